@@ -0,0 +1,199 @@
+//
+//  SPCContention.c
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 21/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#include "SPCContention.h"
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SPUtils.h"
+
+
+
+#pragma mark - Records
+
+
+
+/**
+ *  The counters of a thread. A record is only written to by the thread that owns it. A reset moves its baseline
+ *  rather than clearing its counters, so it never races with the owner.
+ */
+struct SPCContentionRecord {
+    SPCContentionCounters            _counters;
+    SPCContentionCounters            _baseline;
+    volatile long                    _owned;
+    struct SPCContentionRecord      *_next;
+};
+
+typedef struct SPCContentionRecord SPCContentionRecord;
+
+
+static SPCContentionRecord *volatile  gRecords;
+static SPCContentionRecord            gOverflowRecord;
+static pthread_key_t                  gRecordKey;
+static pthread_once_t                 gRecordKeyOnce = PTHREAD_ONCE_INIT;
+
+
+
+/**
+ *  Give up a record when its thread exits. Its counts are kept, and the next new thread takes the record over.
+ *
+ *  @param record A record.
+ */
+static void deactivateRecord(void *record)
+{
+    SPCContentionRecord *thisRecord = record;
+
+    SPC_ATOMIC_STORE_EXPLICIT(&thisRecord->_owned, 0, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Create the thread-specific key of the records.
+ */
+static void createRecordKey(void)
+{
+    if (pthread_key_create(&gRecordKey, deactivateRecord) != 0)
+        STD_OUTPUT_ERROR("SPCContention", "can't create a thread-specific key");
+}
+
+
+/**
+ *  Get the calling thread's record, taking over the record of an exited thread or adding a new one if needed.
+ *
+ *  @param create Whether to add a record if the thread has none yet.
+ *
+ *  @return The calling thread's record; NULL if it has none and create is false.
+ */
+static SPCContentionRecord *acquireRecord(bool create)
+{
+    pthread_once(&gRecordKeyOnce, createRecordKey);
+
+    SPCContentionRecord *record = pthread_getspecific(gRecordKey);
+    if (record || !create)
+        return record;
+
+    for (record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&gRecords, SPC_MEMORY_ORDER_ACQUIRE)); record; record = record->_next)
+        if (!SPC_ATOMIC_LOAD_EXPLICIT(&record->_owned, SPC_MEMORY_ORDER_RELAXED) &&
+            SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&record->_owned, 0, 1, SPC_MEMORY_ORDER_ACQ_REL))
+            break;
+
+    if (!record) {
+        record = calloc(1, sizeof(SPCContentionRecord));
+        if (!record) {
+            STD_OUTPUT_ERROR("SPCContention", "out of memory");
+            return &gOverflowRecord;
+        }
+
+        record->_owned = 1;
+
+        for (;;) {
+            record->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&gRecords, SPC_MEMORY_ORDER_RELAXED));
+            if (SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&gRecords, record->_next, record, SPC_MEMORY_ORDER_RELEASE))
+                break;
+        }
+    }
+
+    pthread_setspecific(gRecordKey, record);
+    return record;
+}
+
+
+/**
+ *  Get the counters of the calling thread, adding a record for it if needed.
+ *
+ *  @return The calling thread's counters; a shared overflow record if a record could not be allocated.
+ */
+SPCContentionCounters *SPC__contentionThreadCounters(void)
+{
+    return &acquireRecord(true)->_counters;
+}
+
+
+/**
+ *  Add the counts of a record since its last reset to a set of counters.
+ *
+ *  @param counters A pointer to the counters to add to.
+ *  @param record   A record.
+ */
+static void accumulateRecord(SPCContentionCounters *counters, const SPCContentionRecord *record)
+{
+    for (size_t idx = 0; idx < kSPCContentionSiteCount; ++idx) {
+        counters->_casAttempts[idx] += record->_counters._casAttempts[idx] - record->_baseline._casAttempts[idx];
+        counters->_casFailures[idx] += record->_counters._casFailures[idx] - record->_baseline._casFailures[idx];
+    }
+    for (size_t idx = 0; idx < kSPCContentionEventCount; ++idx)
+        counters->_events[idx] += record->_counters._events[idx] - record->_baseline._events[idx];
+}
+
+
+
+#pragma mark - Snapshots
+
+
+
+/**
+ *  Add up the counters of all threads since the last reset.
+ *
+ *  @param counters A pointer to the counters to fill in.
+ *
+ *  @return true if contention statistics are compiled in; false (and zeroed counters), otherwise.
+ */
+bool SPCContentionSnapshot(SPCContentionCounters *counters)
+{
+    assert(counters);
+
+    memset(counters, 0, sizeof(SPCContentionCounters));
+
+    SPCContentionRecord *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&gRecords, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next)
+        accumulateRecord(counters, record);
+    accumulateRecord(counters, &gOverflowRecord);
+
+    return SPC_CONTENTION_STATS;
+}
+
+
+/**
+ *  Get the counters of the calling thread since the last reset.
+ *
+ *  @param counters A pointer to the counters to fill in.
+ *
+ *  @return true if contention statistics are compiled in; false (and zeroed counters), otherwise.
+ */
+bool SPCContentionSnapshotThread(SPCContentionCounters *counters)
+{
+    assert(counters);
+
+    memset(counters, 0, sizeof(SPCContentionCounters));
+
+    SPCContentionRecord *record = acquireRecord(false);
+    if (record)
+        accumulateRecord(counters, record);
+
+    return SPC_CONTENTION_STATS;
+}
+
+
+/**
+ *  Start counting from zero again, for all threads.
+ */
+void SPCContentionReset(void)
+{
+    SPCContentionRecord *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&gRecords, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next)
+        record->_baseline = record->_counters;
+    gOverflowRecord._baseline = gOverflowRecord._counters;
+}
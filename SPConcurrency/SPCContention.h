@@ -0,0 +1,164 @@
+//
+//  SPCContention.h
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 21/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#ifndef PZ_SPCContention_h
+#define PZ_SPCContention_h
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "SPCPrimitives.h"
+
+
+
+/**
+ *  Contention statistics for the lock-free structures: how often each compare-and-swap retry loop is attempted and
+ *  fails, how often operations help each other, and how often the node pools run dry.
+ *
+ *  Each thread counts into its own record, so counting never adds shared writes. The records outlive their threads,
+ *  and snapshots add up all of them.
+ *
+ *  Compiled in only when SPC_CONTENTION_STATS is defined as 1 (for the whole library). Otherwise the counting macros
+ *  expand to the bare compare-and-swap, and snapshots come back empty.
+ */
+#ifndef SPC_CONTENTION_STATS
+#    define SPC_CONTENTION_STATS 0
+#endif
+
+
+
+#pragma mark - Counters
+
+
+
+/**
+ *  The compare-and-swap call sites that are counted.
+ */
+typedef enum SPCContentionSite {
+    kSPCContentionSiteFreeListPop = 0,      // Taking nodes off a pool's shared free list.
+    kSPCContentionSiteFreeListPush,         // Returning nodes to a pool's shared free list.
+    kSPCContentionSiteRefCountRelease,      // Dropping a reference count to zero and claiming the node.
+    kSPCContentionSiteRecordList,           // Adding or adopting magazines, slabs and per-thread reclamation records.
+    kSPCContentionSiteHazardRetire,         // Handing retired nodes in and out of hazard pointer records.
+    kSPCContentionSiteEpochAdvance,         // Advancing the global epoch.
+    kSPCContentionSiteQueueInsert,          // Linking a new node into the bottom level of a priority queue.
+    kSPCContentionSiteQueueInsertLevel,     // Linking a new node into the upper levels of a priority queue.
+    kSPCContentionSiteQueueExtract,         // Claiming the first element of a priority queue (the head contention).
+    kSPCContentionSiteQueueMark,            // Marking the links of a deleted priority queue node.
+    kSPCContentionSiteQueueUnlink,          // Unlinking a deleted priority queue node.
+    kSPCContentionSiteListInsert,           // Linking a new node into a lock-free list.
+    kSPCContentionSiteListMark,             // Marking a lock-free list node as deleted.
+    kSPCContentionSiteListUnlink,           // Unlinking a deleted lock-free list node.
+    kSPCContentionSiteCount
+} SPCContentionSite;
+
+
+/**
+ *  The events that are counted.
+ */
+typedef enum SPCContentionEvent {
+    kSPCContentionEventQueueHelp = 0,       // Helping to finish the deletion of a priority queue node.
+    kSPCContentionEventListHelp,            // Helping to unlink a deleted lock-free list node.
+    kSPCContentionEventPoolExhausted,       // Failing to allocate a node.
+    kSPCContentionEventPoolGrown,           // Chaining a slab from the growth reserve.
+    kSPCContentionEventPoolReclaim,         // Forcing deleted nodes back to an empty pool (hazard pointers and epochs).
+    kSPCContentionEventMagazineRefill,      // Refilling a magazine from the shared free list.
+    kSPCContentionEventMagazineSpill,       // Spilling a full magazine to the shared free list.
+    kSPCContentionEventCount
+} SPCContentionEvent;
+
+
+/**
+ *  A set of contention counters.
+ */
+struct SPCContentionCounters {
+    uint64_t _casAttempts[kSPCContentionSiteCount];
+    uint64_t _casFailures[kSPCContentionSiteCount];
+    uint64_t _events[kSPCContentionEventCount];
+};
+
+typedef struct SPCContentionCounters SPCContentionCounters;
+
+
+
+#pragma mark - Snapshots
+
+
+
+/**
+ *  Add up the counters of all threads since the last reset. Threads that keep counting meanwhile may be
+ *  partially included.
+ *
+ *  @param counters A pointer to the counters to fill in.
+ *
+ *  @return true if contention statistics are compiled in; false (and zeroed counters), otherwise.
+ */
+bool SPCContentionSnapshot(SPCContentionCounters *counters);
+
+
+/**
+ *  Get the counters of the calling thread since the last reset.
+ *
+ *  @param counters A pointer to the counters to fill in.
+ *
+ *  @return true if contention statistics are compiled in; false (and zeroed counters), otherwise.
+ */
+bool SPCContentionSnapshotThread(SPCContentionCounters *counters);
+
+
+/**
+ *  Start counting from zero again, for all threads.
+ */
+void SPCContentionReset(void);
+
+
+
+#pragma mark - Counting
+
+
+
+/**
+ *  Get the counters of the calling thread, adding a record for it if needed.
+ *
+ *  @return The calling thread's counters; a shared overflow record if a record could not be allocated.
+ */
+SPCContentionCounters *SPC__contentionThreadCounters(void);
+
+
+/**
+ *  Count a compare-and-swap attempt, and its failure.
+ *
+ *  @param site      The call site.
+ *  @param succeeded The result of the compare-and-swap.
+ *
+ *  @return succeeded
+ */
+static FORCE_INLINE bool SPC__contentionCountCAS(SPCContentionSite site, bool succeeded)
+{
+    SPCContentionCounters *counters = SPC__contentionThreadCounters();
+
+    ++counters->_casAttempts[site];
+    if (__builtin_expect(!succeeded, 0))
+        ++counters->_casFailures[site];
+
+    return succeeded;
+}
+
+
+#if SPC_CONTENTION_STATS
+#    define SPC_CONTENTION_CAS(site, cas)    SPC__contentionCountCAS((site), (cas))
+#    define SPC_CONTENTION_EVENT(event)      ((void)(++SPC__contentionThreadCounters()->_events[(event)]))
+#else
+#    define SPC_CONTENTION_CAS(site, cas)    (cas)
+#    define SPC_CONTENTION_EVENT(event)      ((void)0)
+#endif
+
+
+
+#endif
@@ -0,0 +1,335 @@
+//
+//  SPCFutex.h
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 18/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#ifndef PZ_SPCFutex_h
+#define PZ_SPCFutex_h
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#if defined __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "SPCPrimitives.h"
+
+
+
+/**
+ *  Futex-style waiting on a 32-bit word: a thread sleeps only while the word still has the value it expects,
+ *  so a wake-up issued between reading the word and going to sleep is never lost.
+ *
+ *  Backed by futex(2) on Linux, and on Darwin by os_sync_wait_on_address() where the OS has it (macOS 14.4,
+ *  iOS 17.4 and later). Elsewhere, or when built with SPC_FUTEX_POLLING, waiting degrades to polling the word
+ *  with short sleeps.
+ *
+ *  Define SPC_FUTEX_ULOCK to use the ulock interface on Darwin instead, which works on all OS versions. It is
+ *  private API, so App Store builds must not define it.
+ */
+
+
+
+#pragma mark - Platform interface
+
+
+
+#if defined __APPLE__ && !defined SPC_FUTEX_POLLING
+
+#if defined SPC_FUTEX_ULOCK
+
+#define SPC__ULOCK_COMPARE_AND_WAIT 1
+#define SPC__ULOCK_WAKE_ALL         0x00000100
+#define SPC__ULOCK_NO_ERRNO         0x01000000
+
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout_us);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+
+#elif __has_include(<os/os_sync_wait_on_address.h>)
+
+#include <os/clock.h>
+#include <os/os_sync_wait_on_address.h>
+
+#define SPC__FUTEX_OS_SYNC 1
+
+#define SPC__OS_SYNC_AVAILABLE() __builtin_available(macOS 14.4, iOS 17.4, tvOS 17.4, watchOS 10.4, *)
+
+#endif
+
+#endif
+
+
+
+#pragma mark - Futex word
+
+
+
+/**
+ *  A futex word. (The concurrency primitives operate on pointer-sized words, so futex words have their own accessors.)
+ */
+typedef volatile uint32_t spc_futex_t;
+
+
+/**
+ *  Atomically load the value of a futex word.
+ *
+ *  @param word A pointer to the futex word.
+ *
+ *  @return The current value.
+ */
+static FORCE_INLINE uint32_t SPCFutexLoad(spc_futex_t *word)
+{
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ *  Atomically add to the value of a futex word.
+ *
+ *  @param word  A pointer to the futex word.
+ *  @param value The value to add.
+ *
+ *  @return The previous value.
+ */
+static FORCE_INLINE uint32_t SPCFutexFetchAndAdd(spc_futex_t *word, uint32_t value)
+{
+    return __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ *  Atomically OR bits into the value of a futex word.
+ *
+ *  @param word A pointer to the futex word.
+ *  @param bits The bits to set.
+ *
+ *  @return The previous value.
+ */
+static FORCE_INLINE uint32_t SPCFutexFetchAndOr(spc_futex_t *word, uint32_t bits)
+{
+    return __atomic_fetch_or(word, bits, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ *  Atomically replace the value of a futex word if it holds the expected value.
+ *
+ *  @param word          A pointer to the futex word.
+ *  @param expectedValue A pointer to the expected value; updated with the current value on failure.
+ *  @param newValue      The new value.
+ *
+ *  @return true if the value was replaced; false, otherwise.
+ */
+static FORCE_INLINE bool SPCFutexCompareAndSwap(spc_futex_t *word, uint32_t *expectedValue, uint32_t newValue)
+{
+    return __atomic_compare_exchange_n(word, expectedValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE);
+}
+
+
+
+#pragma mark - Waiting and waking
+
+
+
+/**
+ *  Wait until the word is woken up, as long as it holds the expected value.
+ *
+ *  Spurious wake-ups are possible, so callers are expected to re-check their condition.
+ *
+ *  @param word          A pointer to the futex word.
+ *  @param expectedValue The value the word is expected to hold.
+ *  @param timeoutNSec   The maximum time to wait (in nanoseconds); 0 to wait indefinitely.
+ */
+static FORCE_INLINE void SPCFutexWait(spc_futex_t *word, uint32_t expectedValue, uint64_t timeoutNSec)
+{
+#if defined __linux__
+
+    struct timespec timeout = { (time_t)(timeoutNSec / 1000000000), (long)(timeoutNSec % 1000000000) };
+    (void)syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expectedValue, timeoutNSec ? &timeout : NULL, NULL, 0);
+
+#elif defined __APPLE__ && !defined SPC_FUTEX_POLLING && defined SPC_FUTEX_ULOCK
+
+    uint64_t timeoutUSec = (timeoutNSec + 999) / 1000;
+    (void)__ulock_wait(SPC__ULOCK_COMPARE_AND_WAIT | SPC__ULOCK_NO_ERRNO,
+                       (void *)word,
+                       expectedValue,
+                       timeoutUSec > UINT32_MAX ? UINT32_MAX : (uint32_t)timeoutUSec);
+
+#else
+
+#if defined SPC__FUTEX_OS_SYNC
+    if (SPC__OS_SYNC_AVAILABLE()) {
+        if (timeoutNSec)
+            (void)os_sync_wait_on_address_with_timeout((void *)word, expectedValue, sizeof(*word), OS_SYNC_WAIT_ON_ADDRESS_NONE,
+                                                       OS_CLOCK_MACH_ABSOLUTE_TIME, timeoutNSec);
+        else
+            (void)os_sync_wait_on_address((void *)word, expectedValue, sizeof(*word), OS_SYNC_WAIT_ON_ADDRESS_NONE);
+
+        return;
+    }
+#endif
+
+    const uint64_t kPollIntervalNSec = 100000;
+
+    for (uint64_t waited = 0; !timeoutNSec || waited < timeoutNSec; waited += kPollIntervalNSec) {
+        if (SPCFutexLoad(word) != expectedValue)
+            return;
+
+        usleep((useconds_t)(kPollIntervalNSec / 1000));
+    }
+
+#endif
+}
+
+
+/**
+ *  Wake up threads waiting on the word.
+ *
+ *  @param word    A pointer to the futex word.
+ *  @param wakeAll Wake up all waiting threads if true; just one, otherwise.
+ */
+static FORCE_INLINE void SPCFutexWake(spc_futex_t *word, bool wakeAll)
+{
+#if defined __linux__
+
+    (void)syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, wakeAll ? INT32_MAX : 1, NULL, NULL, 0);
+
+#elif defined __APPLE__ && !defined SPC_FUTEX_POLLING && defined SPC_FUTEX_ULOCK
+
+    (void)__ulock_wake(SPC__ULOCK_COMPARE_AND_WAIT | SPC__ULOCK_NO_ERRNO | (wakeAll ? SPC__ULOCK_WAKE_ALL : 0),
+                       (void *)word,
+                       0);
+
+#elif defined SPC__FUTEX_OS_SYNC
+
+    if (SPC__OS_SYNC_AVAILABLE()) {
+        if (wakeAll)
+            (void)os_sync_wake_by_address_all((void *)word, sizeof(*word), OS_SYNC_WAKE_BY_ADDRESS_NONE);
+        else
+            (void)os_sync_wake_by_address_any((void *)word, sizeof(*word), OS_SYNC_WAKE_BY_ADDRESS_NONE);
+    }
+
+#else
+
+    (void)word;
+    (void)wakeAll;
+
+#endif
+}
+
+
+
+#pragma mark - Completion
+
+
+
+/**
+ *  A one-shot completion: one thread waits for another to signal that some work is done.
+ *
+ *  The waiter spins briefly before sleeping, and the signaller only makes a system call if the waiter is asleep.
+ */
+struct SPCCompletion {
+    spc_futex_t _state;
+};
+
+typedef struct SPCCompletion SPCCompletion;
+
+
+enum {
+    kSPCCompletionPending  = 0,
+    kSPCCompletionDone     = 1,
+    kSPCCompletionSleeping = 2,
+};
+
+
+/**
+ *  Init a completion.
+ *
+ *  @param completion A pointer to the completion.
+ */
+static FORCE_INLINE void SPCCompletionInit(SPCCompletion *completion)
+{
+    __atomic_store_n(&completion->_state, kSPCCompletionPending, __ATOMIC_RELAXED);
+}
+
+
+/**
+ *  Signal a completion, waking up the waiter if it is asleep.
+ *
+ *  @param completion A pointer to the completion.
+ */
+static FORCE_INLINE void SPCCompletionSignal(SPCCompletion *completion)
+{
+    if (__atomic_exchange_n(&completion->_state, kSPCCompletionDone, __ATOMIC_RELEASE) == kSPCCompletionSleeping)
+        SPCFutexWake(&completion->_state, true);
+}
+
+
+/**
+ *  Check if a completion has been signalled.
+ *
+ *  @param completion A pointer to the completion.
+ *
+ *  @return true if signalled; false, otherwise.
+ */
+static FORCE_INLINE bool SPCCompletionIsDone(SPCCompletion *completion)
+{
+    return SPCFutexLoad(&completion->_state) == kSPCCompletionDone;
+}
+
+
+/**
+ *  Wait for a completion to be signalled.
+ *
+ *  @param completion  A pointer to the completion.
+ *  @param spinCount   The number of polls before sleeping.
+ *  @param timeoutNSec The maximum time to sleep (in nanoseconds); 0 to wait indefinitely.
+ *
+ *  @return true if the completion was signalled; false if the wait timed out.
+ */
+static FORCE_INLINE bool SPCCompletionWait(SPCCompletion *completion, unsigned int spinCount, uint64_t timeoutNSec)
+{
+    for (unsigned int spin = 0; spin < spinCount; ++spin) {
+        if (SPCCompletionIsDone(completion))
+            return true;
+
+        SPC_STALL();
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint64_t giveUpTime = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec + timeoutNSec;
+
+    for (;;) {
+        // Announce the sleep, unless the completion has been signalled in the meantime.
+        uint32_t state = kSPCCompletionPending;
+        if (!__atomic_compare_exchange_n(&completion->_state, &state, kSPCCompletionSleeping, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE) &&
+            state == kSPCCompletionDone)
+            return true;
+
+        uint64_t remaining = 0;
+        if (timeoutNSec) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const uint64_t nowNSec = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+            if (nowNSec >= giveUpTime)
+                return SPCCompletionIsDone(completion);
+
+            remaining = giveUpTime - nowNSec;
+        }
+
+        SPCFutexWait(&completion->_state, kSPCCompletionSleeping, remaining);
+    }
+}
+
+
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "SPCPrimitives.h"
 #include "SPCMemoryReclamation.h"
+#include "SPCContention.h"
 
 
 
@@ -54,6 +55,68 @@ static bool unlinkNode(SPCLockFreeList *list, SPCLockFreeListNode *nodeToUnlink,
 
 
 
+/**
+ *  Check if a node is retained (i.e. isn't in the free list).
+ *
+ *  @param list A lock-free list.
+ *  @param node A node to check.
+ *
+ *  @return true if retained; false, otherwise.
+ */
+static FORCE_INLINE bool isNodeRetained(SPCLockFreeList *list, SPCLockFreeListNode *node)
+{
+    // Under hazard pointers, the node may have been claimed by the thread that deleted it while we still hold it.
+    if (list->_reclamationScheme == kSPCMemoryReclamationHazardPointers &&
+        cmem_hazardIsProtected(cmem_hazardAcquireRecord(&list->_hazardDomain), node))
+        return true;
+    
+    return cmem_isRetained(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c));
+}
+
+
+/**
+ *  Take a reference to a node, without checking that it is retained.
+ *
+ *  Under hazard pointers, the node is published in a hazard slot of the calling thread, and its reference count
+ *  is only used if the thread has no free slot left.
+ *
+ *  @param list A lock-free list.
+ *  @param node A node.
+ */
+static FORCE_INLINE void referenceNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
+{
+    // Under epochs, nodes reachable during an operation stay valid until it ends.
+    if (list->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        return;
+    
+    if (list->_reclamationScheme != kSPCMemoryReclamationHazardPointers ||
+        !cmem_hazardProtect(cmem_hazardAcquireRecord(&list->_hazardDomain), node))
+        cmem_retainNode(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c));
+}
+
+
+/**
+ *  Drop a reference to a node, without checking that it is retained.
+ *
+ *  @param list A lock-free list.
+ *  @param node A node.
+ */
+static FORCE_INLINE void dereferenceNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
+{
+    if (list->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        return;
+    
+    if (list->_reclamationScheme == kSPCMemoryReclamationHazardPointers) {
+        cmem_hazard_record_t *record = cmem_hazardAcquireRecord(&list->_hazardDomain);
+        if (!cmem_hazardUnprotect(record, node))
+            cmem_hazardReleaseNode(&list->_hazardDomain, record, node);
+        return;
+    }
+    
+    cmem_poolReleaseNode(&list->_pool, node, 1, -1);
+}
+
+
 /**
  *  Create a new node.
  *
@@ -67,9 +130,15 @@ static FORCE_INLINE SPCLockFreeListNode *createNode(SPCLockFreeList *list, long
 {
     assert(list);
 
-    SPCLockFreeListNode *newNode = cmem_allocNode((void *volatile *)(&list->_freeList),
-                                                  offsetof(SPCLockFreeListNode, _cmem_refCount_c),
-                                                  offsetof(SPCLockFreeListNode, _next_d));
+    // Under hazard pointers or epochs, deleted nodes may still be held back by other threads.
+    if (!cmem_poolHasFreeNodes(&list->_pool)) {
+        if (list->_reclamationScheme == kSPCMemoryReclamationHazardPointers)
+            (void)cmem_hazardReclaim(&list->_hazardDomain, cmem_hazardAcquireRecord(&list->_hazardDomain));
+        else if (list->_reclamationScheme == kSPCMemoryReclamationEpochs)
+            (void)cmem_epochReclaim(&list->_epochDomain, cmem_epochAcquireRecord(&list->_epochDomain));
+    }
+
+    SPCLockFreeListNode *newNode = cmem_poolAllocNode(&list->_pool);
     if (!newNode)
         return NULL;
     
@@ -86,15 +155,16 @@ static FORCE_INLINE SPCLockFreeListNode *createNode(SPCLockFreeList *list, long
 /**
  *  Retain a node.
  *
+ *  @param list A list.
  *  @param node A node.
  *
  *  @return The retained node.
  */
-static FORCE_INLINE SPCLockFreeListNode *retainNode(SPCLockFreeListNode *node)
+static FORCE_INLINE SPCLockFreeListNode *retainNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
 {
-    assert(cmem_isRetained(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c)));
+    assert(isNodeRetained(list, node));
     
-    cmem_retainNode(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c));
+    referenceNode(list, node);
     
     return node;
 }
@@ -108,14 +178,82 @@ static FORCE_INLINE SPCLockFreeListNode *retainNode(SPCLockFreeListNode *node)
  */
 static FORCE_INLINE void releaseNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
 {
-    assert(cmem_isRetained(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c)));
-    
-    return cmem_releaseNode(node,
-                            offsetof(SPCLockFreeListNode, _cmem_refCount_c),
-                            offsetof(SPCLockFreeListNode, _next_d),
-                            1,
-                            -1,
-                            (void *volatile *)(&list->_freeList));
+    assert(isNodeRetained(list, node));
+    
+    dereferenceNode(list, node);
+}
+
+
+/**
+ *  Delete a node, by releasing the reference the list holds to it.
+ *
+ *  @param list A list.
+ *  @param node A node that has been unlinked from the list (or never linked).
+ */
+static FORCE_INLINE void deleteNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
+{
+    assert(isNodeRetained(list, node));
+    
+    if (list->_reclamationScheme == kSPCMemoryReclamationHazardPointers) {
+        // The hazard slots only hold the references of traversals.
+        cmem_hazardReleaseNode(&list->_hazardDomain, cmem_hazardAcquireRecord(&list->_hazardDomain), node);
+        return;
+    }
+    
+    if (list->_reclamationScheme == kSPCMemoryReclamationEpochs) {
+        cmem_epochRetireNode(&list->_epochDomain, cmem_epochAcquireRecord(&list->_epochDomain), node);
+        return;
+    }
+    
+    dereferenceNode(list, node);
+}
+
+
+/**
+ *  Delete a node that was never linked into the list, so no other thread can have seen it.
+ *
+ *  @param list A list.
+ *  @param node A node.
+ */
+static FORCE_INLINE void discardNode(SPCLockFreeList *list, SPCLockFreeListNode *node)
+{
+    // Under epochs, the node can skip limbo.
+    if (list->_reclamationScheme == kSPCMemoryReclamationEpochs) {
+        cmem_epochFreeNode(&list->_epochDomain, node);
+        return;
+    }
+    
+    deleteNode(list, node);
+}
+
+
+/**
+ *  Begin a public operation on the list. Under epochs, announces the current epoch.
+ *
+ *  @param list A list.
+ *
+ *  @return The calling thread's epoch record; NULL under other schemes.
+ */
+static FORCE_INLINE cmem_epoch_record_t *beginOperation(SPCLockFreeList *list)
+{
+    if (list->_reclamationScheme != kSPCMemoryReclamationEpochs)
+        return NULL;
+    
+    return cmem_epochEnter(&list->_epochDomain);
+}
+
+
+/**
+ *  End a public operation on the list.
+ *
+ *  @param list   A list.
+ *  @param record The record returned by beginOperation().
+ */
+static FORCE_INLINE void endOperation(SPCLockFreeList *list, cmem_epoch_record_t *record)
+{
+    (void)list;
+    
+    cmem_epochLeave(record);
 }
 
 
@@ -142,22 +280,20 @@ static FORCE_INLINE SPCLockFreeListNode *readAndRetainNode_d(SPCLockFreeList *li
         
         SPCLockFreeListNode *node = toPtr_m(node_d);
         assert(node);
+        
+        if (list->_reclamationScheme == kSPCMemoryReclamationEpochs)
+            return node;
 
-        cmem_retainNode(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c));
+        referenceNode(list, node);
         SPC_MEMORY_BARRIER_FULL();
 
         if (node_d == *node_d_Ptr) {
-            assert(cmem_isRetained(node, offsetof(SPCLockFreeListNode, _cmem_refCount_c)));
+            assert(isNodeRetained(list, node));
             
             return node;
         } else {
             // This should never need to use the free list unless we preempted a reclaim.
-            cmem_releaseNode(node,
-                             offsetof(SPCLockFreeListNode, _cmem_refCount_c),
-                             offsetof(SPCLockFreeListNode, _next_d),
-                             1,
-                             -1,
-                             (void *volatile *)(&list->_freeList));
+            dereferenceNode(list, node);
         }
     }
 }
@@ -177,9 +313,39 @@ static FORCE_INLINE SPCLockFreeListNode *readAndRetainNode_d(SPCLockFreeList *li
  *  @return true if successful; false, otherwise.
  */
 bool SPCLockFreeListInit(SPCLockFreeList *list, size_t length)
+{
+    return SPCLockFreeListInitWithReclamationScheme(list, length, kSPCMemoryReclamationReferenceCounting);
+}
+
+
+/**
+ *  Initialize a concurrent lock-free list with a given memory reclamation scheme.
+ *
+ *  @param list   A pointer to a lock-free list.
+ *  @param length The list length. (More memory may actually be allocated.)
+ *  @param scheme The memory reclamation scheme.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListInitWithReclamationScheme(SPCLockFreeList *list, size_t length, SPCMemoryReclamationScheme scheme)
 {
     assert(list);
     
+    list->_storage           = NULL;
+    list->_reclamationScheme = kSPCMemoryReclamationReferenceCounting;
+    
+    if (scheme == kSPCMemoryReclamationHazardPointers) {
+        if (!cmem_hazardInit(&list->_hazardDomain, &list->_pool))
+            return false;
+        
+        list->_reclamationScheme = scheme;
+    } else if (scheme == kSPCMemoryReclamationEpochs) {
+        if (!cmem_epochInit(&list->_epochDomain, &list->_pool))
+            return false;
+        
+        list->_reclamationScheme = scheme;
+    }
+    
     //
     // Allocate memory for the nodes.
     // (Reserve 2 nodes for head and tail.)
@@ -198,12 +364,12 @@ bool SPCLockFreeListInit(SPCLockFreeList *list, size_t length)
     //
     // Prepare the free list for the custom lock-free memory allocator.
     //
-    cmem_init((void *volatile *)(&list->_freeList),
-              offsetof(SPCLockFreeListNode, _cmem_refCount_c),
-              offsetof(SPCLockFreeListNode, _next_d),
-              sizeof(SPCLockFreeListNode),
-              list->_storage,
-              listLength);
+    cmem_poolInit(&list->_pool,
+                  offsetof(SPCLockFreeListNode, _cmem_refCount_c),
+                  offsetof(SPCLockFreeListNode, _next_d),
+                  sizeof(SPCLockFreeListNode),
+                  list->_storage,
+                  listLength);
     
     list->_head = createNode(list, LONG_MIN, NULL);
     list->_tail = createNode(list, LONG_MAX, NULL);
@@ -218,6 +384,64 @@ bool SPCLockFreeListInit(SPCLockFreeList *list, size_t length)
 }
 
 
+/**
+ *  Put per-thread magazines of free nodes in front of the list's shared free list. Call before the list is shared
+ *  between threads.
+ *
+ *  A thread then allocates and deletes nodes in its own magazine, and only touches the shared free list to refill
+ *  half of an empty magazine or to spill half of a full one. Each thread may keep up to magazineSize free nodes to
+ *  itself, so allow for that in the length.
+ *
+ *  @param list         A pointer to a lock-free list.
+ *  @param magazineSize The number of free nodes a thread can keep (capped at kCMemMaxMagazineSize).
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListEnableMagazines(SPCLockFreeList *list, size_t magazineSize)
+{
+    assert(list);
+    
+    return cmem_poolEnableMagazines(&list->_pool, magazineSize);
+}
+
+
+/**
+ *  Let the list grow by slabs of nodes once its length is used up, instead of failing to insert. Call before the list
+ *  is shared between threads.
+ *
+ *  Inserts stay lock-free and never allocate memory: an exhausted list chains a slab from a reserve of preallocated
+ *  slabs, which SPCLockFreeListReplenishGrowthReserve() refills. Nodes never move, and slabs are only freed with the list.
+ *
+ *  @param list          A pointer to a lock-free list.
+ *  @param slabLength    The number of nodes in a slab.
+ *  @param reserveLength The number of slabs to keep in reserve.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListEnableGrowth(SPCLockFreeList *list, size_t slabLength, size_t reserveLength)
+{
+    assert(list);
+    
+    return cmem_poolEnableGrowth(&list->_pool, slabLength, reserveLength);
+}
+
+
+/**
+ *  Refill the growth reserve of the list. Allocates memory, so call it from a non-real-time context, e.g. periodically
+ *  or after an insert has failed. Safe to call while other threads use the list.
+ *
+ *  @param list A pointer to a lock-free list.
+ *
+ *  @return true if the reserve is full; false, otherwise.
+ */
+bool SPCLockFreeListReplenishGrowthReserve(SPCLockFreeList *list)
+{
+    assert(list);
+    
+    return cmem_poolReplenishReserve(&list->_pool);
+}
+
+
 /**
  *  Dispose of a concurrent lock-free list.
  *
@@ -228,6 +452,14 @@ void SPCLockFreeListDispose(SPCLockFreeList *list)
     // Prevent old changes from being observed happening after the queue release.
     SPC_MEMORY_BARRIER_STORE();
     
+    if (list->_reclamationScheme == kSPCMemoryReclamationHazardPointers)
+        cmem_hazardDispose(&list->_hazardDomain);
+    else if (list->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        cmem_epochDispose(&list->_epochDomain);
+    
+    if (list->_storage)
+        cmem_poolDispose(&list->_pool);
+    
     free(list->_storage);
     
     memset(list, 0, sizeof(SPCLockFreeList));
@@ -258,7 +490,7 @@ static SPCLockFreeListNode *readNextNode_r(SPCLockFreeList *list, SPCLockFreeLis
     assert(list);
     assert(rNodePtr && *rNodePtr);
     assert(rPrevNode);
-    assert(cmem_isRetained(*rNodePtr, offsetof(SPCLockFreeListNode, _cmem_refCount_c)));
+    assert(isNodeRetained(list, *rNodePtr));
 
     if (*rNodePtr == list->_tail)
         return NULL;
@@ -268,6 +500,7 @@ static SPCLockFreeListNode *readNextNode_r(SPCLockFreeList *list, SPCLockFreeLis
 
         // Try to delete the marked node.
         //
+        SPC_CONTENTION_EVENT(kSPCContentionEventListHelp);
         if (!unlinkNode(list, *rNodePtr, &rPrevNode)) {
             return NULL;
         }
@@ -318,7 +551,7 @@ retry:
         
         // Start the search from the head.
         //
-        *rPrevPtr = retainNode(list->_head);
+        *rPrevPtr = retainNode(list, list->_head);
         SPCLockFreeListNode *rCurNode = readAndRetainNode_d(list, &(*rPrevPtr)->_next_d);
         
         for (;;) {
@@ -364,7 +597,7 @@ retry:
 
 
 /**
- *  Insert an element into a lock-free list.
+ *  Insert an element into a lock-free list (within an operation).
  *
  *  @param list A pointer to a lock-free list.
  *  @param key  A key.
@@ -372,7 +605,7 @@ retry:
  *
  *  @return true if successful.
  */
-bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
+static bool insertElement(SPCLockFreeList *list, long key, void *data)
 {
     assert(list);
     
@@ -387,7 +620,7 @@ bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
     if (!rNewNode)
         return false;
     
-    retainNode(rNewNode);
+    retainNode(list, rNewNode);
     
     for (;;) {
         //
@@ -401,7 +634,7 @@ bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
             releaseNode(list, rInsertionPoint);
             releaseNode(list, rNewNode);
             rNewNode->_next_d = toMarkable(NULL, false);
-            releaseNode(list, rNewNode); // Delete the node.
+            discardNode(list, rNewNode);
             
             return true; // maybe should return false?
         } else {
@@ -410,7 +643,7 @@ bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
             //
             rNewNode->_next_d = toMarkable(rNextNode, false);
             SPC_MEMORY_BARRIER_STORE();
-            if (SPC_ATOMIC_COMPARE_AND_SWAP(&rInsertionPoint->_next_d, toMarkable(rNextNode, false), toMarkable(rNewNode, false))) {
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteListInsert, SPC_ATOMIC_COMPARE_AND_SWAP(&rInsertionPoint->_next_d, toMarkable(rNextNode, false), toMarkable(rNewNode, false)))) {
 
                 releaseNode(list, rNextNode);
                 releaseNode(list, rInsertionPoint);
@@ -425,6 +658,27 @@ bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
 }
 
 
+/**
+ *  Insert an element into a lock-free list.
+ *
+ *  @param list A pointer to a lock-free list.
+ *  @param key  A key.
+ *  @param data The element.
+ *
+ *  @return true if successful.
+ */
+bool SPCLockFreeListInsertElement(SPCLockFreeList *list, long key, void *data)
+{
+    assert(list);
+    
+    cmem_epoch_record_t *record = beginOperation(list);
+    bool successful = insertElement(list, key, data);
+    endOperation(list, record);
+    
+    return successful;
+}
+
+
 
 #pragma mark - Deletion
 
@@ -445,7 +699,7 @@ static bool unlinkNode(SPCLockFreeList *list, SPCLockFreeListNode *nodeToUnlink,
     
     markable_ptr_t nextNode_m = toMarkable_m(nodeToUnlink->_next_d, false);
     
-    if (!SPC_ATOMIC_COMPARE_AND_SWAP(&(*rPrevPtr)->_next_d, toMarkable(nodeToUnlink, false), nextNode_m)) {
+    if (!SPC_CONTENTION_CAS(kSPCContentionSiteListUnlink, SPC_ATOMIC_COMPARE_AND_SWAP(&(*rPrevPtr)->_next_d, toMarkable(nodeToUnlink, false), nextNode_m))) {
         // Retry.
         return false;
     }
@@ -462,14 +716,14 @@ static bool unlinkNode(SPCLockFreeList *list, SPCLockFreeListNode *nodeToUnlink,
 
 
 /**
- *  Delete and return the element with the minimum priority value.
+ *  Delete and return the element with the minimum priority value (within an operation).
  *
  *  @param list   A lock-free list.
  *  @param outKey An optional pointer that if passed, will be set to the key of the element.
  *
  *  @return The element with the minimum key value.
  */
-void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
+static void *extractMinimumElement(SPCLockFreeList *list, long *outKey)
 {
     assert(list);
     
@@ -480,12 +734,12 @@ void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
     // Start from the head and get the first node not marked for deletion.
     //
     
-    SPCLockFreeListNode *rPrev = retainNode(list->_head);
+    SPCLockFreeListNode *rPrev = retainNode(list, list->_head);
     for (;;) {
         
         // Start the search from the head.
         //
-        if (!rPrev) { rPrev = retainNode(list->_head); continue; }
+        if (!rPrev) { rPrev = retainNode(list, list->_head); continue; }
         SPCLockFreeListNode *rFirstNode = readAndRetainNode_d(list, &rPrev->_next_d);
         if (!rFirstNode) continue;
         if (rFirstNode == list->_head) {
@@ -525,7 +779,7 @@ void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
         SPC_MEMORY_BARRIER_STORE();
         assert(rNextNode);
         if (!isMarked_m(rFirstNode->_next_d) &&
-            !SPC_ATOMIC_COMPARE_AND_SWAP(&rFirstNode->_next_d, toMarkable(rNextNode, false), toMarkable(rNextNode, true))) {
+            !SPC_CONTENTION_CAS(kSPCContentionSiteListMark, SPC_ATOMIC_COMPARE_AND_SWAP(&rFirstNode->_next_d, toMarkable(rNextNode, false), toMarkable(rNextNode, true)))) {
 
             releaseNode(list, rFirstNode);
             releaseNode(list, rNextNode);
@@ -548,7 +802,7 @@ void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
         releaseNode(list, rPrev);
         releaseNode(list, rFirstNode);
         rFirstNode->_next_d = NULL_D;
-        releaseNode(list, rFirstNode); // Delete the node.
+        deleteNode(list, rFirstNode);
         
         if (outKey)
             *outKey = retKey;
@@ -558,14 +812,14 @@ void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
 
 
 /**
- *  Extract an element with a given key.
+ *  Extract an element with a given key (within an operation).
  *
  *  @param list A pointer to a lock-free list.
  *  @param key  A given key.
  *
  *  @return The element corresponding to the given key; NULL if not found.
  */
-void *SPCLockFreeListExtractElementWithKey(SPCLockFreeList *list, long key)
+static void *extractElementWithKey(SPCLockFreeList *list, long key)
 {
     assert(list);
     
@@ -589,8 +843,8 @@ void *SPCLockFreeListExtractElementWithKey(SPCLockFreeList *list, long key)
             
             // Extract the element, by first flagging, and then deleting the node.
             //
-            SPCLockFreeListNode *rNextNode = retainNode(toPtr_m(rNode->_next_d));
-            if (!SPC_ATOMIC_COMPARE_AND_SWAP(&rNode->_next_d, toMarkable(rNextNode, false), toMarkable(rNextNode, true))) {
+            SPCLockFreeListNode *rNextNode = retainNode(list, toPtr_m(rNode->_next_d));
+            if (!SPC_CONTENTION_CAS(kSPCContentionSiteListMark, SPC_ATOMIC_COMPARE_AND_SWAP(&rNode->_next_d, toMarkable(rNextNode, false), toMarkable(rNextNode, true)))) {
                 releaseNode(list, rPrev);
                 releaseNode(list, rNode);
                 releaseNode(list, rNextNode);
@@ -599,7 +853,7 @@ void *SPCLockFreeListExtractElementWithKey(SPCLockFreeList *list, long key)
             
             SPC_MEMORY_BARRIER_STORE();
             
-            if (!SPC_ATOMIC_COMPARE_AND_SWAP(&rPrev->_next_d, rNode, rNextNode)) {
+            if (!SPC_CONTENTION_CAS(kSPCContentionSiteListUnlink, SPC_ATOMIC_COMPARE_AND_SWAP(&rPrev->_next_d, rNode, rNextNode))) {
                 releaseNode(list, rPrev);
                 releaseNode(list, rNode);
                 releaseNode(list, rNextNode);
@@ -613,10 +867,49 @@ void *SPCLockFreeListExtractElementWithKey(SPCLockFreeList *list, long key)
             releaseNode(list, rNextNode);
             
             releaseNode(list, rNode);
-            releaseNode(list, rNode); // Delete the node.
+            deleteNode(list, rNode);
             
             return data;
         }
     }
 }
 
+
+/**
+ *  Delete and return the element with the minimum priority value.
+ *
+ *  @param list   A lock-free list.
+ *  @param outKey An optional pointer that if passed, will be set to the key of the element.
+ *
+ *  @return The element with the minimum key value.
+ */
+void *SPCLockFreeListExtractMinimumElement(SPCLockFreeList *list, long *outKey)
+{
+    assert(list);
+    
+    cmem_epoch_record_t *record = beginOperation(list);
+    void *data = extractMinimumElement(list, outKey);
+    endOperation(list, record);
+    
+    return data;
+}
+
+
+/**
+ *  Extract an element with a given key.
+ *
+ *  @param list A pointer to a lock-free list.
+ *  @param key  A given key.
+ *
+ *  @return The element corresponding to the given key; NULL if not found.
+ */
+void *SPCLockFreeListExtractElementWithKey(SPCLockFreeList *list, long key)
+{
+    assert(list);
+    
+    cmem_epoch_record_t *record = beginOperation(list);
+    void *data = extractElementWithKey(list, key);
+    endOperation(list, record);
+    
+    return data;
+}
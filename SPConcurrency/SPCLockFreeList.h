@@ -17,6 +17,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "SPCMemoryReclamation.h"
+
 
 
 struct _SPCLockFreeListNode;
@@ -30,9 +32,12 @@ typedef struct _SPCLockFreeListNode SPCLockFreeListNode;
 struct SPCLockFreeList {
     SPCLockFreeListNode          *_head;
     SPCLockFreeListNode          *_tail;
-    SPCLockFreeListNode *volatile _freeList;
+    cmem_pool_t                   _pool;
     void                         *_storage;
     size_t                        _size;
+    SPCMemoryReclamationScheme    _reclamationScheme;
+    cmem_hazard_domain_t          _hazardDomain;
+    cmem_epoch_domain_t           _epochDomain;
 };
 
 typedef struct SPCLockFreeList SPCLockFreeList;
@@ -50,6 +55,67 @@ typedef struct SPCLockFreeList SPCLockFreeList;
 bool SPCLockFreeListInit(SPCLockFreeList *list, size_t length);
 
 
+/**
+ *  Initialize a concurrent lock-free list with a given memory reclamation scheme.
+ *
+ *  Under hazard pointers, traversals leave the nodes they visit untouched. Each thread may hold back a few deleted
+ *  nodes (up to kCMemRetiredSlotCount) before they are reused, so allow for that in the length.
+ *
+ *  Under epochs, neither traversals nor deletions touch the reference counts. Deleted nodes are reused two epochs
+ *  later, once every operation that could still see them has ended.
+ *
+ *  @param list   A pointer to a lock-free list.
+ *  @param length The list length. (More memory may actually be allocated.)
+ *  @param scheme The memory reclamation scheme.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListInitWithReclamationScheme(SPCLockFreeList *list, size_t length, SPCMemoryReclamationScheme scheme);
+
+
+/**
+ *  Put per-thread magazines of free nodes in front of the list's shared free list. Call before the list is shared
+ *  between threads.
+ *
+ *  A thread then allocates and deletes nodes in its own magazine, and only touches the shared free list to refill
+ *  half of an empty magazine or to spill half of a full one. Each thread may keep up to magazineSize free nodes to
+ *  itself, so allow for that in the length.
+ *
+ *  @param list         A pointer to a lock-free list.
+ *  @param magazineSize The number of free nodes a thread can keep (capped at kCMemMaxMagazineSize).
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListEnableMagazines(SPCLockFreeList *list, size_t magazineSize);
+
+
+/**
+ *  Let the list grow by slabs of nodes once its length is used up, instead of failing to insert. Call before the list
+ *  is shared between threads.
+ *
+ *  Inserts stay lock-free and never allocate memory: an exhausted list chains a slab from a reserve of preallocated
+ *  slabs, which SPCLockFreeListReplenishGrowthReserve() refills. Nodes never move, and slabs are only freed with the list.
+ *
+ *  @param list          A pointer to a lock-free list.
+ *  @param slabLength    The number of nodes in a slab.
+ *  @param reserveLength The number of slabs to keep in reserve.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCLockFreeListEnableGrowth(SPCLockFreeList *list, size_t slabLength, size_t reserveLength);
+
+
+/**
+ *  Refill the growth reserve of the list. Allocates memory, so call it from a non-real-time context, e.g. periodically
+ *  or after an insert has failed. Safe to call while other threads use the list.
+ *
+ *  @param list A pointer to a lock-free list.
+ *
+ *  @return true if the reserve is full; false, otherwise.
+ */
+bool SPCLockFreeListReplenishGrowthReserve(SPCLockFreeList *list);
+
+
 /**
  *  Dispose of a concurrent lock-free list.
  *
@@ -11,12 +11,28 @@
 
 
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SPUtils.h"
 #include "SPCPrimitives.h"
+#include "SPCContention.h"
 
 
 /**
  *  A fixed-size lock-free memory reclamation scheme adapted from the corrected version of Valois's algorithm (Michael & Scott).
  *
+ *  Structures may opt for hazard pointers (Michael) instead: traversals then publish the nodes they visit
+ *  in per-thread slots, rather than writing to the reference counts of the nodes, and deleted nodes are
+ *  held back until no thread has them published. Or for epochs (Fraser): operations announce the global epoch they
+ *  started in, and deleted nodes are held back in per-thread limbo lists until every thread has moved on.
+ *
+ *  Independently of the scheme, the node pool can keep per-thread magazines of free nodes (Bonwick & Adams)
+ *  in front of the shared free list, so that most allocations and reclamations stay off its head.
+ *
  *  References:
  *
  *  - Michael, Maged M., and Michael L. Scott. Correction of a Memory Management Method
@@ -24,7 +40,30 @@
  *
  *  - John David Valois. 1996. Lock-Free Data Structures. Ph.D. Dissertation.
  *      Rensselaer Polytechnic Institute, Troy, NY, USA. UMI Order No. GAX95-44082.
+ *
+ *  - Michael, Maged M. Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects.
+ *      IEEE Transactions on Parallel and Distributed Systems 15, no. 6 (2004): 491-504.
+ *
+ *  - Keir Fraser. 2004. Practical Lock-Freedom. Ph.D. Dissertation. University of Cambridge, UK. UCAM-CL-TR-579.
+ *
+ *  - Jeff Bonwick and Jonathan Adams. 2001. Magazines and Vmem: Extending the Slab Allocator to Many CPUs
+ *      and Arbitrary Resources. In Proceedings of the USENIX Annual Technical Conference, 15-33.
+ */
+
+
+
+#pragma mark - Reclamation schemes
+
+
+
+/**
+ *  The memory reclamation scheme used by a lock-free structure.
  */
+typedef enum SPCMemoryReclamationScheme {
+    kSPCMemoryReclamationReferenceCounting = 0,  // Traversals retain and release every node they visit.
+    kSPCMemoryReclamationHazardPointers,         // Traversals publish the nodes they visit in per-thread hazard slots.
+    kSPCMemoryReclamationEpochs,                 // Operations announce the global epoch, and deleted nodes wait out two epochs.
+} SPCMemoryReclamationScheme;
 
 
 
@@ -48,14 +87,12 @@ static FORCE_INLINE bool cmem_decrementAndTestAndSet(volatile long *refCountPtr)
 
     for (;;) {
         
-        long oldValue = (long)(SPC_ATOMIC_LOAD(refCountPtr));
+        long oldValue = (long)(SPC_ATOMIC_LOAD_EXPLICIT(refCountPtr, SPC_MEMORY_ORDER_RELAXED));
         long newValue = (oldValue == 2) ? 1 : oldValue - 2;
         
-        if (SPC_ATOMIC_COMPARE_AND_SWAP(refCountPtr, oldValue, newValue)) {
-     
-            SPC_MEMORY_BARRIER_STORE();
+        // Release our accesses to the node to whoever claims it, and acquire everybody else's if we do.
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteRefCountRelease, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(refCountPtr, oldValue, newValue, SPC_MEMORY_ORDER_ACQ_REL)))
             return (oldValue - newValue) & 1;
-        }
         
         SPC_STALL();
     }
@@ -67,18 +104,41 @@ static FORCE_INLINE bool cmem_decrementAndTestAndSet(volatile long *refCountPtr)
  *
  *  @param node          A node.
  *  @param nextPtrOffset Next pointer offset.
+ *  @param numNextPtrs   The number of consecutive next pointers.
  *
  *  @return true if the pointer to the next node is non-null.
  */
 static FORCE_INLINE bool cmem_nodeHasNoForwardLinks(void *node, ptrdiff_t nextPtrOffset, size_t numNextPtrs)
 {
-    for (int idx = 0; idx < numNextPtrs; ++idx)
-        if (toMarkable_m((markable_ptr_t)(SPC_ATOMIC_LOAD(node + nextPtrOffset + nextPtrOffset * idx)), false))
+    for (size_t idx = 0; idx < numNextPtrs; ++idx)
+        if (toMarkable_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(node + nextPtrOffset + sizeof(markable_ptr_t) * idx, SPC_MEMORY_ORDER_RELAXED)), false))
             return false;
     return true;
 }
 
 
+/**
+ *  Return a claimed node to the free list.
+ *
+ *  @param node          The node to reclaim.
+ *  @param nextPtrOffset The offset to the next pointer field in the node.
+ *  @param freeListPtr   A pointer to the free list's head pointer.
+ */
+static FORCE_INLINE void cmem_reclaimNode(void *node, ptrdiff_t nextPtrOffset, void *volatile *freeListPtr)
+{
+    assert(freeListPtr);
+    
+    for (;;) {
+        void *freeListHead = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(freeListPtr, SPC_MEMORY_ORDER_RELAXED));
+        SPC_ATOMIC_STORE_EXPLICIT(node + nextPtrOffset, freeListHead, SPC_MEMORY_ORDER_RELAXED);
+        
+        // Release the update of the _next_d[0] pointer of the node together with the node itself.
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteFreeListPush, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(freeListPtr, freeListHead, node, SPC_MEMORY_ORDER_RELEASE)))
+            break;
+    }
+}
+
+
 /**
  *  Release a node.
  *  This functions decrements the reference count, and if nobody else is pointing to the node,
@@ -112,32 +172,20 @@ static FORCE_INLINE void cmem_releaseNode(void           *node,
     // If we claimed the node, release any retained links.
     //
     if (retainedLinkOffset >= 0) {
-        cmem_releaseNode((void *)(SPC_ATOMIC_LOAD(node + retainedLinkOffset)),
+        cmem_releaseNode((void *)(SPC_ATOMIC_LOAD_EXPLICIT(node + retainedLinkOffset, SPC_MEMORY_ORDER_RELAXED)),
                          refCountOffset,
                          nextPtrOffset,
                          numNextPtrs,
                          retainedLinkOffset,
                          freeListPtr);
         
-        SPC_ATOMIC_STORE(node + retainedLinkOffset, NULL);
+        SPC_ATOMIC_STORE_EXPLICIT(node + retainedLinkOffset, NULL, SPC_MEMORY_ORDER_RELAXED);
     }
     
     //
     // Reclaim the node (i.e. by adding it to the top of the free list).
     //
-    assert(freeListPtr);
-    
-    for (;;) {
-        void *freeListHead = (void *)(SPC_ATOMIC_LOAD(freeListPtr));
-        SPC_ATOMIC_STORE(node + nextPtrOffset, freeListHead);
-        
-        // Use a barrier to make sure that the change is observed to happen after
-        // we have claimed the node and updated the _next_d[0] pointer of the node.
-        SPC_MEMORY_BARRIER_STORE();
-        
-        if (SPC_ATOMIC_COMPARE_AND_SWAP(freeListPtr, *(void *volatile *)(node + nextPtrOffset), node))
-            break;
-    }
+    cmem_reclaimNode(node, nextPtrOffset, freeListPtr);
 }
 
 
@@ -149,7 +197,8 @@ static FORCE_INLINE void cmem_releaseNode(void           *node,
  */
 static FORCE_INLINE void cmem_retainNode(void *node, ptrdiff_t refCountOffset)
 {
-    (void)SPC_ATOMIC_FETCH_AND_ADD(node + refCountOffset, 2);
+    // The acquire keeps the re-validation of the link the node was read from after the increment.
+    (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(node + refCountOffset, 2, SPC_MEMORY_ORDER_ACQ_REL);
 }
 
 
@@ -167,17 +216,18 @@ static FORCE_INLINE void *cmem_safeReadHead(void *volatile *freeListPtr, ptrdiff
     assert(freeListPtr);
     
     for (;;) {
-        void *node = (void *)(SPC_ATOMIC_LOAD(freeListPtr));
+        void *node = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(freeListPtr, SPC_MEMORY_ORDER_ACQUIRE));
         if (!node)
             return NULL;
         
         cmem_retainNode(node, refCountOffset);
         
-        if (node == (void *)(SPC_ATOMIC_LOAD(freeListPtr)))
+        if (node == (void *)(SPC_ATOMIC_LOAD_EXPLICIT(freeListPtr, SPC_MEMORY_ORDER_ACQUIRE)))
             return node;
         else {
-            // This should never need to use the free list unless we preempted a reclaim.
-            cmem_releaseNode(node, refCountOffset, nextPtrOffset, 1, -1, freeListPtr);
+            // This should never need to use the free list unless we preempted a reclaim. The node may have been
+            // allocated and used in the meantime, so its links are whatever its last user left and aren't checked.
+            cmem_releaseNode(node, refCountOffset, nextPtrOffset, 0, -1, freeListPtr);
         }
     }
 }
@@ -200,37 +250,31 @@ static FORCE_INLINE void *cmem_allocNode(void *volatile *freeListPtr, ptrdiff_t
         void *newNode = cmem_safeReadHead(freeListPtr, refCountOffset, nextPtrOffset);
         if (!newNode) {
             STD_OUTPUT_ERROR("cmem_allocNode", "out of memory in the fixed pool");
+            SPC_CONTENTION_EVENT(kSPCContentionEventPoolExhausted);
             return NULL;
         }
         
         //
         // Move the head of the free list.
         //
-        if (SPC_ATOMIC_COMPARE_AND_SWAP(freeListPtr, newNode, *(void *volatile *)(newNode + nextPtrOffset))) {
-            
-            // Add a barrier to make sure the free list head update is observed to happen strictly before
-            // any changes to the node.
-            SPC_MEMORY_BARRIER_STORE();
+        void *nextNode = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(newNode + nextPtrOffset, SPC_MEMORY_ORDER_RELAXED));
+        
+        // The acquire-release exchange orders the free list head update strictly before any changes to the node.
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteFreeListPop, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(freeListPtr, newNode, nextNode, SPC_MEMORY_ORDER_ACQ_REL))) {
             
-            // Clear the claimed bit.
+            // Clear the claimed bit. Other threads may still be adjusting the reference count,
+            // but nobody else can clear the bit, so there is no need to compare.
             //
-            for (;;) {
-                long oldValue = (long)(SPC_ATOMIC_LOAD(newNode + refCountOffset));
-                
-                if (SPC_ATOMIC_COMPARE_AND_SWAP(newNode + refCountOffset, oldValue, oldValue - 1)) {
-                    
-                    SPC_ATOMIC_STORE(newNode + nextPtrOffset, toMarkable(NULL, false));
-                    SPC_MEMORY_BARRIER_STORE();
-                    return newNode;
-                }
-                
-                SPC_STALL();
-            }
+            (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(newNode + refCountOffset, -1, SPC_MEMORY_ORDER_ACQ_REL);
+            
+            // The node is published by the data structure with a release operation.
+            SPC_ATOMIC_STORE_EXPLICIT(newNode + nextPtrOffset, toMarkable(NULL, false), SPC_MEMORY_ORDER_RELAXED);
+            return newNode;
         } else {
             
-            // Release the node.
+            // Release the node. (Its links aren't checked, see cmem_safeReadHead().)
             //
-            cmem_releaseNode(newNode, refCountOffset, nextPtrOffset, 1, -1, freeListPtr);
+            cmem_releaseNode(newNode, refCountOffset, nextPtrOffset, 0, -1, freeListPtr);
         }
     }
 }
@@ -245,7 +289,7 @@ static FORCE_INLINE void *cmem_allocNode(void *volatile *freeListPtr, ptrdiff_t
  */
 static FORCE_INLINE bool cmem_isRetained(const void *node, ptrdiff_t refCountOffset)
 {
-    return !((long)(SPC_ATOMIC_LOAD(node + refCountOffset)) % 2);
+    return !((long)(SPC_ATOMIC_LOAD_EXPLICIT(node + refCountOffset, SPC_MEMORY_ORDER_RELAXED)) % 2);
 }
 
 
@@ -271,13 +315,1415 @@ static FORCE_INLINE void cmem_init(void *volatile *freeListPtr,
     
     void *currentNode = storage;
     
-    for (int idx = 0; idx < totalNumNodes; ++idx) {
-        SPC_ATOMIC_STORE(currentNode + refCountOffset, 1);
-        SPC_ATOMIC_STORE(currentNode + nextPtrOffset, toMarkable(((idx == totalNumNodes - 1) ? NULL : currentNode + nodeSize), false));
-        currentNode = toPtr_m((markable_ptr_t)(SPC_ATOMIC_LOAD(currentNode + nextPtrOffset)));
+    for (size_t idx = 0; idx < totalNumNodes; ++idx) {
+        SPC_ATOMIC_STORE_EXPLICIT(currentNode + refCountOffset, 1, SPC_MEMORY_ORDER_RELAXED);
+        SPC_ATOMIC_STORE_EXPLICIT(currentNode + nextPtrOffset, toMarkable(((idx == totalNumNodes - 1) ? NULL : currentNode + nodeSize), false), SPC_MEMORY_ORDER_RELAXED);
+        currentNode = toPtr_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(currentNode + nextPtrOffset, SPC_MEMORY_ORDER_RELAXED)));
+    }
+    
+    SPC_ATOMIC_STORE_EXPLICIT(freeListPtr, storage, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+
+#pragma mark - Pools
+
+
+
+enum {
+    kCMemMaxMagazineSize = 256,  // Upper bound on the free nodes a thread can keep to itself.
+};
+
+
+/**
+ *  A per-thread cache of free (claimed) nodes in front of a pool's free list.
+ */
+struct cmem_magazine {
+    volatile long          _owned;
+    struct cmem_magazine  *_next;
+    struct cmem_pool      *_pool;
+    size_t                 _count;
+    void                  *_nodes[];
+};
+
+typedef struct cmem_magazine cmem_magazine_t;
+
+
+/**
+ *  An additional block of nodes for a growable pool.
+ */
+struct cmem_slab {
+    struct cmem_slab  *_next;
+    void              *_nodes;
+};
+
+typedef struct cmem_slab cmem_slab_t;
+
+
+/**
+ *  A pool of nodes: the shared free list, and optionally per-thread magazines in front of it.
+ *
+ *  Without magazines, every allocation and reclamation is a compare-and-swap on the head of the free list. With them,
+ *  a thread allocates from and reclaims to its own magazine, and only goes to the free list to refill an empty magazine
+ *  or to spill half of a full one.
+ *
+ *  Nodes of the initial storage are handed out from a bump pointer the first time they are used, so a pool costs
+ *  nothing up front beyond its storage, and the free list only holds nodes that have been recycled.
+ *
+ *  A pool is fixed to its initial storage, unless growth is enabled: an exhausted pool then chains a slab from a reserve
+ *  of preallocated slabs, which a non-real-time context keeps replenished. Nodes never move once they are in the pool.
+ */
+struct cmem_pool {
+    void *volatile               _freeList;
+    ptrdiff_t                    _refCountOffset;
+    ptrdiff_t                    _nextPtrOffset;
+    size_t                       _nodeSize;
+    void                        *_bumpNodes;
+    long                         _bumpLength;
+    volatile long                _bumpIndex;
+    size_t                       _magazineSize;
+    pthread_key_t                _magazineKey;
+    cmem_magazine_t *volatile    _magazines;
+    size_t                       _slabLength;
+    long                         _reserveLength;
+    volatile long                _reserveCount;
+    cmem_slab_t *volatile        _reserve;
+    cmem_slab_t *volatile        _slabs;
+};
+
+typedef struct cmem_pool cmem_pool_t;
+
+
+/**
+ *  Initialize a pool on a block of storage (without magazines). Takes constant time: the storage is not touched
+ *  until its nodes are allocated.
+ *
+ *  @param pool           A pointer to the pool.
+ *  @param refCountOffset The offset of the reference count field used by free list nodes.
+ *  @param nextPtrOffset  The offset of the next pointer field used by free list nodes.
+ *  @param nodeSize       The size of a node (fixed).
+ *  @param storage        A pointer to a block of free memory large enough to accomodate the requested number of nodes.
+ *  @param totalNumNodes  The total number of nodes in the pool.
+ */
+static inline void cmem_poolInit(cmem_pool_t *pool,
+                                 ptrdiff_t    refCountOffset,
+                                 ptrdiff_t    nextPtrOffset,
+                                 size_t       nodeSize,
+                                 void        *storage,
+                                 size_t       totalNumNodes)
+{
+    assert(pool);
+    
+    pool->_refCountOffset = refCountOffset;
+    pool->_nextPtrOffset  = nextPtrOffset;
+    pool->_nodeSize       = nodeSize;
+    pool->_bumpNodes      = storage;
+    pool->_bumpLength     = (long)totalNumNodes;
+    pool->_bumpIndex      = 0;
+    pool->_magazineSize   = 0;
+    pool->_magazines      = NULL;
+    pool->_slabLength     = 0;
+    pool->_reserveLength  = 0;
+    pool->_reserveCount   = 0;
+    pool->_reserve        = NULL;
+    pool->_slabs          = NULL;
+    
+    SPC_ATOMIC_STORE_EXPLICIT(&pool->_freeList, NULL, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Push a chain of claimed nodes, already linked through their next pointers, to the free list.
+ *
+ *  @param pool  A pointer to the pool.
+ *  @param first The first node of the chain.
+ *  @param last  The last node of the chain.
+ */
+static FORCE_INLINE void cmem__poolPushChain(cmem_pool_t *pool, void *first, void *last)
+{
+    for (;;) {
+        void *freeListHead = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_freeList, SPC_MEMORY_ORDER_RELAXED));
+        SPC_ATOMIC_STORE_EXPLICIT(last + pool->_nextPtrOffset, freeListHead, SPC_MEMORY_ORDER_RELAXED);
+        
+        // Release the links of the whole chain together with the nodes.
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteFreeListPush, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_freeList, freeListHead, first, SPC_MEMORY_ORDER_RELEASE)))
+            break;
+    }
+}
+
+
+/**
+ *  Spill the nodes of a magazine above a given count to the free list, in a single compare-and-swap.
+ *
+ *  @param pool     A pointer to the pool.
+ *  @param magazine A magazine owned by the calling thread.
+ *  @param keep     The number of nodes to keep.
+ */
+static inline void cmem__magazineSpill(cmem_pool_t *pool, cmem_magazine_t *magazine, size_t keep)
+{
+    if (magazine->_count <= keep)
+        return;
+    
+    void *first = magazine->_nodes[keep];
+    void *last  = magazine->_nodes[magazine->_count - 1];
+    
+    for (size_t idx = keep; idx < magazine->_count - 1; ++idx)
+        SPC_ATOMIC_STORE_EXPLICIT(magazine->_nodes[idx] + pool->_nextPtrOffset, magazine->_nodes[idx + 1], SPC_MEMORY_ORDER_RELAXED);
+    
+    cmem__poolPushChain(pool, first, last);
+    SPC_CONTENTION_EVENT(kSPCContentionEventMagazineSpill);
+    
+    magazine->_count = keep;
+}
+
+
+/**
+ *  Give up a magazine when its thread exits, spilling its nodes to the free list.
+ *
+ *  @param magazine A magazine.
+ */
+static inline void cmem__magazineDeactivate(void *magazine)
+{
+    cmem_magazine_t *thisMagazine = magazine;
+    
+    cmem__magazineSpill(thisMagazine->_pool, thisMagazine, 0);
+    
+    SPC_ATOMIC_STORE_EXPLICIT(&thisMagazine->_owned, 0, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Put per-thread magazines in front of the free list of a pool. Call before the pool is shared between threads.
+ *
+ *  Each thread may keep up to magazineSize free nodes to itself, so allow for that in the size of the pool.
+ *
+ *  @param pool         A pointer to the pool.
+ *  @param magazineSize The number of free nodes a thread can keep (capped at kCMemMaxMagazineSize).
+ *
+ *  @return true if successful; false, otherwise.
+ */
+static inline bool cmem_poolEnableMagazines(cmem_pool_t *pool, size_t magazineSize)
+{
+    assert(pool);
+    
+    if (!magazineSize || pool->_magazineSize)
+        return !!magazineSize;
+    
+    if (pthread_key_create(&pool->_magazineKey, cmem__magazineDeactivate) != 0) {
+        STD_OUTPUT_ERROR("cmem_poolEnableMagazines", "can't create a thread-specific key");
+        return false;
+    }
+    
+    pool->_magazineSize = magazineSize < kCMemMaxMagazineSize ? magazineSize : kCMemMaxMagazineSize;
+    
+    return true;
+}
+
+
+/**
+ *  Add slabs to the reserve of a growable pool until it is full again. Allocates memory, so only call it
+ *  from a non-real-time context. Safe to call while other threads use the pool.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return true if the reserve is full; false, otherwise.
+ */
+static inline bool cmem_poolReplenishReserve(cmem_pool_t *pool)
+{
+    assert(pool);
+    
+    // Claim a place in the reserve before allocating, so that concurrent callers do not overfill it.
+    while (SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pool->_reserveCount, 1, SPC_MEMORY_ORDER_RELAXED) < pool->_reserveLength) {
+        cmem_slab_t *slab  = calloc(1, sizeof(cmem_slab_t));
+        void        *nodes = calloc(pool->_slabLength, pool->_nodeSize);
+        if (!slab || !nodes) {
+            STD_OUTPUT_ERROR("cmem_poolReplenishReserve", "out of memory");
+            
+            free(slab);
+            free(nodes);
+            (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pool->_reserveCount, -1, SPC_MEMORY_ORDER_RELAXED);
+            return false;
+        }
+        
+        // Link the nodes as cmem_init() does, so that the slab can go onto the free list in one piece.
+        void *node = nodes;
+        for (size_t idx = 0; idx < pool->_slabLength; ++idx, node += pool->_nodeSize) {
+            SPC_ATOMIC_STORE_EXPLICIT(node + pool->_refCountOffset, 1, SPC_MEMORY_ORDER_RELAXED);
+            SPC_ATOMIC_STORE_EXPLICIT(node + pool->_nextPtrOffset,
+                                      toMarkable((idx == pool->_slabLength - 1) ? NULL : node + pool->_nodeSize, false),
+                                      SPC_MEMORY_ORDER_RELAXED);
+        }
+        
+        slab->_nodes = nodes;
+        
+        for (;;) {
+            slab->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_reserve, SPC_MEMORY_ORDER_RELAXED));
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_reserve, slab->_next, slab, SPC_MEMORY_ORDER_RELEASE)))
+                break;
+        }
+    }
+    
+    (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pool->_reserveCount, -1, SPC_MEMORY_ORDER_RELAXED);
+    
+    return true;
+}
+
+
+/**
+ *  Let a pool grow by whole slabs when it is exhausted, instead of failing. Call before the pool is shared between threads.
+ *
+ *  Allocation stays lock-free and never allocates memory itself: it takes a slab off the reserve, which is filled here
+ *  and then by cmem_poolReplenishReserve().
+ *
+ *  @param pool          A pointer to the pool.
+ *  @param slabLength    The number of nodes in a slab.
+ *  @param reserveLength The number of slabs to keep in reserve.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+static inline bool cmem_poolEnableGrowth(cmem_pool_t *pool, size_t slabLength, size_t reserveLength)
+{
+    assert(pool);
+    
+    if (!slabLength || !reserveLength || pool->_slabLength)
+        return false;
+    
+    pool->_slabLength    = slabLength;
+    pool->_reserveLength = (long)reserveLength;
+    
+    return cmem_poolReplenishReserve(pool);
+}
+
+
+/**
+ *  Free a chain of slabs.
+ *
+ *  @param slab The first slab of the chain.
+ */
+static inline void cmem__slabFreeChain(cmem_slab_t *slab)
+{
+    while (slab) {
+        cmem_slab_t *nextSlab = slab->_next;
+        free(slab->_nodes);
+        free(slab);
+        slab = nextSlab;
+    }
+}
+
+
+/**
+ *  Dispose of the magazines and the slabs of a pool. No thread may be using the pool anymore.
+ *
+ *  @param pool A pointer to the pool.
+ */
+static inline void cmem_poolDispose(cmem_pool_t *pool)
+{
+    assert(pool);
+    
+    cmem__slabFreeChain(pool->_slabs);
+    cmem__slabFreeChain(pool->_reserve);
+    
+    pool->_slabs         = NULL;
+    pool->_reserve       = NULL;
+    pool->_reserveCount  = 0;
+    pool->_reserveLength = 0;
+    pool->_slabLength    = 0;
+    
+    if (!pool->_magazineSize)
+        return;
+    
+    pthread_key_delete(pool->_magazineKey);
+    
+    for (cmem_magazine_t *magazine = pool->_magazines; magazine;) {
+        cmem_magazine_t *nextMagazine = magazine->_next;
+        free(magazine);
+        magazine = nextMagazine;
+    }
+    
+    pool->_magazines    = NULL;
+    pool->_magazineSize = 0;
+}
+
+
+/**
+ *  Get the calling thread's magazine, taking over the magazine of an exited thread or adding a new one if needed.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return The calling thread's magazine; NULL if the pool has no magazines, or if it could not be allocated.
+ */
+static FORCE_INLINE cmem_magazine_t *cmem__poolAcquireMagazine(cmem_pool_t *pool)
+{
+    if (!pool->_magazineSize)
+        return NULL;
+    
+    cmem_magazine_t *magazine = pthread_getspecific(pool->_magazineKey);
+    if (__builtin_expect(!!magazine, 1))
+        return magazine;
+    
+    for (magazine = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_magazines, SPC_MEMORY_ORDER_ACQUIRE)); magazine; magazine = magazine->_next)
+        if (!SPC_ATOMIC_LOAD_EXPLICIT(&magazine->_owned, SPC_MEMORY_ORDER_RELAXED) &&
+            SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&magazine->_owned, 0, 1, SPC_MEMORY_ORDER_ACQ_REL)))
+            break;
+    
+    if (!magazine) {
+        magazine = calloc(1, sizeof(cmem_magazine_t) + pool->_magazineSize * sizeof(void *));
+        if (!magazine) {
+            STD_OUTPUT_ERROR("cmem__poolAcquireMagazine", "out of memory");
+            return NULL;
+        }
+        
+        magazine->_pool  = pool;
+        magazine->_owned = 1;
+        
+        for (;;) {
+            magazine->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_magazines, SPC_MEMORY_ORDER_RELAXED));
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_magazines, magazine->_next, magazine, SPC_MEMORY_ORDER_RELEASE)))
+                break;
+        }
+    }
+    
+    pthread_setspecific(pool->_magazineKey, magazine);
+    return magazine;
+}
+
+
+/**
+ *  Take a node off the free list, leaving it claimed.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return A claimed node; NULL if the free list is empty.
+ */
+static FORCE_INLINE void *cmem__poolPopFreeList(cmem_pool_t *pool)
+{
+    for (;;) {
+        void *node = cmem_safeReadHead(&pool->_freeList, pool->_refCountOffset, pool->_nextPtrOffset);
+        if (!node)
+            return NULL;
+        
+        void *nextNode = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(node + pool->_nextPtrOffset, SPC_MEMORY_ORDER_RELAXED));
+        
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteFreeListPop, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_freeList, node, nextNode, SPC_MEMORY_ORDER_ACQ_REL))) {
+            
+            // Drop our reference. Nobody else can clear the claimed bit.
+            (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(node + pool->_refCountOffset, -2, SPC_MEMORY_ORDER_ACQ_REL);
+            return node;
+        }
+        
+        // Its links aren't checked, see cmem_safeReadHead().
+        cmem_releaseNode(node, pool->_refCountOffset, pool->_nextPtrOffset, 0, -1, &pool->_freeList);
+    }
+}
+
+
+/**
+ *  Take a never-used node of the initial storage, leaving it claimed as if it came off the free list.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return A claimed node; NULL if every node of the initial storage has been handed out.
+ */
+static FORCE_INLINE void *cmem__poolBump(cmem_pool_t *pool)
+{
+    // Check first, so that the index stops moving once the storage is used up.
+    if ((long)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_bumpIndex, SPC_MEMORY_ORDER_RELAXED)) >= pool->_bumpLength)
+        return NULL;
+    
+    long idx = SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pool->_bumpIndex, 1, SPC_MEMORY_ORDER_RELAXED);
+    if (idx >= pool->_bumpLength)
+        return NULL;
+    
+    void *node = pool->_bumpNodes + idx * pool->_nodeSize;
+    SPC_ATOMIC_STORE_EXPLICIT(node + pool->_refCountOffset, 1, SPC_MEMORY_ORDER_RELAXED);
+    
+    return node;
+}
+
+
+/**
+ *  Chain a slab from the reserve of a growable pool to its free list.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return true if the pool grew; false, if it is not growable or its reserve is empty.
+ */
+static inline bool cmem__poolGrow(cmem_pool_t *pool)
+{
+    if (!pool->_slabLength)
+        return false;
+    
+    // Slabs never return to the reserve, so the pop is free from ABA.
+    cmem_slab_t *slab;
+    do {
+        slab = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_reserve, SPC_MEMORY_ORDER_ACQUIRE));
+        if (!slab)
+            return false;
+    } while (!SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_reserve, slab, slab->_next, SPC_MEMORY_ORDER_ACQ_REL)));
+    
+    (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pool->_reserveCount, -1, SPC_MEMORY_ORDER_RELAXED);
+    
+    for (;;) {
+        slab->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_slabs, SPC_MEMORY_ORDER_RELAXED));
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&pool->_slabs, slab->_next, slab, SPC_MEMORY_ORDER_RELEASE)))
+            break;
+    }
+    
+    cmem__poolPushChain(pool, slab->_nodes, slab->_nodes + (pool->_slabLength - 1) * pool->_nodeSize);
+    SPC_CONTENTION_EVENT(kSPCContentionEventPoolGrown);
+    
+    return true;
+}
+
+
+/**
+ *  Take a node out of the calling thread's magazine, refilling half of it from the free list if it is empty.
+ *
+ *  @param pool     A pointer to the pool.
+ *  @param magazine The calling thread's magazine.
+ *
+ *  @return A claimed node; NULL if both the magazine and the free list are empty.
+ */
+static FORCE_INLINE void *cmem__magazinePop(cmem_pool_t *pool, cmem_magazine_t *magazine)
+{
+    if (!magazine->_count) {
+        SPC_CONTENTION_EVENT(kSPCContentionEventMagazineRefill);
+        
+        for (size_t batch = (pool->_magazineSize + 1) / 2; magazine->_count < batch;) {
+            void *node = cmem__poolPopFreeList(pool);
+            if (!node)
+                break;
+            
+            magazine->_nodes[magazine->_count++] = node;
+        }
+    }
+    
+    return magazine->_count ? magazine->_nodes[--magazine->_count] : NULL;
+}
+
+
+/**
+ *  Allocate a node from a pool.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return A node available for use; NULL if the pool is exhausted.
+ */
+static FORCE_INLINE void *cmem_poolAllocNode(cmem_pool_t *pool)
+{
+    assert(pool);
+    
+    cmem_magazine_t *magazine = cmem__poolAcquireMagazine(pool);
+    
+    void *node = cmem__poolBump(pool);
+    while (!node && !(node = magazine ? cmem__magazinePop(pool, magazine) : cmem__poolPopFreeList(pool))) {
+        if (!cmem__poolGrow(pool)) {
+            STD_OUTPUT_ERROR("cmem_poolAllocNode", "out of memory in the fixed pool");
+            SPC_CONTENTION_EVENT(kSPCContentionEventPoolExhausted);
+            return NULL;
+        }
+    }
+    
+    // Clear the claimed bit, as cmem_allocNode() does.
+    (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(node + pool->_refCountOffset, 1, SPC_MEMORY_ORDER_ACQ_REL);
+    SPC_ATOMIC_STORE_EXPLICIT(node + pool->_nextPtrOffset, toMarkable(NULL, false), SPC_MEMORY_ORDER_RELAXED);
+    
+    return node;
+}
+
+
+/**
+ *  Return a claimed node to a pool.
+ *
+ *  @param pool A pointer to the pool.
+ *  @param node The node to reclaim.
+ */
+static FORCE_INLINE void cmem_poolReclaimNode(cmem_pool_t *pool, void *node)
+{
+    assert(pool);
+    
+    cmem_magazine_t *magazine = cmem__poolAcquireMagazine(pool);
+    if (!magazine) {
+        cmem_reclaimNode(node, pool->_nextPtrOffset, &pool->_freeList);
+        return;
+    }
+    
+    if (magazine->_count == pool->_magazineSize)
+        cmem__magazineSpill(pool, magazine, pool->_magazineSize / 2);
+    
+    magazine->_nodes[magazine->_count++] = node;
+}
+
+
+/**
+ *  Release a node of a pool: cmem_releaseNode(), reclaiming through the calling thread's magazine.
+ *
+ *  @param pool               A pointer to the pool.
+ *  @param node               The node to release.
+ *  @param numNextPtrs        The number of next pointers in the node.
+ *  @param retainedLinkOffset An offset to a retained link, (-1 if none).
+ */
+static inline void cmem_poolReleaseNode(cmem_pool_t *pool, void *node, size_t numNextPtrs, ptrdiff_t retainedLinkOffset)
+{
+    if (!node) return;
+    
+    if (!pool->_magazineSize) {
+        cmem_releaseNode(node, pool->_refCountOffset, pool->_nextPtrOffset, numNextPtrs, retainedLinkOffset, &pool->_freeList);
+        return;
+    }
+    
+    if (!cmem_decrementAndTestAndSet(node + pool->_refCountOffset))
+        return;
+    
+    assert(cmem_nodeHasNoForwardLinks(node, pool->_nextPtrOffset, numNextPtrs));
+    
+    if (retainedLinkOffset >= 0) {
+        cmem_poolReleaseNode(pool,
+                             (void *)(SPC_ATOMIC_LOAD_EXPLICIT(node + retainedLinkOffset, SPC_MEMORY_ORDER_RELAXED)),
+                             numNextPtrs,
+                             retainedLinkOffset);
+        
+        SPC_ATOMIC_STORE_EXPLICIT(node + retainedLinkOffset, NULL, SPC_MEMORY_ORDER_RELAXED);
+    }
+    
+    cmem_poolReclaimNode(pool, node);
+}
+
+
+/**
+ *  Check if a pool has free nodes at hand for the calling thread.
+ *
+ *  @param pool A pointer to the pool.
+ *
+ *  @return true if the calling thread's magazine, the free list or the initial storage has nodes; false, otherwise.
+ */
+static FORCE_INLINE bool cmem_poolHasFreeNodes(cmem_pool_t *pool)
+{
+    cmem_magazine_t *magazine = pool->_magazineSize ? pthread_getspecific(pool->_magazineKey) : NULL;
+    
+    return ((magazine && magazine->_count) ||
+            SPC_ATOMIC_LOAD_EXPLICIT(&pool->_freeList, SPC_MEMORY_ORDER_RELAXED) ||
+            (long)(SPC_ATOMIC_LOAD_EXPLICIT(&pool->_bumpIndex, SPC_MEMORY_ORDER_RELAXED)) < pool->_bumpLength);
+}
+
+
+
+#pragma mark - Hazard pointers
+
+
+
+enum {
+    kCMemHazardSlotCount    = 32,  // Nodes a thread can have published at once. Traversals holding more fall back to reference counts.
+    kCMemRetiredSlotCount   = 64,  // Deleted nodes a thread can hold back before it has to wait for some of them to be reclaimed.
+    kCMemRetireScanInterval = 16,  // Deleted nodes a thread holds back between two attempts at reclaiming them.
+};
+
+
+/**
+ *  Per-thread hazard pointer state.
+ *
+ *  The hazard slots are only written by the owning thread. The retired slots are filled by the owning thread
+ *  and emptied by whichever thread reclaims their nodes, so the nodes of exited threads are never lost.
+ */
+struct cmem_hazard_record {
+    void *volatile                      _hazards[kCMemHazardSlotCount];
+    void *volatile                      _retired[kCMemRetiredSlotCount];
+    struct cmem_hazard_record          *_next;
+    struct cmem_hazard_domain          *_domain;
+    volatile long                       _active;
+    size_t                              _retireCount;
+    void                              **_scanBuffer;
+    size_t                              _scanBufferLength;
+};
+
+typedef struct cmem_hazard_record cmem_hazard_record_t;
+
+
+/**
+ *  The hazard pointer state of a single structure: the records of the threads using it, and the layout
+ *  of its nodes, so that any thread can return them to the structure's pool.
+ */
+struct cmem_hazard_domain {
+    cmem_hazard_record_t *volatile _records;
+    volatile long                  _numRecords;
+    pthread_key_t                  _recordKey;
+    cmem_pool_t                   *_pool;
+};
+
+typedef struct cmem_hazard_domain cmem_hazard_domain_t;
+
+
+/**
+ *  Give up a hazard record when its thread exits, leaving any nodes it still holds back for other threads to reclaim.
+ *
+ *  @param record A hazard record.
+ */
+static inline void cmem__hazardDeactivateRecord(void *record)
+{
+    cmem_hazard_record_t *thisRecord = record;
+    
+    for (int idx = 0; idx < kCMemHazardSlotCount; ++idx)
+        SPC_ATOMIC_STORE_EXPLICIT(&thisRecord->_hazards[idx], NULL, SPC_MEMORY_ORDER_RELAXED);
+    
+    SPC_ATOMIC_STORE_EXPLICIT(&thisRecord->_active, 0, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Initialize a hazard pointer domain.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param pool   The pool deleted nodes are returned to.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+static inline bool cmem_hazardInit(cmem_hazard_domain_t *domain, cmem_pool_t *pool)
+{
+    assert(domain);
+    assert(pool);
+    
+    domain->_records    = NULL;
+    domain->_numRecords = 0;
+    domain->_pool       = pool;
+    
+    if (pthread_key_create(&domain->_recordKey, cmem__hazardDeactivateRecord) != 0) {
+        STD_OUTPUT_ERROR("cmem_hazardInit", "can't create a thread-specific key");
+        return false;
+    }
+    
+    return true;
+}
+
+
+/**
+ *  Dispose of a hazard pointer domain. No thread may be using the structure anymore.
+ *
+ *  @param domain A pointer to the domain.
+ */
+static inline void cmem_hazardDispose(cmem_hazard_domain_t *domain)
+{
+    assert(domain);
+    
+    pthread_key_delete(domain->_recordKey);
+    
+    for (cmem_hazard_record_t *record = domain->_records; record;) {
+        cmem_hazard_record_t *nextRecord = record->_next;
+        
+        free(record->_scanBuffer);
+        free(record);
+        
+        record = nextRecord;
+    }
+    
+    domain->_records    = NULL;
+    domain->_numRecords = 0;
+}
+
+
+/**
+ *  Take over the record of an exited thread, or add a new one to the domain.
+ *
+ *  @param domain A pointer to the domain.
+ *
+ *  @return The calling thread's record; NULL if it could not be allocated.
+ */
+static inline cmem_hazard_record_t *cmem__hazardAdoptRecord(cmem_hazard_domain_t *domain)
+{
+    cmem_hazard_record_t *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next)
+        if (!SPC_ATOMIC_LOAD_EXPLICIT(&record->_active, SPC_MEMORY_ORDER_RELAXED) &&
+            SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&record->_active, 0, 1, SPC_MEMORY_ORDER_ACQ_REL)))
+            break;
+    
+    if (!record) {
+        record = calloc(1, sizeof(cmem_hazard_record_t));
+        if (!record) {
+            STD_OUTPUT_ERROR("cmem_hazardAcquireRecord", "out of memory");
+            return NULL;
+        }
+        
+        record->_domain = domain;
+        record->_active = 1;
+        
+        // Publish the record, and count it for the scans.
+        for (;;) {
+            record->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_RELAXED));
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&domain->_records, record->_next, record, SPC_MEMORY_ORDER_RELEASE)))
+                break;
+        }
+        (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&domain->_numRecords, 1, SPC_MEMORY_ORDER_RELAXED);
+    }
+    
+    pthread_setspecific(domain->_recordKey, record);
+    return record;
+}
+
+
+/**
+ *  Get the calling thread's hazard record.
+ *
+ *  @param domain A pointer to the domain.
+ *
+ *  @return The calling thread's record; NULL if it could not be allocated.
+ */
+static FORCE_INLINE cmem_hazard_record_t *cmem_hazardAcquireRecord(cmem_hazard_domain_t *domain)
+{
+    cmem_hazard_record_t *record = pthread_getspecific(domain->_recordKey);
+    if (__builtin_expect(!record, 0))
+        record = cmem__hazardAdoptRecord(domain);
+    
+    return record;
+}
+
+
+/**
+ *  Publish a node in a free hazard slot of the calling thread.
+ *
+ *  A node read from a link is only safe to use if the link still points to it after the node has been published.
+ *
+ *  @param record The calling thread's record.
+ *  @param node   A node.
+ *
+ *  @return true if published; false if there was no free slot.
+ */
+static FORCE_INLINE bool cmem_hazardProtect(cmem_hazard_record_t *record, void *node)
+{
+    if (!record)
+        return false;
+    
+    for (int idx = 0; idx < kCMemHazardSlotCount; ++idx)
+        if (!record->_hazards[idx]) {
+            SPC_ATOMIC_STORE_EXPLICIT(&record->_hazards[idx], node, SPC_MEMORY_ORDER_RELAXED);
+            
+            // Order the publication before the caller re-reads the link, and before the scans of reclaiming threads.
+            SPC_MEMORY_BARRIER_FULL();
+            return true;
+        }
+    
+    return false;
+}
+
+
+/**
+ *  Withdraw a node from the calling thread's hazard slots.
+ *
+ *  @param record The calling thread's record.
+ *  @param node   A node.
+ *
+ *  @return true if the node was published; false, otherwise.
+ */
+static FORCE_INLINE bool cmem_hazardUnprotect(cmem_hazard_record_t *record, void *node)
+{
+    if (!record)
+        return false;
+    
+    for (int idx = 0; idx < kCMemHazardSlotCount; ++idx)
+        if (record->_hazards[idx] == node) {
+            // Keep our accesses to the node before the slot is seen empty.
+            SPC_ATOMIC_STORE_EXPLICIT(&record->_hazards[idx], NULL, SPC_MEMORY_ORDER_RELEASE);
+            return true;
+        }
+    
+    return false;
+}
+
+
+/**
+ *  Check if a node is published by the calling thread.
+ *
+ *  @param record The calling thread's record.
+ *  @param node   A node.
+ *
+ *  @return true if published; false, otherwise.
+ */
+static FORCE_INLINE bool cmem_hazardIsProtected(cmem_hazard_record_t *record, const void *node)
+{
+    if (!record)
+        return false;
+    
+    for (int idx = 0; idx < kCMemHazardSlotCount; ++idx)
+        if (record->_hazards[idx] == node)
+            return true;
+    
+    return false;
+}
+
+
+/**
+ *  Order hazards by address.
+ */
+static inline int cmem__compareHazards(const void *lhs, const void *rhs)
+{
+    uintptr_t lhsHazard = *(const uintptr_t *)lhs;
+    uintptr_t rhsHazard = *(const uintptr_t *)rhs;
+    
+    return (lhsHazard > rhsHazard) - (lhsHazard < rhsHazard);
+}
+
+
+/**
+ *  Collect the hazards of all threads in the scan buffer of a record, sorted by address.
+ *
+ *  @param domain  A pointer to the domain.
+ *  @param scanner The calling thread's record.
+ *
+ *  @return The number of hazards collected; SIZE_MAX if the scan buffer could not be allocated.
+ */
+static inline size_t cmem__hazardCollect(cmem_hazard_domain_t *domain, cmem_hazard_record_t *scanner)
+{
+    size_t numHazards = 0;
+    
+    cmem_hazard_record_t *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next)
+        for (int idx = 0; idx < kCMemHazardSlotCount; ++idx) {
+            void *hazard = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&record->_hazards[idx], SPC_MEMORY_ORDER_ACQUIRE));
+            if (!hazard)
+                continue;
+            
+            if (numHazards == scanner->_scanBufferLength) {
+                size_t newLength = scanner->_scanBufferLength ? scanner->_scanBufferLength * 2 : kCMemHazardSlotCount;
+                void **newBuffer = realloc(scanner->_scanBuffer, newLength * sizeof(void *));
+                if (!newBuffer) {
+                    STD_OUTPUT_ERROR("cmem_hazardScan", "out of memory");
+                    return SIZE_MAX;
+                }
+                
+                scanner->_scanBuffer       = newBuffer;
+                scanner->_scanBufferLength = newLength;
+            }
+            
+            scanner->_scanBuffer[numHazards++] = hazard;
+        }
+    
+    qsort(scanner->_scanBuffer, numHazards, sizeof(void *), cmem__compareHazards);
+    
+    return numHazards;
+}
+
+
+/**
+ *  Hold back a deleted node in a free retired slot of a record.
+ *
+ *  @param record A record.
+ *  @param node   A claimed node.
+ *
+ *  @return true if successful; false if there was no free slot.
+ */
+static FORCE_INLINE bool cmem__hazardHoldBack(cmem_hazard_record_t *record, void *node)
+{
+    for (int idx = 0; idx < kCMemRetiredSlotCount; ++idx)
+        if (!SPC_ATOMIC_LOAD_EXPLICIT(&record->_retired[idx], SPC_MEMORY_ORDER_RELAXED) &&
+            SPC_CONTENTION_CAS(kSPCContentionSiteHazardRetire, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&record->_retired[idx], NULL, node, SPC_MEMORY_ORDER_RELEASE)))
+            return true;
+    
+    return false;
+}
+
+
+/**
+ *  Reclaim the nodes held back in a record that no thread has published.
+ *
+ *  The nodes are taken out of the record before the hazards are collected, so that a node deleted again
+ *  after being reclaimed and reused can never be mistaken for its earlier self.
+ *
+ *  @param domain  A pointer to the domain.
+ *  @param scanner The calling thread's record.
+ *  @param record  The record to scan.
+ *
+ *  @return The number of nodes reclaimed.
+ */
+static inline size_t cmem_hazardScan(cmem_hazard_domain_t *domain, cmem_hazard_record_t *scanner, cmem_hazard_record_t *record)
+{
+    void  *candidates[kCMemRetiredSlotCount];
+    size_t numCandidates = 0;
+    
+    for (int idx = 0; idx < kCMemRetiredSlotCount; ++idx) {
+        void *node = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&record->_retired[idx], SPC_MEMORY_ORDER_ACQUIRE));
+        if (node && SPC_CONTENTION_CAS(kSPCContentionSiteHazardRetire, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&record->_retired[idx], node, NULL, SPC_MEMORY_ORDER_ACQ_REL)))
+            candidates[numCandidates++] = node;
+    }
+    
+    if (!numCandidates)
+        return 0;
+    
+    // Order the removal of the candidates before reading the hazards, against the publications of other threads.
+    SPC_MEMORY_BARRIER_FULL();
+    
+    size_t numHazards   = cmem__hazardCollect(domain, scanner);
+    size_t numReclaimed = 0;
+    
+    for (size_t idx = 0; idx < numCandidates; ++idx) {
+        void *node = candidates[idx];
+        
+        if (numHazards != SIZE_MAX &&
+            !bsearch(&node, scanner->_scanBuffer, numHazards, sizeof(void *), cmem__compareHazards)) {
+            cmem_poolReclaimNode(domain->_pool, node);
+            ++numReclaimed;
+            continue;
+        }
+        
+        // Still in use, so put it back.
+        for (spc_backoff_t backoffCounter = SPC_BACKOFF_INIT;
+             !cmem__hazardHoldBack(record, node) && !cmem__hazardHoldBack(scanner, node);)
+            SPC_BackoffExponential(&backoffCounter);
+    }
+    
+    return numReclaimed;
+}
+
+
+/**
+ *  Reclaim the unpublished nodes held back by all threads. Useful when the free list runs out.
+ *
+ *  @param domain  A pointer to the domain.
+ *  @param scanner The calling thread's record.
+ *
+ *  @return The number of nodes reclaimed.
+ */
+static inline size_t cmem_hazardReclaim(cmem_hazard_domain_t *domain, cmem_hazard_record_t *scanner)
+{
+    if (!scanner)
+        return 0;
+    
+    SPC_CONTENTION_EVENT(kSPCContentionEventPoolReclaim);
+    
+    size_t numReclaimed = 0;
+    
+    cmem_hazard_record_t *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next)
+        numReclaimed += cmem_hazardScan(domain, scanner, record);
+    
+    return numReclaimed;
+}
+
+
+/**
+ *  Retire a claimed node: hold it back until no thread has it published, and then return it to the pool.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record The calling thread's record.
+ *  @param node   A claimed node, no longer reachable from the structure.
+ */
+static inline void cmem_hazardRetireNode(cmem_hazard_domain_t *domain, cmem_hazard_record_t *record, void *node)
+{
+    if (!record) {
+        STD_OUTPUT_ERROR("cmem_hazardRetireNode", "no hazard record, leaking node");
+        return;
+    }
+    
+    for (spc_backoff_t backoffCounter = SPC_BACKOFF_INIT; !cmem__hazardHoldBack(record, node);) {
+        if (!cmem_hazardScan(domain, record, record))
+            SPC_BackoffExponential(&backoffCounter);
+    }
+    
+    if (!(++record->_retireCount % kCMemRetireScanInterval))
+        (void)cmem_hazardScan(domain, record, record);
+}
+
+
+/**
+ *  Release a reference counted reference to a node (hazard pointer variant of cmem_releaseNode()).
+ *
+ *  Under hazard pointers, the reference count of a node only holds the reference of the structure itself, and
+ *  the references of traversals that ran out of hazard slots. The node is retired once the count drops to zero.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record The calling thread's record.
+ *  @param node   The node to release.
+ */
+static FORCE_INLINE void cmem_hazardReleaseNode(cmem_hazard_domain_t *domain, cmem_hazard_record_t *record, void *node)
+{
+    if (!node) return;
+    
+    if (cmem_decrementAndTestAndSet(node + domain->_pool->_refCountOffset))
+        cmem_hazardRetireNode(domain, record, node);
+}
+
+
+
+#pragma mark - Epochs
+
+
+
+enum {
+    kCMemLimboInitialLength    = 64,  // Initial capacity of a limbo list. Lists grow if the epoch can't advance.
+    kCMemEpochAdvanceInterval  = 32,  // Deleted nodes a thread puts in limbo between two attempts at advancing the epoch.
+    kCMemEpochReclaimAttempts  = 16,  // Times a thread out of nodes yields to threads holding up the epoch.
+};
+
+
+/**
+ *  The nodes a thread deleted during one epoch.
+ */
+struct cmem_limbo_list {
+    long    _epoch;
+    void  **_nodes;
+    size_t  _count;
+    size_t  _length;
+};
+
+typedef struct cmem_limbo_list cmem_limbo_list_t;
+
+
+/**
+ *  Per-thread epoch state.
+ *
+ *  A thread announces the global epoch it observed while it is inside an operation on the structure. Nodes it deletes
+ *  go to the limbo list of the global epoch at the time, and are returned to the pool two epochs later, once every
+ *  thread that could still have been reading them has left its operation.
+ */
+struct cmem_epoch_record {
+    volatile long                      _state;      // The announced epoch, shifted left, and an active flag.
+    volatile long                      _owned;      // Set while a thread uses the record (or borrows its limbo lists).
+    struct cmem_epoch_record          *_next;
+    struct cmem_epoch_domain          *_domain;
+    cmem_limbo_list_t                  _limbo[3];
+    size_t                             _retireCount;
+};
+
+typedef struct cmem_epoch_record cmem_epoch_record_t;
+
+
+/**
+ *  The epoch state of a single structure.
+ */
+struct cmem_epoch_domain {
+    volatile long                  _epoch;
+    cmem_epoch_record_t *volatile  _records;
+    pthread_key_t                  _recordKey;
+    cmem_pool_t                   *_pool;
+};
+
+typedef struct cmem_epoch_domain cmem_epoch_domain_t;
+
+
+/**
+ *  Give up an epoch record when its thread exits. Its limbo lists are reclaimed by the next thread to use the record,
+ *  or by threads running out of nodes.
+ *
+ *  @param record An epoch record.
+ */
+static inline void cmem__epochDeactivateRecord(void *record)
+{
+    cmem_epoch_record_t *thisRecord = record;
+    
+    SPC_ATOMIC_STORE_EXPLICIT(&thisRecord->_state, 0, SPC_MEMORY_ORDER_RELEASE);
+    SPC_ATOMIC_STORE_EXPLICIT(&thisRecord->_owned, 0, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Initialize an epoch domain.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param pool   The pool deleted nodes are returned to.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+static inline bool cmem_epochInit(cmem_epoch_domain_t *domain, cmem_pool_t *pool)
+{
+    assert(domain);
+    assert(pool);
+    
+    domain->_epoch   = 3; // Past the epochs of the empty limbo lists.
+    domain->_records = NULL;
+    domain->_pool    = pool;
+    
+    if (pthread_key_create(&domain->_recordKey, cmem__epochDeactivateRecord) != 0) {
+        STD_OUTPUT_ERROR("cmem_epochInit", "can't create a thread-specific key");
+        return false;
+    }
+    
+    return true;
+}
+
+
+/**
+ *  Dispose of an epoch domain. No thread may be using the structure anymore.
+ *
+ *  @param domain A pointer to the domain.
+ */
+static inline void cmem_epochDispose(cmem_epoch_domain_t *domain)
+{
+    assert(domain);
+    
+    pthread_key_delete(domain->_recordKey);
+    
+    for (cmem_epoch_record_t *record = domain->_records; record;) {
+        cmem_epoch_record_t *nextRecord = record->_next;
+        
+        for (int idx = 0; idx < 3; ++idx)
+            free(record->_limbo[idx]._nodes);
+        free(record);
+        
+        record = nextRecord;
+    }
+    
+    domain->_records = NULL;
+}
+
+
+/**
+ *  Get the calling thread's epoch record, taking over the record of an exited thread or adding a new one if needed.
+ *
+ *  @param domain A pointer to the domain.
+ *
+ *  @return The calling thread's record; NULL if it could not be allocated.
+ */
+static FORCE_INLINE cmem_epoch_record_t *cmem_epochAcquireRecord(cmem_epoch_domain_t *domain)
+{
+    cmem_epoch_record_t *record = pthread_getspecific(domain->_recordKey);
+    if (__builtin_expect(!!record, 1))
+        return record;
+    
+    for (record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE)); record; record = record->_next)
+        if (!SPC_ATOMIC_LOAD_EXPLICIT(&record->_owned, SPC_MEMORY_ORDER_RELAXED) &&
+            SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&record->_owned, 0, 1, SPC_MEMORY_ORDER_ACQ_REL)))
+            break;
+    
+    if (!record) {
+        record = calloc(1, sizeof(cmem_epoch_record_t));
+        if (!record) {
+            STD_OUTPUT_ERROR("cmem_epochAcquireRecord", "out of memory");
+            return NULL;
+        }
+        
+        record->_domain = domain;
+        record->_owned  = 1;
+        
+        for (;;) {
+            record->_next = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_RELAXED));
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&domain->_records, record->_next, record, SPC_MEMORY_ORDER_RELEASE)))
+                break;
+        }
+    }
+    
+    pthread_setspecific(domain->_recordKey, record);
+    return record;
+}
+
+
+/**
+ *  Return a node straight to the pool. Either its grace period has passed, or it was never published.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param node   A node no thread can still be reading.
+ */
+static FORCE_INLINE void cmem_epochFreeNode(cmem_epoch_domain_t *domain, void *node)
+{
+    // Nodes are claimed as they are reclaimed, as the free list expects. A thread that is transiently holding
+    // the node in the free list's own reference count claims it instead, and reclaims it when it lets go.
+    if (cmem_decrementAndTestAndSet(node + domain->_pool->_refCountOffset))
+        cmem_poolReclaimNode(domain->_pool, node);
+}
+
+
+/**
+ *  Return the nodes of a limbo list to the pool.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param limbo  A limbo list whose grace period has passed.
+ */
+static inline void cmem__epochReclaimLimbo(cmem_epoch_domain_t *domain, cmem_limbo_list_t *limbo)
+{
+    for (size_t idx = 0; idx < limbo->_count; ++idx)
+        cmem_epochFreeNode(domain, limbo->_nodes[idx]);
+    
+    limbo->_count = 0;
+}
+
+
+/**
+ *  Reclaim the limbo lists of a record whose grace period has passed.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record A record owned by the calling thread.
+ *  @param epoch  The current global epoch.
+ */
+static FORCE_INLINE void cmem__epochReclaimRecord(cmem_epoch_domain_t *domain, cmem_epoch_record_t *record, long epoch)
+{
+    for (int idx = 0; idx < 3; ++idx)
+        if (record->_limbo[idx]._count && record->_limbo[idx]._epoch + 2 <= epoch)
+            cmem__epochReclaimLimbo(domain, &record->_limbo[idx]);
+}
+
+
+/**
+ *  Advance the global epoch if every thread inside an operation has observed the current one.
+ *
+ *  @param domain A pointer to the domain.
+ *
+ *  @return The global epoch.
+ */
+static inline long cmem_epochTryAdvance(cmem_epoch_domain_t *domain)
+{
+    long epoch = (long)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_epoch, SPC_MEMORY_ORDER_ACQUIRE));
+    
+    // Read the announcements after our own, against the announcements of other threads.
+    SPC_MEMORY_BARRIER_FULL();
+    
+    cmem_epoch_record_t *record = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; record; record = record->_next) {
+        long state = (long)(SPC_ATOMIC_LOAD_EXPLICIT(&record->_state, SPC_MEMORY_ORDER_ACQUIRE));
+        if ((state & 1) && (state >> 1) != epoch)
+            return epoch;
+    }
+    
+    if (SPC_CONTENTION_CAS(kSPCContentionSiteEpochAdvance, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&domain->_epoch, epoch, epoch + 1, SPC_MEMORY_ORDER_ACQ_REL)))
+        return epoch + 1;
+    
+    return (long)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_epoch, SPC_MEMORY_ORDER_ACQUIRE));
+}
+
+
+/**
+ *  Enter an operation on the structure: nodes reachable from now on stay valid until cmem_epochLeave().
+ *
+ *  @param domain A pointer to the domain.
+ *
+ *  @return The calling thread's record (to pass to cmem_epochLeave()); NULL if it could not be allocated.
+ */
+static FORCE_INLINE cmem_epoch_record_t *cmem_epochEnter(cmem_epoch_domain_t *domain)
+{
+    cmem_epoch_record_t *record = cmem_epochAcquireRecord(domain);
+    if (!record)
+        return NULL;
+    
+    long epoch = (long)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_epoch, SPC_MEMORY_ORDER_ACQUIRE));
+    SPC_ATOMIC_STORE_EXPLICIT(&record->_state, (epoch << 1) | 1, SPC_MEMORY_ORDER_RELAXED);
+    
+    // Announce the epoch before reading anything from the structure.
+    SPC_MEMORY_BARRIER_FULL();
+    
+    cmem__epochReclaimRecord(domain, record, epoch);
+    
+    return record;
+}
+
+
+/**
+ *  Leave an operation on the structure.
+ *
+ *  @param record The calling thread's record.
+ */
+static FORCE_INLINE void cmem_epochLeave(cmem_epoch_record_t *record)
+{
+    if (!record)
+        return;
+    
+    // Keep our reads of the structure before the announcement is withdrawn.
+    SPC_ATOMIC_STORE_EXPLICIT(&record->_state, 0, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Retire a node deleted during the current operation: put it in limbo until the grace period has passed.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record The calling thread's record.
+ *  @param node   A node no longer reachable from the structure.
+ */
+static inline void cmem_epochRetireNode(cmem_epoch_domain_t *domain, cmem_epoch_record_t *record, void *node)
+{
+    if (!record) {
+        STD_OUTPUT_ERROR("cmem_epochRetireNode", "no epoch record, leaking node");
+        return;
+    }
+    
+    // File the node under the global epoch, which may be one ahead of our announcement: threads that announced it
+    // may already hold the node, so it has to wait out two more epochs from there.
+    SPC_MEMORY_BARRIER_FULL();
+    long               epoch = (long)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_epoch, SPC_MEMORY_ORDER_ACQUIRE));
+    cmem_limbo_list_t *limbo = &record->_limbo[epoch % 3];
+    
+    // The list was last used three or more epochs ago.
+    if (limbo->_epoch != epoch) {
+        cmem__epochReclaimLimbo(domain, limbo);
+        limbo->_epoch = epoch;
+    }
+    
+    if (limbo->_count == limbo->_length) {
+        size_t newLength = limbo->_length ? limbo->_length * 2 : kCMemLimboInitialLength;
+        void **newNodes  = realloc(limbo->_nodes, newLength * sizeof(void *));
+        if (!newNodes) {
+            STD_OUTPUT_ERROR("cmem_epochRetireNode", "out of memory, leaking node");
+            return;
+        }
+        
+        limbo->_nodes  = newNodes;
+        limbo->_length = newLength;
+    }
+    
+    limbo->_nodes[limbo->_count++] = node;
+    
+    if (!(++record->_retireCount % kCMemEpochAdvanceInterval))
+        (void)cmem_epochTryAdvance(domain);
+}
+
+
+/**
+ *  Advance the epoch as far as possible, and reclaim every limbo list whose grace period has passed, including
+ *  those of exited threads.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record The calling thread's record.
+ */
+static inline void cmem__epochReclaimAll(cmem_epoch_domain_t *domain, cmem_epoch_record_t *record)
+{
+    long epoch = 0;
+    
+    for (int pass = 0; pass < 2; ++pass) {
+        epoch = cmem_epochTryAdvance(domain);
+        
+        if (record && (SPC_ATOMIC_LOAD_EXPLICIT(&record->_state, SPC_MEMORY_ORDER_RELAXED) & 1)) {
+            SPC_ATOMIC_STORE_EXPLICIT(&record->_state, (epoch << 1) | 1, SPC_MEMORY_ORDER_RELAXED);
+            SPC_MEMORY_BARRIER_FULL();
+        }
+    }
+    
+    if (record)
+        cmem__epochReclaimRecord(domain, record, epoch);
+    
+    cmem_epoch_record_t *otherRecord = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&domain->_records, SPC_MEMORY_ORDER_ACQUIRE));
+    for (; otherRecord; otherRecord = otherRecord->_next) {
+        if (otherRecord == record ||
+            SPC_ATOMIC_LOAD_EXPLICIT(&otherRecord->_owned, SPC_MEMORY_ORDER_RELAXED) ||
+            !SPC_CONTENTION_CAS(kSPCContentionSiteRecordList, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&otherRecord->_owned, 0, 1, SPC_MEMORY_ORDER_ACQ_REL)))
+            continue;
+        
+        cmem__epochReclaimRecord(domain, otherRecord, epoch);
+        
+        SPC_ATOMIC_STORE_EXPLICIT(&otherRecord->_owned, 0, SPC_MEMORY_ORDER_RELEASE);
+    }
+}
+
+
+/**
+ *  Reclaim the nodes held back in limbo when the free list runs out.
+ *
+ *  The calling thread may be inside an operation, but must not hold any nodes yet: its announcement is refreshed,
+ *  so that the epoch can advance past its own deletions. A thread preempted inside an operation keeps the epoch
+ *  from advancing, so the calling thread yields to it a few times before giving up.
+ *
+ *  @param domain A pointer to the domain.
+ *  @param record The calling thread's record.
+ *
+ *  @return true if the pool has free nodes at hand again; false, otherwise.
+ */
+static inline bool cmem_epochReclaim(cmem_epoch_domain_t *domain, cmem_epoch_record_t *record)
+{
+    SPC_CONTENTION_EVENT(kSPCContentionEventPoolReclaim);
+    
+    for (int attempt = 0; attempt < kCMemEpochReclaimAttempts; ++attempt) {
+        cmem__epochReclaimAll(domain, record);
+        
+        if (cmem_poolHasFreeNodes(domain->_pool))
+            return true;
+        
+        sched_yield();
     }
     
-    *freeListPtr = storage;
+    return false;
 }
 
 
@@ -0,0 +1,622 @@
+//
+//  SPCMessageEngine.c
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 18/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE // pthread_setname_np
+#endif
+
+#include "SPCMessageEngine.h"
+
+#ifndef DEBUG
+#define NDEBUG
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "SPUtils.h"
+
+
+
+#pragma mark - Messages
+
+
+
+struct message_t {
+    SPCMessageHandler  handler;
+    size_t             userInfoLength;
+};
+
+typedef struct message_t message_t;
+
+
+static const int           kDispatchSpinCount        = 1024;
+static const uint64_t      kSpaceWaitIntervalNSec    = 1000000;
+static const unsigned int  kDefaultConsumerSpinCount = 256;
+
+
+
+#pragma mark - Helpers
+
+
+
+/**
+ *  Get the monotonic time (in nanoseconds).
+ */
+static uint64_t monotonicTimeNSec(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+
+/**
+ *  Name the calling thread.
+ */
+static void setCurrentThreadName(const char *name)
+{
+    if (!name[0])
+        return;
+
+#if defined __APPLE__
+    (void)pthread_setname_np(name);
+#elif defined __linux__
+    (void)pthread_setname_np(pthread_self(), name);
+#endif
+}
+
+
+
+#pragma mark - Initialization
+
+
+
+//
+// Init a message engine.
+//
+bool SPCMessageEngineInit(SPCMessageEngine *this, const char *name, size_t length)
+{
+    memset(this, 0, sizeof(*this));
+
+    if (name)
+        strncpy(this->_name, name, sizeof(this->_name) - 1);
+
+    this->_spinCount = kDefaultConsumerSpinCount;
+
+    this->_eventDescriptor      = -1;
+    this->_eventWriteDescriptor = -1;
+
+    if (!SPCRingBufferInit(&this->_messageBuffer, length))
+        return false;
+
+    //
+    // A handler flushing its own engine must not deadlock, so the flush lock is recursive.
+    //
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+
+    int result = pthread_mutex_init(&this->_flushLock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    if (result != 0) {
+        STD_OUTPUT_ERROR("flush lock creation", strerror(result));
+        SPCRingBufferDispose(&this->_messageBuffer);
+        return false;
+    }
+
+    return true;
+}
+
+
+//
+// Dispose of a message engine.
+//
+void SPCMessageEngineDispose(SPCMessageEngine *this)
+{
+    SPCMessageEngineStop(this);
+
+    if (this->_eventWriteDescriptor >= 0 && this->_eventWriteDescriptor != this->_eventDescriptor)
+        close(this->_eventWriteDescriptor);
+    if (this->_eventDescriptor >= 0)
+        close(this->_eventDescriptor);
+
+    pthread_mutex_destroy(&this->_flushLock);
+    SPCRingBufferDispose(&this->_messageBuffer);
+}
+
+
+
+#pragma mark - Processing control
+
+
+
+//
+// The engine's thread and its producers signal each other with an eventcount: the thread sets the waiting
+// flag before its last check for messages, and only a producer that finds the flag set bumps the epoch and
+// issues a wake-up. While the thread is draining, dispatching a message costs no system call at all.
+//
+
+static const uint32_t kWaitingFlag = 1;
+static const uint32_t kEpochStep   = 2;
+
+
+/**
+ *  Announce that the engine's thread is going to sleep.
+ *
+ *  @return The key to wait on.
+ */
+static FORCE_INLINE uint32_t prepareWait(SPCMessageEngine *this)
+{
+    uint32_t key = SPCFutexFetchAndOr(&this->_messageSignal, kWaitingFlag) | kWaitingFlag;
+
+    // Order the announcement before the last check for messages.
+    SPC_MEMORY_BARRIER_FULL();
+
+    return key;
+}
+
+
+/**
+ *  Withdraw the announcement, unless a producer has already bumped the epoch.
+ */
+static FORCE_INLINE void cancelWait(SPCMessageEngine *this, uint32_t key)
+{
+    (void)SPCFutexCompareAndSwap(&this->_messageSignal, &key, key & ~kWaitingFlag);
+}
+
+
+/**
+ *  Make the event descriptor readable, if there is one.
+ */
+static void signalEventDescriptor(SPCMessageEngine *this)
+{
+    if (this->_eventWriteDescriptor < 0)
+        return;
+
+    // A full eventfd counter or pipe is already readable, so failing to write is fine.
+#if defined __linux__
+    (void)eventfd_write(this->_eventWriteDescriptor, 1);
+#else
+    const char byte = 1;
+    (void)write(this->_eventWriteDescriptor, &byte, sizeof(byte));
+#endif
+}
+
+
+/**
+ *  Make the event descriptor unreadable, if there is one.
+ */
+static void resetEventDescriptor(SPCMessageEngine *this)
+{
+    if (this->_eventDescriptor < 0)
+        return;
+
+#if defined __linux__
+    eventfd_t ignore;
+    (void)eventfd_read(this->_eventDescriptor, &ignore);
+#else
+    char bytes[64];
+    while (read(this->_eventDescriptor, bytes, sizeof(bytes)) > 0)
+        ;
+#endif
+}
+
+
+/**
+ *  Wake up the engine's thread, or the caller's event loop, if it has announced that it is going to sleep.
+ */
+static FORCE_INLINE void notifyEngineThread(SPCMessageEngine *this)
+{
+    // Order the commit of the message before the check of the flag.
+    SPC_MEMORY_BARRIER_FULL();
+
+    uint32_t signal = SPCFutexLoad(&this->_messageSignal);
+
+    // Clearing the flag and bumping the epoch is a single increment, and only one producer gets to do it.
+    while (signal & kWaitingFlag) {
+        if (SPCFutexCompareAndSwap(&this->_messageSignal, &signal, signal + (kEpochStep - kWaitingFlag))) {
+            SPCFutexWake(&this->_messageSignal, false);
+            signalEventDescriptor(this);
+            break;
+        }
+    }
+}
+
+
+/**
+ *  The engine's thread: waits for messages to be dispatched, and either runs them or notifies the caller's loop.
+ */
+static void *engineThreadMain(void *context)
+{
+    SPCMessageEngine *this = context;
+
+    setCurrentThreadName(this->_name);
+
+    while (!SPC_ATOMIC_LOAD(&this->_stopRequested)) {
+
+        // Drain while awake; producers don't signal until we announce that we are going to sleep.
+        if (!this->_notifier && SPCMessageEngineHasPendingMessages(this)) {
+            (void)SPCMessageEngineFlush(this);
+            continue;
+        }
+
+        for (unsigned int spin = 0; spin < this->_spinCount && !SPCMessageEngineHasPendingMessages(this); ++spin)
+            SPC_STALL();
+
+        //
+        // Announce that we are going to sleep, then check for messages once more: a message committed
+        // before the announcement is seen here, and a producer committing after it bumps the epoch.
+        //
+        uint32_t key = prepareWait(this);
+
+        if (SPC_ATOMIC_LOAD(&this->_stopRequested))
+            break;
+
+        if (SPCMessageEngineHasPendingMessages(this)) {
+
+            if (!this->_notifier) {
+                cancelWait(this, key);
+                continue;
+            }
+
+            // The caller's loop flushes everything pending, and anything later bumps the epoch.
+            this->_notifier(this->_notifierContext);
+        }
+
+        SPCFutexWait(&this->_messageSignal, key, 0);
+    }
+
+    return NULL;
+}
+
+
+//
+// Start the engine's thread.
+//
+bool SPCMessageEngineStart(SPCMessageEngine *this, SPCMessageEngineNotifier notifier, void *context)
+{
+    if (SPC_ATOMIC_LOAD(&this->_running))
+        return true;
+
+    this->_notifier        = notifier;
+    this->_notifierContext = context;
+    SPC_ATOMIC_STORE(&this->_stopRequested, 0);
+
+    int result = pthread_create(&this->_thread, NULL, engineThreadMain, this);
+    if (result != 0) {
+        STD_OUTPUT_ERROR("engine thread creation", strerror(result));
+        return false;
+    }
+
+    SPC_ATOMIC_STORE(&this->_running, 1);
+
+    return true;
+}
+
+
+//
+// Set the spin count of the engine's thread.
+//
+void SPCMessageEngineSetSpinCount(SPCMessageEngine *this, unsigned int spinCount)
+{
+    this->_spinCount = spinCount;
+}
+
+
+//
+// Stop the engine's thread.
+//
+void SPCMessageEngineStop(SPCMessageEngine *this)
+{
+    if (!SPC_ATOMIC_LOAD(&this->_running))
+        return;
+
+    SPC_ATOMIC_STORE(&this->_stopRequested, 1);
+
+    (void)SPCFutexFetchAndAdd(&this->_messageSignal, kEpochStep);
+    SPCFutexWake(&this->_messageSignal, true);
+
+    int result = pthread_join(this->_thread, NULL);
+    if (result != 0)
+        STD_OUTPUT_ERROR("engine thread join", strerror(result));
+
+    SPC_ATOMIC_STORE(&this->_running, 0);
+}
+
+
+//
+// Determine if the engine's thread is running.
+//
+bool SPCMessageEngineIsRunning(SPCMessageEngine *this)
+{
+    return SPC_ATOMIC_LOAD(&this->_running) != 0;
+}
+
+
+/**
+ *  Run the handlers of pending messages on the calling thread.
+ *
+ *  Handlers run directly on the messages in the ring buffer, and each message is only marked as read
+ *  after its handler returns. Messages are drained in a single pass under one lock.
+ *
+ *  @param budget The maximum number of messages to process.
+ *
+ *  @return The number of messages processed.
+ */
+static size_t processMessages(SPCMessageEngine *this, size_t budget)
+{
+    size_t processed = 0;
+
+    pthread_mutex_lock(&this->_flushLock);
+
+    // A handler flushing the engine again would run the message it is being called for once more.
+    if (this->_flushing) {
+        pthread_mutex_unlock(&this->_flushLock);
+        return 0;
+    }
+
+    this->_flushing = true;
+
+    size_t availableBytes;
+    message_t *message;
+    while (processed < budget && (message = SPCRingBufferGetForRead_MPSC(&this->_messageBuffer, &availableBytes))) {
+
+        if (message->handler) {
+
+            // Run the handler.
+            message->handler(message->userInfoLength > 0 ? message + 1 : NULL, message->userInfoLength);
+        }
+
+        SPCRingBufferMarkReadAndClear_MPSC(&this->_messageBuffer);
+        ++processed;
+    }
+
+    this->_flushing = false;
+
+    pthread_mutex_unlock(&this->_flushLock);
+
+    //
+    // Wake up any producers waiting for space. The full barrier of the increment orders the check after
+    // the clearing of the messages above, and producers announce themselves before checking for space.
+    //
+    if (processed > 0) {
+        (void)SPCFutexFetchAndAdd(&this->_spaceSignal, 1);
+
+        if (SPC_ATOMIC_LOAD_EXPLICIT(&this->_spaceWaiters, SPC_MEMORY_ORDER_RELAXED))
+            SPCFutexWake(&this->_spaceSignal, true);
+    }
+
+    return processed;
+}
+
+
+//
+// Flush the engine.
+//
+size_t SPCMessageEngineFlush(SPCMessageEngine *this)
+{
+    return processMessages(this, SIZE_MAX);
+}
+
+
+//
+// Check if there are messages to process.
+//
+bool SPCMessageEngineHasPendingMessages(SPCMessageEngine *this)
+{
+    size_t ignore;
+    return SPCRingBufferGetForRead_MPSC(&this->_messageBuffer, &ignore) != NULL;
+}
+
+
+//
+// Get the number of dropped messages.
+//
+size_t SPCMessageEngineGetDroppedMessageCount(SPCMessageEngine *this)
+{
+    return (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&this->_droppedMessageCount, SPC_MEMORY_ORDER_RELAXED));
+}
+
+
+
+#pragma mark - Event loop integration
+
+
+
+//
+// Open the event descriptor.
+//
+int SPCMessageEngineOpenEventDescriptor(SPCMessageEngine *this)
+{
+    if (this->_eventDescriptor >= 0)
+        return this->_eventDescriptor;
+
+#if defined __linux__
+    int descriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (descriptor < 0) {
+        STD_OUTPUT_ERROR("event descriptor creation", strerror(errno));
+        return -1;
+    }
+
+    this->_eventDescriptor      = descriptor;
+    this->_eventWriteDescriptor = descriptor;
+#else
+    int descriptors[2];
+    if (pipe(descriptors) != 0) {
+        STD_OUTPUT_ERROR("event pipe creation", strerror(errno));
+        return -1;
+    }
+
+    for (int idx = 0; idx < 2; ++idx) {
+        (void)fcntl(descriptors[idx], F_SETFL, fcntl(descriptors[idx], F_GETFL) | O_NONBLOCK);
+        (void)fcntl(descriptors[idx], F_SETFD, FD_CLOEXEC);
+    }
+
+    this->_eventDescriptor      = descriptors[0];
+    this->_eventWriteDescriptor = descriptors[1];
+#endif
+
+    // Arm the descriptor. Messages dispatched before it existed leave it readable.
+    (void)SPCMessageEngineDrain(this, 0);
+
+    return this->_eventDescriptor;
+}
+
+
+//
+// Drain the engine from an event loop.
+//
+size_t SPCMessageEngineDrain(SPCMessageEngine *this, size_t budget)
+{
+    assert(this->_eventDescriptor >= 0);
+
+    resetEventDescriptor(this);
+
+    size_t processed = processMessages(this, budget);
+
+    //
+    // Announce that the loop is going back to waiting, then check for messages once more, exactly like
+    // the engine's thread does. If any are left, keep the descriptor readable for the next pass.
+    //
+    uint32_t key = prepareWait(this);
+
+    if (SPCMessageEngineHasPendingMessages(this)) {
+        cancelWait(this, key);
+        signalEventDescriptor(this);
+    }
+
+    return processed;
+}
+
+
+
+#pragma mark - Messaging
+
+
+
+/**
+ *  Write a message to a reserved chunk of the ring buffer, commit it and signal the engine's thread.
+ */
+static FORCE_INLINE void commitMessage(SPCMessageEngine *this, message_t *message, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
+{
+    message->handler        = handler;
+    message->userInfoLength = userInfoLength;
+
+    if (userInfoLength > 0)
+        memcpy(message + 1, userInfo, userInfoLength);
+
+    SPCRingBufferCommitWrite_MPSC(&this->_messageBuffer, message, sizeof(message_t) + userInfoLength);
+
+    //
+    // Signal the engine's thread, if it is about to sleep.
+    //
+    notifyEngineThread(this);
+}
+
+
+/**
+ *  Count a message that could not be queued.
+ */
+static FORCE_INLINE SPCMessageQueueDispatchStatus dropMessage(SPCMessageEngine *this)
+{
+    (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&this->_droppedMessageCount, 1, SPC_MEMORY_ORDER_RELAXED);
+    return kSPCMessageQueueDispatchFull;
+}
+
+
+//
+// Try to dispatch a message.
+//
+SPCMessageQueueDispatchStatus SPCMessageEngineTryDispatch(SPCMessageEngine *this, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
+{
+    //
+    // Reserve space for the message in the ring buffer, write the message and commit it.
+    // Any number of threads can do this concurrently.
+    //
+    message_t *message = SPCRingBufferReserveForWrite_MPSC(&this->_messageBuffer, sizeof(message_t) + userInfoLength);
+    if (!message)
+        return dropMessage(this);
+
+    commitMessage(this, message, handler, userInfo, userInfoLength);
+
+    return kSPCMessageQueueDispatchQueued;
+}
+
+
+//
+// Dispatch a message, waiting for space if needed.
+//
+SPCMessageQueueDispatchStatus SPCMessageEngineDispatchWaiting(SPCMessageEngine *this,
+                                                              SPCMessageHandler handler,
+                                                              void *userInfo,
+                                                              size_t userInfoLength,
+                                                              double timeout)
+{
+    const size_t messageLength = sizeof(message_t) + userInfoLength;
+
+    //
+    // Spin for a while first, as the consumer is likely to be draining the queue already.
+    //
+    message_t *message = NULL;
+    for (int spin = 0; spin < kDispatchSpinCount && !message; ++spin) {
+        if (!(message = SPCRingBufferReserveForWrite_MPSC(&this->_messageBuffer, messageLength)))
+            SPC_STALL();
+    }
+
+    //
+    // Then block until the consumer frees up some space, or we time out.
+    //
+    if (!message) {
+        uint64_t giveUpTime = monotonicTimeNSec() + (uint64_t)(timeout * 1e9);
+
+        (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&this->_spaceWaiters, 1, SPC_MEMORY_ORDER_SEQ_CST);
+
+        for (;;) {
+            uint32_t signal = SPCFutexLoad(&this->_spaceSignal);
+
+            if ((message = SPCRingBufferReserveForWrite_MPSC(&this->_messageBuffer, messageLength)) ||
+                monotonicTimeNSec() >= giveUpTime)
+                break;
+
+            // Time out periodically in case the wake-up was missed.
+            SPCFutexWait(&this->_spaceSignal, signal, kSpaceWaitIntervalNSec);
+        }
+
+        (void)SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&this->_spaceWaiters, -1, SPC_MEMORY_ORDER_RELAXED);
+
+        if (!message)
+            return dropMessage(this);
+    }
+
+    commitMessage(this, message, handler, userInfo, userInfoLength);
+
+    return kSPCMessageQueueDispatchQueued;
+}
+
+
+//
+// Dispatch a message.
+//
+void SPCMessageEngineDispatch(SPCMessageEngine *this, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
+{
+    SPCMessageQueueDispatchStatus status = SPCMessageEngineTryDispatch(this, handler, userInfo, userInfoLength);
+    assert(status == kSPCMessageQueueDispatchQueued);
+    (void)status;
+}
@@ -0,0 +1,282 @@
+//
+//  SPCMessageEngine.h
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 18/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#ifndef PZ_SPCMessageEngine_h
+#define PZ_SPCMessageEngine_h
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "SPCFutex.h"
+#include "SPCRingBuffer.h"
+
+
+
+/**
+ *  A lock-less message queue engine: any number of producers dispatch messages into an MPSC ring buffer,
+ *  and a single consumer runs their handlers.
+ *
+ *  The consumer is either the engine's own thread, a caller-supplied loop that is notified when messages are
+ *  pending, an event loop polling the engine's event descriptor, or anybody flushing the engine offline.
+ *  Plain C and pthreads only.
+ */
+
+
+
+#pragma mark - Types
+
+
+
+/**
+ *  A message handler function.
+ *
+ *  The user info is passed in place from the queue's buffer, and is only valid until the handler returns.
+ */
+typedef void (*SPCMessageHandler)(void *refCon, size_t refConSize);
+
+
+/**
+ *  A function notifying a caller-supplied loop that messages are pending, and that it should flush the engine.
+ */
+typedef void (*SPCMessageEngineNotifier)(void *context);
+
+
+/**
+ *  The result of dispatching a message.
+ */
+typedef enum SPCMessageQueueDispatchStatus {
+    kSPCMessageQueueDispatchQueued = 0,  // The message was queued.
+    kSPCMessageQueueDispatchFull,        // The queue was full, and the message was dropped.
+} SPCMessageQueueDispatchStatus;
+
+
+struct SPCMessageEngine {
+    SPCRingBuffer             _messageBuffer;
+
+    spc_futex_t               _messageSignal;       // An eventcount: the epoch, shifted left, and a waiting flag.
+    unsigned int              _spinCount;
+    spc_futex_t               _spaceSignal;
+    volatile long             _spaceWaiters;
+    volatile long             _droppedMessageCount;
+
+    pthread_mutex_t           _flushLock;
+    bool                      _flushing;
+
+    pthread_t                 _thread;
+    volatile long             _running;
+    volatile long             _stopRequested;
+    SPCMessageEngineNotifier  _notifier;
+    void                     *_notifierContext;
+
+    int                       _eventDescriptor;
+    int                       _eventWriteDescriptor;
+    char                      _name[16];
+};
+
+typedef struct SPCMessageEngine SPCMessageEngine;
+
+
+
+#pragma mark - Initialization
+
+
+
+/**
+ *  Init a message engine.
+ *
+ *  @param engine A pointer to the engine.
+ *  @param name   A name for the engine's thread (truncated to 15 characters).
+ *  @param length The message buffer length. (More memory may actually be allocated.)
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCMessageEngineInit(SPCMessageEngine *engine, const char *name, size_t length);
+
+
+/**
+ *  Dispose of a message engine, stopping it if needed. Pending messages are discarded.
+ *
+ *  @param engine A pointer to the engine.
+ */
+void SPCMessageEngineDispose(SPCMessageEngine *engine);
+
+
+
+#pragma mark - Processing control
+
+
+
+/**
+ *  Start the engine's thread.
+ *
+ *  Without a notifier, the thread runs the message handlers itself. With a notifier, the thread calls
+ *  the notifier whenever messages are dispatched, and the handlers run wherever SPCMessageEngineFlush() is called.
+ *
+ *  @param engine   A pointer to the engine.
+ *  @param notifier An optional notifier for a caller-supplied loop.
+ *  @param context  A context passed to the notifier.
+ *
+ *  @return true if the thread was started or is already running; false, otherwise.
+ */
+bool SPCMessageEngineStart(SPCMessageEngine *engine, SPCMessageEngineNotifier notifier, void *context);
+
+
+/**
+ *  Set how long the engine's thread spins for new messages before announcing that it is going to sleep.
+ *
+ *  Producers only wake up the thread after it has announced that, so spinning saves wake-ups for bursts of
+ *  messages at the cost of CPU time.
+ *
+ *  @param engine    A pointer to the engine.
+ *  @param spinCount The number of polls before sleeping (0 to sleep right away).
+ */
+void SPCMessageEngineSetSpinCount(SPCMessageEngine *engine, unsigned int spinCount);
+
+
+/**
+ *  Stop the engine's thread, and wait for it to finish.
+ *
+ *  @param engine A pointer to the engine.
+ */
+void SPCMessageEngineStop(SPCMessageEngine *engine);
+
+
+/**
+ *  Determine if the engine's thread is running.
+ *
+ *  @param engine A pointer to the engine.
+ *
+ *  @return true if running; false, otherwise.
+ */
+bool SPCMessageEngineIsRunning(SPCMessageEngine *engine);
+
+
+/**
+ *  Flush the engine by running the handlers of all pending messages on the calling thread.
+ *
+ *  Only one thread flushes at a time. A handler flushing its own engine returns immediately.
+ *
+ *  @param engine A pointer to the engine.
+ *
+ *  @return The number of messages processed.
+ */
+size_t SPCMessageEngineFlush(SPCMessageEngine *engine);
+
+
+/**
+ *  Check if there are messages to process.
+ *
+ *  @param engine A pointer to the engine.
+ *
+ *  @return true if there are pending messages; false, otherwise.
+ */
+bool SPCMessageEngineHasPendingMessages(SPCMessageEngine *engine);
+
+
+/**
+ *  Get the number of messages that could not be queued because the queue was full.
+ *
+ *  @param engine A pointer to the engine.
+ *
+ *  @return The number of dropped messages.
+ */
+size_t SPCMessageEngineGetDroppedMessageCount(SPCMessageEngine *engine);
+
+
+
+#pragma mark - Event loop integration
+
+
+
+/**
+ *  Open a file descriptor that becomes readable when messages are pending, for draining the engine from an
+ *  epoll, kqueue or poll based loop instead of the engine's thread.
+ *
+ *  An eventfd on Linux, and the read end of a pipe elsewhere. The descriptor is owned by the engine and closed
+ *  when it is disposed of. Not to be combined with SPCMessageEngineStart().
+ *
+ *  @param engine A pointer to the engine.
+ *
+ *  @return The descriptor; -1 if it could not be created.
+ */
+int SPCMessageEngineOpenEventDescriptor(SPCMessageEngine *engine);
+
+
+/**
+ *  Run the handlers of up to a number of pending messages, without blocking. Call when the event descriptor
+ *  is readable.
+ *
+ *  The descriptor stays readable while messages are left over, so a level-triggered loop comes back for them
+ *  after serving its other sources.
+ *
+ *  @param engine A pointer to the engine.
+ *  @param budget The maximum number of messages to process.
+ *
+ *  @return The number of messages processed.
+ */
+size_t SPCMessageEngineDrain(SPCMessageEngine *engine, size_t budget);
+
+
+
+#pragma mark - Messaging
+
+
+
+/**
+ *  Dispatch a message.
+ *
+ *  Safe to call from any number of threads concurrently (including real-time threads), without locking.
+ *  The queue is expected to have space for the message; if it doesn't, the message is dropped and counted.
+ *
+ *  @param engine         A pointer to the engine.
+ *  @param handler        The message handler.
+ *  @param userInfo       A user info.
+ *  @param userInfoLength The user info length.
+ */
+void SPCMessageEngineDispatch(SPCMessageEngine *engine, SPCMessageHandler handler, void *userInfo, size_t userInfoLength);
+
+
+/**
+ *  Try to dispatch a message.
+ *
+ *  Safe to call from any number of threads concurrently (including real-time threads), without locking.
+ *
+ *  @param engine         A pointer to the engine.
+ *  @param handler        The message handler.
+ *  @param userInfo       A user info.
+ *  @param userInfoLength The user info length.
+ *
+ *  @return kSPCMessageQueueDispatchQueued if the message was queued; kSPCMessageQueueDispatchFull if the queue was full.
+ */
+SPCMessageQueueDispatchStatus SPCMessageEngineTryDispatch(SPCMessageEngine *engine, SPCMessageHandler handler, void *userInfo, size_t userInfoLength);
+
+
+/**
+ *  Dispatch a message, waiting for space to become available if the queue is full.
+ *
+ *  Spins for a bounded number of attempts, and then blocks until the queue is flushed. Not for real-time threads.
+ *
+ *  @param engine         A pointer to the engine.
+ *  @param handler        The message handler.
+ *  @param userInfo       A user info.
+ *  @param userInfoLength The user info length.
+ *  @param timeout        The maximum time to wait for space (in seconds).
+ *
+ *  @return kSPCMessageQueueDispatchQueued if the message was queued; kSPCMessageQueueDispatchFull if the wait timed out.
+ */
+SPCMessageQueueDispatchStatus SPCMessageEngineDispatchWaiting(SPCMessageEngine *engine,
+                                                              SPCMessageHandler handler,
+                                                              void *userInfo,
+                                                              size_t userInfoLength,
+                                                              double timeout);
+
+
+
+#endif
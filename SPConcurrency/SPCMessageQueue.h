@@ -10,10 +10,14 @@
 
 #import <stddef.h>
 
+#import "SPCMessageEngine.h"
+
 
 
 /**
  *  A lock-less message queue for transmitting and running execution blocks on the main thread.
+ *
+ *  A Foundation front-end to SPCMessageEngine, whose thread forwards pending messages to the main thread.
  */
 @interface SPCMessageQueue : NSObject
 
@@ -56,15 +60,28 @@
 - (void)flushQueue;
 
 
+/**
+ *  The number of times the processing thread polls for new messages before going to sleep.
+ *
+ *  Dispatching only wakes up a sleeping thread, so a longer spin saves wake-ups for bursts of messages.
+ *  Set before starting the queue.
+ */
+@property (nonatomic) NSUInteger spinCount;
+
 
 /**
- *  A message handler function to be excuted on the main thread.
+ *  The number of messages that could not be queued because the queue was full.
  */
-typedef void (*SPCMessageHandler)(void *refCon, size_t refConSize);
+@property (nonatomic, readonly) NSUInteger droppedMessageCount;
+
+
 
 /**
  *  Dispatch a message to a lock-free message queue.
  *
+ *  Safe to call from any number of threads concurrently (including real-time threads), without locking.
+ *  The queue is expected to have space for the message; if it doesn't, the message is dropped and counted.
+ *
  *  @param messageQueue   The message queue.
  *  @param handler        The message handler.
  *  @param userInfo       A user info.
@@ -73,5 +90,40 @@ typedef void (*SPCMessageHandler)(void *refCon, size_t refConSize);
 void SPCMessageQueueDispatch(SPCMessageQueue *messageQueue, SPCMessageHandler handler, void *userInfo, size_t userInfoLength);
 
 
+/**
+ *  Try to dispatch a message to a lock-free message queue.
+ *
+ *  Safe to call from any number of threads concurrently (including real-time threads), without locking.
+ *
+ *  @param messageQueue   The message queue.
+ *  @param handler        The message handler.
+ *  @param userInfo       A user info.
+ *  @param userInfoLength The user info length.
+ *
+ *  @return kSPCMessageQueueDispatchQueued if the message was queued; kSPCMessageQueueDispatchFull if the queue was full.
+ */
+SPCMessageQueueDispatchStatus SPCMessageQueueTryDispatch(SPCMessageQueue *messageQueue, SPCMessageHandler handler, void *userInfo, size_t userInfoLength);
+
+
+/**
+ *  Dispatch a message to a lock-free message queue, waiting for space to become available if the queue is full.
+ *
+ *  Spins for a bounded number of attempts, and then blocks until the queue is flushed. Not for real-time threads.
+ *
+ *  @param messageQueue   The message queue.
+ *  @param handler        The message handler.
+ *  @param userInfo       A user info.
+ *  @param userInfoLength The user info length.
+ *  @param timeout        The maximum time to wait for space (in seconds).
+ *
+ *  @return kSPCMessageQueueDispatchQueued if the message was queued; kSPCMessageQueueDispatchFull if the wait timed out.
+ */
+SPCMessageQueueDispatchStatus SPCMessageQueueDispatchWaiting(SPCMessageQueue *messageQueue,
+                                                             SPCMessageHandler handler,
+                                                             void *userInfo,
+                                                             size_t userInfoLength,
+                                                             NSTimeInterval timeout);
+
+
 
 @end
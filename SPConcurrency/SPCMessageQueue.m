@@ -13,28 +13,6 @@
 #endif
 
 #import <assert.h>
-#import <mach/mach.h>
-
-#import "SPCRingBuffer.h"
-
-
-
-#pragma mark - Private interfaces
-
-/**
- *  A message queue execution thread used to take messages from the queue 
- *  and post them for execution to the main thread.
- */
-@interface SPCMessageQueueExecutionThread : NSThread
-{
-@public
-    semaphore_t _semaphore;
-}
-
-- (instancetype)initWithName:(NSString *)name
-                       queue:(SPCMessageQueue *)messageQueue;
-
-@end
 
 
 
@@ -43,9 +21,15 @@
 
 
 @interface SPCMessageQueue ()
+{
+    SPCMessageEngine _engine;
+}
 
-@property (nonatomic)         SPCRingBuffer                   messageBuffer;
-@property (nonatomic, strong) SPCMessageQueueExecutionThread *executionThread;
+/**
+ *  Called on the engine's thread when messages are pending. Holds the queue weakly, so that the engine's
+ *  thread never resurrects a deallocating queue.
+ */
+@property (nonatomic, copy)   void (^mainThreadNotifier)(void);
 
 @property (nonatomic, copy)   NSString *name;
 
@@ -61,28 +45,31 @@
 
 
 
-static const int32_t kMessageBufferSize = 16384;
+static const size_t kMessageBufferSize = 16384;
 
 
 - (instancetype)initWithName:(NSString *)name
 {
     self = [super init];
     if (!self) return nil;
-    
+
     _name = name;
-    _executionThread = [[SPCMessageQueueExecutionThread alloc] initWithName:_name
-                                                                     queue:self];
-    
-    bool successful = SPCRingBufferInit(&_messageBuffer, kMessageBufferSize);
+
+    bool successful = SPCMessageEngineInit(&_engine, [_name UTF8String], kMessageBufferSize);
     if (!successful) return nil;
-    
+
+    __weak SPCMessageQueue *weakSelf = self;
+    _mainThreadNotifier = ^{
+        [weakSelf performSelectorOnMainThread:@selector(flushQueue) withObject:nil waitUntilDone:NO];
+    };
+
     return self;
 }
 
 
 - (void)dealloc
 {
-    SPCRingBufferDispose(&_messageBuffer);
+    SPCMessageEngineDispose(&_engine);
 }
 
 
@@ -91,217 +78,103 @@ static const int32_t kMessageBufferSize = 16384;
 
 
 
-static const NSTimeInterval kThreadWaitTimeout = 0.01;
+/**
+ *  Forward pending messages from the engine's thread to the main thread.
+ */
+static void notifyMainThread(void *context)
+{
+    void (^notifier)(void) = (__bridge void (^)(void))context;
+    notifier();
+}
 
 
 - (void)startQueue
 {
-    @synchronized (self.executionThread) {
-        if (!self.executionThread) {
-            self.executionThread = [[SPCMessageQueueExecutionThread alloc] initWithName:self.name
-                                                                                 queue:self];
-            
-            assert(self.executionThread);
-            
-            [self.executionThread start];
-        }
+    @synchronized (self) {
+        bool successful = SPCMessageEngineStart(&_engine, notifyMainThread, (__bridge void *)_mainThreadNotifier);
+        assert(successful);
+        (void)successful;
     }
 }
 
 
 - (void)stopQueue
 {
-    @synchronized (self.executionThread) {
-        if (self.executionThread) {
-            [self.executionThread cancel];
-            
-            while ([self.executionThread isExecuting]) {
-                
-                HANDLE_KERN_ERROR("semaphore_signal", semaphore_signal(self.executionThread->_semaphore));
-                
-                [NSThread sleepForTimeInterval:kThreadWaitTimeout];
-            }
-            
-            self.executionThread = nil;
-        }
+    @synchronized (self) {
+        SPCMessageEngineStop(&_engine);
     }
 }
 
 
 - (BOOL)isRunning
 {
-    return [self.executionThread isExecuting];
+    return SPCMessageEngineIsRunning(&_engine);
 }
 
 
 /**
  *  The main processing logic of the message queue.
+ *
+ *  Handlers run directly on the messages in the ring buffer, and each message is only marked as read
+ *  after its handler returns. All available messages are drained in a single pass under one lock.
  */
 - (void)flushQueue
 {
-    for (;;) {
-        
-        message_t *message = NULL;
-        @synchronized (self) {
-            message = [self copyLastMessage];
-            if (!message)
-                break;
-        }
-        
-        if (message->handler) {
-            
-            // Run the handler.
-            message->handler(message->userInfoLength > 0 ? message + 1 : NULL, message->userInfoLength);
-        }
-        
-        free(message);
-    }
+    (void)SPCMessageEngineFlush(&_engine);
 }
 
 
-
-#pragma mark - Messaging
-
-
-
-struct message_t {
-    SPCMessageHandler  handler;
-    size_t             userInfoLength;
-};
-
-typedef struct message_t message_t;
-
-
-
-//
-// Dispatch a message to a lock-free message queue.
-//
-void SPCMessageQueueDispatch(SPCMessageQueue *this, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
+- (NSUInteger)spinCount
 {
-    //
-    // Write a message to the ring buffer.
-    //
-    size_t availableBytes;
-    message_t *message = SPCRingBufferGetForWrite(&this->_messageBuffer, &availableBytes);
-    assert(availableBytes >= sizeof(message_t) + userInfoLength);
-    
-    memset(message, 0, sizeof(message_t));
-    message->handler        = handler;
-    message->userInfoLength = userInfoLength;
-
-    if (userInfoLength > 0)
-        memcpy(message + 1, userInfo, userInfoLength);
-    
-    SPCRingBufferMarkWritten(&this->_messageBuffer, sizeof(message_t) + userInfoLength);
-    
-    //
-    // Signal the processing thread.
-    //
-    if (this->_executionThread)
-        HANDLE_KERN_ERROR("semaphore_signal",
-                          semaphore_signal(this->_executionThread->_semaphore));
+    return _engine._spinCount;
 }
 
 
-/**
- *  Check if there are messages to process.
- */
-- (BOOL)hasPendingMessages
+- (void)setSpinCount:(NSUInteger)spinCount
 {
-    size_t ignore;
-    return SPCRingBufferGetForRead(&_messageBuffer, &ignore) != NULL;
+    SPCMessageEngineSetSpinCount(&_engine, (unsigned int)spinCount);
 }
 
 
-/**
- *  Create a copy of the last message in the queue.
- *
- *  @return A copuy of the last message
- */
-- (message_t *)copyLastMessage
+- (NSUInteger)droppedMessageCount
 {
-    size_t availableBytes = 0;
-    message_t *buffer = SPCRingBufferGetForRead(&_messageBuffer, &availableBytes);
-    if (!buffer)
-        return NULL;
-    
-    
-    size_t messageLength = sizeof(message_t) + buffer->userInfoLength;
-    message_t *message = malloc(messageLength);
-    memcpy(message, buffer, messageLength);
-    SPCRingBufferMarkRead(&_messageBuffer, messageLength);
-    
-    return message;
+    return (NSUInteger)SPCMessageEngineGetDroppedMessageCount(&_engine);
 }
 
 
 
-@end
-
-
-
-#pragma mark - Message queue execution thread
-
-
-
-@interface SPCMessageQueueExecutionThread ()
-
-@property (nonatomic, weak) SPCMessageQueue *messageQueue;
-
-@end
-
-
-
-@implementation SPCMessageQueueExecutionThread
-
-
-
-#pragma mark - Initialization
+#pragma mark - Messaging
 
 
 
-- (instancetype)initWithName:(NSString *)name
-                       queue:(SPCMessageQueue *)messageQueue
+//
+// Try to dispatch a message to a lock-free message queue.
+//
+SPCMessageQueueDispatchStatus SPCMessageQueueTryDispatch(SPCMessageQueue *this, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
 {
-    self = [super init];
-    if (!self) return nil;
-    
-    _messageQueue = messageQueue;
-    
-    self.name = name;
-    
-    HANDLE_KERN_ERROR_AND_RETURN("semaphore_create",
-                                 semaphore_create(mach_task_self(), &_semaphore, SYNC_POLICY_FIFO, 0),
-                                 nil);
-    
-    return self;
+    return SPCMessageEngineTryDispatch(&this->_engine, handler, userInfo, userInfoLength);
 }
 
 
-- (void)dealloc
+//
+// Dispatch a message to a lock-free message queue, waiting for space if needed.
+//
+SPCMessageQueueDispatchStatus SPCMessageQueueDispatchWaiting(SPCMessageQueue *this,
+                                                             SPCMessageHandler handler,
+                                                             void *userInfo,
+                                                             size_t userInfoLength,
+                                                             NSTimeInterval timeout)
 {
-    HANDLE_KERN_ERROR("semaphore_destroy",
-                      semaphore_destroy(mach_task_self(), _semaphore));
+    return SPCMessageEngineDispatchWaiting(&this->_engine, handler, userInfo, userInfoLength, timeout);
 }
 
 
-
-#pragma mark - Message processing
-
-
-
-- (void)main
+//
+// Dispatch a message to a lock-free message queue.
+//
+void SPCMessageQueueDispatch(SPCMessageQueue *this, SPCMessageHandler handler, void *userInfo, size_t userInfoLength)
 {
-    while (![self isCancelled]) {
-        
-        HANDLE_KERN_ERROR("semaphore_wait",
-                          semaphore_wait(_semaphore));
-        
-        if ([_messageQueue hasPendingMessages]) {
-            
-            [_messageQueue performSelectorOnMainThread:@selector(flushQueue) withObject:nil waitUntilDone:NO];
-        }
-    }
+    SPCMessageEngineDispatch(&this->_engine, handler, userInfo, userInfoLength);
 }
 
 
@@ -9,10 +9,18 @@
 #ifndef PZ_SPPrimitives_h
 #define PZ_SPPrimitives_h
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 
 
-#define ARCH_PRIMITIVES
+// The C11 memory model backend is used by default on GCC and Clang.
+// Define SPC_ARCH_PRIMITIVES to fall back to the hand-written architecture-specific primitives.
+#if (defined __clang__ || defined __GNUC__) && !defined SPC_ARCH_PRIMITIVES
+#    define C11_PRIMITIVES
+#else
+#    define ARCH_PRIMITIVES
+#endif
 
 
 
@@ -20,6 +28,39 @@
 
 
 
+// The size of the cache lines data structures pad their shared fields to, in order to avoid false sharing.
+#ifndef SPC_CACHE_LINE_SIZE
+#    if defined __APPLE__ && defined __aarch64__
+#        define SPC_CACHE_LINE_SIZE 128
+#    else
+#        define SPC_CACHE_LINE_SIZE 64
+#    endif
+#endif
+
+#define SPC_CACHE_LINE_ALIGNED __attribute__((aligned(SPC_CACHE_LINE_SIZE)))
+
+
+
+
+#pragma mark - Concurrency primitives - Memory orders
+
+
+
+#ifdef __ATOMIC_RELAXED
+#    define SPC_MEMORY_ORDER_RELAXED __ATOMIC_RELAXED
+#    define SPC_MEMORY_ORDER_ACQUIRE __ATOMIC_ACQUIRE
+#    define SPC_MEMORY_ORDER_RELEASE __ATOMIC_RELEASE
+#    define SPC_MEMORY_ORDER_ACQ_REL __ATOMIC_ACQ_REL
+#    define SPC_MEMORY_ORDER_SEQ_CST __ATOMIC_SEQ_CST
+#else
+#    define SPC_MEMORY_ORDER_RELAXED 0
+#    define SPC_MEMORY_ORDER_ACQUIRE 2
+#    define SPC_MEMORY_ORDER_RELEASE 3
+#    define SPC_MEMORY_ORDER_ACQ_REL 4
+#    define SPC_MEMORY_ORDER_SEQ_CST 5
+#endif
+
+
 
 #pragma mark - Concurrency primitives - Architecture
 
@@ -39,6 +80,104 @@
 
 
 
+#pragma mark - Concurrency primitives - C11
+
+
+
+#ifdef C11_PRIMITIVES
+
+
+//
+// All operations work on pointer-sized words, like the architecture-specific backends, but each call
+// carries its own memory order, so ordering is enforced by the operation itself instead of a separate fence.
+// The plain variants keep the strongest ordering the hand-written backends provided (acquire loads,
+// release stores, sequentially consistent read-modify-write operations).
+//
+
+
+#define SPC_ATOMIC_LOAD_EXPLICIT(ptr, order) \
+    __atomic_load_n((const volatile uintptr_t *)(ptr), (order))
+
+#define SPC_ATOMIC_LOAD(ptr) SPC_ATOMIC_LOAD_EXPLICIT(ptr, SPC_MEMORY_ORDER_ACQUIRE)
+
+
+
+#define SPC_ATOMIC_STORE_EXPLICIT(ptr, value, order) \
+    __atomic_store_n((volatile uintptr_t *)(ptr), (uintptr_t)(value), (order))
+
+#define SPC_ATOMIC_STORE(ptr, value) SPC_ATOMIC_STORE_EXPLICIT(ptr, value, SPC_MEMORY_ORDER_RELEASE)
+
+
+
+#define SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(ptr, value, order) \
+    __atomic_fetch_add((volatile intptr_t *)(ptr), (intptr_t)(value), (order))
+
+#define SPC_ATOMIC_FETCH_AND_ADD(ptr, value) SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(ptr, value, SPC_MEMORY_ORDER_SEQ_CST)
+
+
+
+static FORCE_INLINE bool SPC__C11_atomic_compare_and_swap(volatile uintptr_t *ptr, uintptr_t oldValue, uintptr_t newValue, int order)
+{
+    // The failure order can be neither a release nor stronger than the success order.
+    int failureOrder = (order == SPC_MEMORY_ORDER_ACQ_REL) ? SPC_MEMORY_ORDER_ACQUIRE :
+                       (order == SPC_MEMORY_ORDER_RELEASE) ? SPC_MEMORY_ORDER_RELAXED : order;
+    
+    return __atomic_compare_exchange_n(ptr, &oldValue, newValue, false, order, failureOrder);
+}
+
+#define SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(ptr, oldValue, newValue, order) \
+    SPC__C11_atomic_compare_and_swap((volatile uintptr_t *)(ptr), (uintptr_t)(oldValue), (uintptr_t)(newValue), (order))
+
+#define SPC_ATOMIC_COMPARE_AND_SWAP(ptr, oldValue, newValue) \
+    SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(ptr, oldValue, newValue, SPC_MEMORY_ORDER_SEQ_CST)
+
+
+
+//
+// 32-bit variants, for structures that pack fields below the pointer size. Only this backend provides them,
+// so code using them has to check that SPC_ATOMIC32_LOAD_EXPLICIT is defined.
+//
+
+
+#define SPC_ATOMIC32_LOAD_EXPLICIT(ptr, order) \
+    __atomic_load_n((const volatile uint32_t *)(ptr), (order))
+
+#define SPC_ATOMIC32_STORE_EXPLICIT(ptr, value, order) \
+    __atomic_store_n((volatile uint32_t *)(ptr), (uint32_t)(value), (order))
+
+
+static FORCE_INLINE bool SPC__C11_atomic32_compare_and_swap(volatile uint32_t *ptr, uint32_t oldValue, uint32_t newValue, int order)
+{
+    int failureOrder = (order == SPC_MEMORY_ORDER_ACQ_REL) ? SPC_MEMORY_ORDER_ACQUIRE :
+                       (order == SPC_MEMORY_ORDER_RELEASE) ? SPC_MEMORY_ORDER_RELAXED : order;
+    
+    return __atomic_compare_exchange_n(ptr, &oldValue, newValue, false, order, failureOrder);
+}
+
+#define SPC_ATOMIC32_COMPARE_AND_SWAP_EXPLICIT(ptr, oldValue, newValue, order) \
+    SPC__C11_atomic32_compare_and_swap((volatile uint32_t *)(ptr), (uint32_t)(oldValue), (uint32_t)(newValue), (order))
+
+
+
+#define SPC_COMPILER_BARRIER()     __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+#define SPC_MEMORY_BARRIER_FULL()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define SPC_MEMORY_BARRIER_LOAD()  __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SPC_MEMORY_BARRIER_STORE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#if defined __x86_64__ || defined __i386__
+#    define SPC_STALL()            __asm__ __volatile__("pause" : : : "memory")
+#elif defined __aarch64__ || defined __arm__
+#    define SPC_STALL()            __asm__ __volatile__("yield" : : : "memory")
+#else
+#    define SPC_STALL()            __asm__ __volatile__(""      : : : "memory")
+#endif
+
+
+#endif
+
+
+
 #pragma mark - Concurrency primitives - ARM
 
 
@@ -370,6 +509,79 @@ static FORCE_INLINE bool SPC__x86_64_atomic_compare_and_swap(int64_t *ptr, int64
 
 
 
+#pragma mark - Concurrency primitives - Explicit memory orders
+
+
+
+#ifndef SPC_ATOMIC_LOAD_EXPLICIT
+
+
+//
+// Backends without native support for memory orders emulate them with barriers around the plain operations.
+// On x86 (TSO) only the compiler needs to be restrained, except for sequentially consistent stores.
+//
+
+#if defined x86_PRIMITIVES || defined x86_64_PRIMITIVES
+#    define SPC__MEMORY_BARRIER_ACQUIRE() SPC_COMPILER_BARRIER()
+#    define SPC__MEMORY_BARRIER_RELEASE() SPC_COMPILER_BARRIER()
+#    define SPC__ATOMIC_RMW_IS_FULL_BARRIER 1
+#else
+#    define SPC__MEMORY_BARRIER_ACQUIRE() SPC_MEMORY_BARRIER_FULL()
+#    define SPC__MEMORY_BARRIER_RELEASE() SPC_MEMORY_BARRIER_FULL()
+#    define SPC__ATOMIC_RMW_IS_FULL_BARRIER 0
+#endif
+
+
+static FORCE_INLINE void SPC__barrier_before(int order)
+{
+    if (order == SPC_MEMORY_ORDER_RELEASE || order == SPC_MEMORY_ORDER_ACQ_REL || order == SPC_MEMORY_ORDER_SEQ_CST)
+        SPC__MEMORY_BARRIER_RELEASE();
+}
+
+
+static FORCE_INLINE void SPC__barrier_after(int order)
+{
+    if (order == SPC_MEMORY_ORDER_ACQUIRE || order == SPC_MEMORY_ORDER_ACQ_REL || order == SPC_MEMORY_ORDER_SEQ_CST)
+        SPC__MEMORY_BARRIER_ACQUIRE();
+}
+
+
+#define SPC_ATOMIC_LOAD_EXPLICIT(ptr, order)                                 \
+    ({                                                                      \
+        __typeof__(SPC_ATOMIC_LOAD(ptr)) __spc_value = SPC_ATOMIC_LOAD(ptr); \
+        SPC__barrier_after(order);                                           \
+        __spc_value;                                                         \
+    })
+
+#define SPC_ATOMIC_STORE_EXPLICIT(ptr, value, order)  \
+    do {                                              \
+        SPC__barrier_before(order);                   \
+        SPC_ATOMIC_STORE(ptr, value);                 \
+        if ((order) == SPC_MEMORY_ORDER_SEQ_CST)      \
+            SPC_MEMORY_BARRIER_FULL();                \
+    } while (0)
+
+#define SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(ptr, value, order)                                    \
+    ({                                                                                         \
+        if (!SPC__ATOMIC_RMW_IS_FULL_BARRIER) SPC__barrier_before(order);                      \
+        __typeof__(SPC_ATOMIC_FETCH_AND_ADD(ptr, value)) __spc_value = SPC_ATOMIC_FETCH_AND_ADD(ptr, value); \
+        if (!SPC__ATOMIC_RMW_IS_FULL_BARRIER) SPC__barrier_after(order);                       \
+        __spc_value;                                                                           \
+    })
+
+#define SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(ptr, oldValue, newValue, order)                    \
+    ({                                                                                         \
+        if (!SPC__ATOMIC_RMW_IS_FULL_BARRIER) SPC__barrier_before(order);                      \
+        bool __spc_result = SPC_ATOMIC_COMPARE_AND_SWAP(ptr, oldValue, newValue);              \
+        if (!SPC__ATOMIC_RMW_IS_FULL_BARRIER) SPC__barrier_after(order);                       \
+        __spc_result;                                                                          \
+    })
+
+
+#endif
+
+
+
 #pragma mark - Atomic markable pointer
 
 
@@ -14,33 +14,72 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "SPUtils.h"
 
 #include "SPCPrimitives.h"
 #include "SPCMemoryReclamation.h"
+#include "SPCContention.h"
 
 
-static const size_t kProbabilityExponent = 1;  // A new level is added with probability (0.5)^kProbabilityExponent.
-static const size_t kMaxLevels           = 6;  // Max number of levels that we'll allocate fixed storage for.
+static const size_t kProbabilityExponent = 1;   // A new level is added with probability (0.5)^kProbabilityExponent.
+static const size_t kMinLevels           = 2;   // Min height of a queue (compact links need two links to keep a free list link).
+static const size_t kMaxLevels           = 32;  // Max height of a queue.
+
+enum { kMaxExtractionRunLength = 64 };  // Max number of nodes unlinked together by a batch extraction.
+
+
+
+#if SPC_PQ_COMPACT_LINKS
+
+#ifndef SPC_ATOMIC32_LOAD_EXPLICIT
+#error "SPC_PQ_COMPACT_LINKS requires the C11 primitives backend."
+#endif
+
+/**
+ *  A compact link: the low bits of the node's generation at the top, then its index in the storage plus one (0 for NULL),
+ *  then the deletion mark in the lowest bit. A link to a node that has since been reused no longer compares equal.
+ *
+ *  While a node is free, the pool keeps its pointer-sized free list link in the first two links.
+ */
+typedef uint32_t pqueue_link_t;
+
+enum { kLinkIndexBits = 24 };  // Up to 2^24 - 1 nodes.
+
+static const uint32_t kLinkIndexMask      = (1u << kLinkIndexBits) - 1;
+static const uint32_t kLinkGenerationMask = (1u << (31 - kLinkIndexBits)) - 1;
+
+#else
+
+typedef markable_ptr_t pqueue_link_t;
+
+#endif
 
 
 
 /**
- *  A concurrent lock-free priority queue node.
+ *  A concurrent lock-free priority queue node. The links take up the rest of the node, which is sized to hold as many
+ *  links as the height of the queue.
  */
 struct _SPCPriorityQueueNode {
     volatile long                      _cmem_refCount_c;     // Markable in the lowest bit - claim flag.
-    volatile markable_ptr_t            _next_d[kMaxLevels];  // Markable in the lowest bit - del flag.
+    uint32_t                           _generation;          // Bumped every time the node is reused.
+#if SPC_PQ_COMPACT_LINKS
+    uint32_t                           _index;               // The index of the node in the storage plus one.
+#endif
     SPCPriorityQueueNode     *volatile _rPrev;               // Contains a retained pointer.
     SPCPriorityQueueKey                _key;
+    unsigned long                      _sequence;            // Orders nodes with the same key (0 unless duplicates are kept).
     void                     *volatile _data_d;              // Markable in the lowest bit - del flag.
     size_t                             _height;
     volatile size_t                    _validToHeight;
+    volatile pqueue_link_t             _next_d[];            // Markable in the lowest bit - del flag.
 };
 
 
@@ -72,7 +111,7 @@ struct _SPCPriorityQueueNode {
  */
 
 
-static SPCPriorityQueueNode *scanForKey_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rStartingNodePtr, size_t level, SPCPriorityQueueKey key);
+static SPCPriorityQueueNode *scanForKey_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rStartingNodePtr, size_t level, SPCPriorityQueueKey key, unsigned long sequence);
 static SPCPriorityQueueNode *helpDeleteAndReleaseNode_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rNodeToDelete, size_t level);
 static void unlinkNodeAtLevel(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rNodeToUnlink, SPCPriorityQueueNode **rPrevPtr, size_t level);
 
@@ -82,51 +121,254 @@ static void unlinkNodeAtLevel(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rN
 
 
 
+/**
+ *  Make a link to a node.
+ *
+ *  @param pqueue A priority queue.
+ *  @param node   A node (or NULL).
+ *  @param markOn Whether the deletion mark is set.
+ *
+ *  @return A link, widened to a markable pointer.
+ */
+static FORCE_INLINE markable_ptr_t toLink(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node, bool markOn)
+{
+#if SPC_PQ_COMPACT_LINKS
+    (void)pqueue;
+    
+    if (!node)
+        return markOn;
+    
+    return ((node->_generation & kLinkGenerationMask) << (kLinkIndexBits + 1)) | (node->_index << 1) | markOn;
+#else
+    (void)pqueue;
+    
+    return toMarkable(node, markOn);
+#endif
+}
+
+
+/**
+ *  Get the node a link points to.
+ *
+ *  @param pqueue A priority queue.
+ *  @param link   A link, marked or not.
+ *
+ *  @return The node; NULL for a null link.
+ */
+static FORCE_INLINE SPCPriorityQueueNode *toNode(SPCPriorityQueue *pqueue, markable_ptr_t link)
+{
+#if SPC_PQ_COMPACT_LINKS
+    uint32_t index = (uint32_t)(link >> 1) & kLinkIndexMask;
+    
+    return index ? (SPCPriorityQueueNode *)(pqueue->_storage + (index - 1) * pqueue->_pool._nodeSize) : NULL;
+#else
+    (void)pqueue;
+    
+    return toPtr_m(link);
+#endif
+}
+
+
+/**
+ *  Atomically load a link.
+ *
+ *  @param linkPtr A pointer to a link.
+ *  @param order   The memory order.
+ *
+ *  @return The link, widened to a markable pointer.
+ */
+static FORCE_INLINE markable_ptr_t loadLink(volatile pqueue_link_t *linkPtr, int order)
+{
+#if SPC_PQ_COMPACT_LINKS
+    return SPC_ATOMIC32_LOAD_EXPLICIT(linkPtr, order);
+#else
+    return (markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(linkPtr, order));
+#endif
+}
+
+
+/**
+ *  Atomically store a link.
+ *
+ *  @param linkPtr A pointer to a link.
+ *  @param link    The new link.
+ *  @param order   The memory order.
+ */
+static FORCE_INLINE void storeLink(volatile pqueue_link_t *linkPtr, markable_ptr_t link, int order)
+{
+#if SPC_PQ_COMPACT_LINKS
+    SPC_ATOMIC32_STORE_EXPLICIT(linkPtr, link, order);
+#else
+    SPC_ATOMIC_STORE_EXPLICIT(linkPtr, link, order);
+#endif
+}
+
+
+/**
+ *  Atomically compare and swap a link.
+ *
+ *  @param linkPtr A pointer to a link.
+ *  @param oldLink The expected link.
+ *  @param newLink The new link.
+ *  @param order   The memory order.
+ *  @param site    The call site to count the attempt against.
+ *
+ *  @return true if the link was swapped; false, otherwise.
+ */
+static FORCE_INLINE bool compareAndSwapLink(volatile pqueue_link_t *linkPtr, markable_ptr_t oldLink, markable_ptr_t newLink, int order, SPCContentionSite site)
+{
+    (void)site;
+    
+#if SPC_PQ_COMPACT_LINKS
+    return SPC_CONTENTION_CAS(site, SPC_ATOMIC32_COMPARE_AND_SWAP_EXPLICIT(linkPtr, oldLink, newLink, order));
+#else
+    return SPC_CONTENTION_CAS(site, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(linkPtr, oldLink, newLink, order));
+#endif
+}
+
+
+/**
+ *  Check if a node comes before a position in the queue. Nodes are ordered by key, and nodes with the same key by
+ *  sequence number.
+ *
+ *  @param node     A node.
+ *  @param key      The key of the position.
+ *  @param sequence The sequence number of the position.
+ *
+ *  @return true if the node comes before the position; false, otherwise.
+ */
+static FORCE_INLINE bool isNodeBefore(SPCPriorityQueueNode *node, SPCPriorityQueueKey key, unsigned long sequence)
+{
+    return node->_key < key || (node->_key == key && node->_sequence < sequence);
+}
+
+
+/**
+ *  Check if a node is at a position in the queue.
+ *
+ *  @param node     A node.
+ *  @param key      The key of the position.
+ *  @param sequence The sequence number of the position.
+ *
+ *  @return true if the node has the key and sequence number of the position; false, otherwise.
+ */
+static FORCE_INLINE bool isNodeAt(SPCPriorityQueueNode *node, SPCPriorityQueueKey key, unsigned long sequence)
+{
+    return node->_key == key && node->_sequence == sequence;
+}
+
+
 /**
  *  Check if a node is retained (i.e. isn't in the free list).
  *
- *  @param node A node to check.
+ *  @param pqueue A priority queue.
+ *  @param node   A node to check.
  *
  *  @return true if retained; false, otherwise.
  */
-static FORCE_INLINE bool isNodeRetained(SPCPriorityQueueNode *node)
+static FORCE_INLINE bool isNodeRetained(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
 {
+    // Under hazard pointers, the node may have been claimed by the thread that deleted it while we still hold it.
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationHazardPointers &&
+        cmem_hazardIsProtected(cmem_hazardAcquireRecord(&pqueue->_hazardDomain), node))
+        return true;
+    
     return cmem_isRetained(node, offsetof(SPCPriorityQueueNode, _cmem_refCount_c));
 }
 
 
+/**
+ *  Take a reference to a node, without checking that it is retained.
+ *
+ *  Under hazard pointers, the node is published in a hazard slot of the calling thread, and its reference count
+ *  is only used if the thread has no free slot left.
+ *
+ *  @param pqueue A priority queue.
+ *  @param node   A node.
+ */
+static FORCE_INLINE void referenceNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
+{
+    // Under epochs, nodes reachable during an operation stay valid until it ends.
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        return;
+    
+    if (pqueue->_reclamationScheme != kSPCMemoryReclamationHazardPointers ||
+        !cmem_hazardProtect(cmem_hazardAcquireRecord(&pqueue->_hazardDomain), node))
+        cmem_retainNode(node, offsetof(SPCPriorityQueueNode, _cmem_refCount_c));
+}
+
+
+/**
+ *  Drop a reference to a node, without checking that it is retained.
+ *
+ *  @param pqueue A priority queue.
+ *  @param node   A node.
+ */
+static FORCE_INLINE void dereferenceNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
+{
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        return;
+    
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationHazardPointers) {
+        cmem_hazard_record_t *record = cmem_hazardAcquireRecord(&pqueue->_hazardDomain);
+        if (!cmem_hazardUnprotect(record, node))
+            cmem_hazardReleaseNode(&pqueue->_hazardDomain, record, node);
+        return;
+    }
+    
+    // The pool can only check pointer-sized links for being cleared.
+    cmem_poolReleaseNode(&pqueue->_pool, node, SPC_PQ_COMPACT_LINKS ? 0 : pqueue->_maxHeight, offsetof(SPCPriorityQueueNode, _rPrev));
+}
+
+
 /**
  *  Create a new node.
  *
- *  @param pqueue A lock-free priority queue.
- *  @param key    The node key.
- *  @param data   The node data.
+ *  @param pqueue     A lock-free priority queue.
+ *  @param height     The node height.
+ *  @param key        The node key.
+ *  @param data       The node data.
+ *  @param mayReclaim Whether to reclaim deleted nodes if the pool is empty. The calling thread must not hold any nodes then.
  *
  *  @return A newly created node with the requested key and data.
  */
-static FORCE_INLINE SPCPriorityQueueNode *createNode(SPCPriorityQueue *pqueue, size_t height, SPCPriorityQueueKey key, void *data)
+static FORCE_INLINE SPCPriorityQueueNode *createNode(SPCPriorityQueue *pqueue, size_t height, SPCPriorityQueueKey key, void *data, bool mayReclaim)
 {
     assert(pqueue);
 
-    SPCPriorityQueueNode *newNode = cmem_allocNode((void *volatile *)(&pqueue->_freeList),
-                                                   offsetof(SPCPriorityQueueNode, _cmem_refCount_c),
-                                                   offsetof(SPCPriorityQueueNode, _next_d));
+    // Under hazard pointers or epochs, deleted nodes may still be held back by other threads.
+    if (mayReclaim && !cmem_poolHasFreeNodes(&pqueue->_pool)) {
+        if (pqueue->_reclamationScheme == kSPCMemoryReclamationHazardPointers)
+            (void)cmem_hazardReclaim(&pqueue->_hazardDomain, cmem_hazardAcquireRecord(&pqueue->_hazardDomain));
+        else if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs)
+            (void)cmem_epochReclaim(&pqueue->_epochDomain, cmem_epochAcquireRecord(&pqueue->_epochDomain));
+    }
+
+    SPCPriorityQueueNode *newNode = cmem_poolAllocNode(&pqueue->_pool);
     if (!newNode)
         return NULL;
     
-    assert(isNodeRetained(newNode));
+    assert(isNodeRetained(pqueue, newNode));
     
     newNode->_key           = key;
+    newNode->_sequence      = pqueue->_keepsDuplicateKeys ? (unsigned long)(SPC_ATOMIC_FETCH_AND_ADD_EXPLICIT(&pqueue->_sequence, 1, SPC_MEMORY_ORDER_RELAXED)) : 0;
     newNode->_data_d        = data;
     newNode->_rPrev         = NULL;
     newNode->_height        = (typeof(newNode->_height))(height);
     newNode->_validToHeight = 0;
     
-    for (int iterLevel = 0; iterLevel < kMaxLevels; ++iterLevel)
-        newNode->_next_d[iterLevel] = toMarkable(NULL, false);
+    // Links and handles made to the previous use of the node no longer match.
+    newNode->_generation++;
     
-    SPC_MEMORY_BARRIER_STORE();
+#if SPC_PQ_COMPACT_LINKS
+    if (!newNode->_index)
+        newNode->_index = (uint32_t)(((void *)newNode - pqueue->_storage) / pqueue->_pool._nodeSize) + 1;
+#endif
+    
+    for (int iterLevel = 0; iterLevel < pqueue->_maxHeight; ++iterLevel)
+        newNode->_next_d[iterLevel] = toLink(pqueue, NULL, false);
     
+    // The node is published by the release operation that links it into the queue.
     return newNode;
 }
 
@@ -134,15 +376,16 @@ static FORCE_INLINE SPCPriorityQueueNode *createNode(SPCPriorityQueue *pqueue, s
 /**
  *  Retain a node.
  *
- *  @param node A node.
+ *  @param pqueue A pointer to a priority queue.
+ *  @param node   A node.
  *
  *  @return The retained node.
  */
-static FORCE_INLINE SPCPriorityQueueNode *retainNode(SPCPriorityQueueNode *node)
+static FORCE_INLINE SPCPriorityQueueNode *retainNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
 {
-    assert(isNodeRetained(node));
+    assert(isNodeRetained(pqueue, node));
     
-    cmem_retainNode(node, offsetof(SPCPriorityQueueNode, _cmem_refCount_c));
+    referenceNode(pqueue, node);
     
     return node;
 }
@@ -156,14 +399,82 @@ static FORCE_INLINE SPCPriorityQueueNode *retainNode(SPCPriorityQueueNode *node)
  */
 static FORCE_INLINE void releaseNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
 {
-    assert(isNodeRetained(node));
+    assert(isNodeRetained(pqueue, node));
+    
+    dereferenceNode(pqueue, node);
+}
+
+
+/**
+ *  Delete a node, by releasing the reference the queue holds to it.
+ *
+ *  @param pqueue A pointer to a priority queue.
+ *  @param node   A pointer to a node that has been unlinked from the queue (or never linked).
+ */
+static FORCE_INLINE void deleteNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
+{
+    assert(isNodeRetained(pqueue, node));
+    
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationHazardPointers) {
+        // The hazard slots only hold the references of traversals.
+        cmem_hazardReleaseNode(&pqueue->_hazardDomain, cmem_hazardAcquireRecord(&pqueue->_hazardDomain), node);
+        return;
+    }
+    
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs) {
+        cmem_epochRetireNode(&pqueue->_epochDomain, cmem_epochAcquireRecord(&pqueue->_epochDomain), node);
+        return;
+    }
+    
+    dereferenceNode(pqueue, node);
+}
+
+
+/**
+ *  Delete a node that was never linked into the queue, so no other thread can have seen it.
+ *
+ *  @param pqueue A pointer to a priority queue.
+ *  @param node   A pointer to a node.
+ */
+static FORCE_INLINE void discardNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *node)
+{
+    // Under epochs, the node can skip limbo.
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs) {
+        cmem_epochFreeNode(&pqueue->_epochDomain, node);
+        return;
+    }
+    
+    deleteNode(pqueue, node);
+}
+
+
+/**
+ *  Begin a public operation on the queue. Under epochs, announces the current epoch.
+ *
+ *  @param pqueue A pointer to a priority queue.
+ *
+ *  @return The calling thread's epoch record; NULL under other schemes.
+ */
+static FORCE_INLINE cmem_epoch_record_t *beginOperation(SPCPriorityQueue *pqueue)
+{
+    if (pqueue->_reclamationScheme != kSPCMemoryReclamationEpochs)
+        return NULL;
+    
+    return cmem_epochEnter(&pqueue->_epochDomain);
+}
+
+
+/**
+ *  End a public operation on the queue.
+ *
+ *  @param pqueue A pointer to a priority queue.
+ *  @param record The record returned by beginOperation().
+ */
+static FORCE_INLINE void endOperation(SPCPriorityQueue *pqueue, cmem_epoch_record_t *record)
+{
+    (void)pqueue;
     
-    return cmem_releaseNode(node,
-                            offsetof(SPCPriorityQueueNode, _cmem_refCount_c),
-                            offsetof(SPCPriorityQueueNode, _next_d),
-                            kMaxLevels,
-                            offsetof(SPCPriorityQueueNode, _rPrev),
-                            (void *volatile *)(&pqueue->_freeList));
+    cmem_epochLeave(record);
 }
 
 
@@ -175,7 +486,7 @@ static FORCE_INLINE void releaseNode(SPCPriorityQueue *pqueue, SPCPriorityQueueN
  *
  *  @return A regular pointer to a retained node.
  */
-static FORCE_INLINE SPCPriorityQueueNode *readAndRetainNode_d(SPCPriorityQueue *pqueue, volatile markable_ptr_t *node_d_Ptr)
+static FORCE_INLINE SPCPriorityQueueNode *readAndRetainNode_d(SPCPriorityQueue *pqueue, volatile pqueue_link_t *node_d_Ptr)
 {
     assert(pqueue);
     assert(node_d_Ptr);
@@ -183,33 +494,50 @@ static FORCE_INLINE SPCPriorityQueueNode *readAndRetainNode_d(SPCPriorityQueue *
     for (;;) {
         // We need to have the node retained before it changes,
         // as this whole operation is considered to be atomic.
-        markable_ptr_t node_d = (markable_ptr_t)(SPC_ATOMIC_LOAD(node_d_Ptr));
+        markable_ptr_t node_d = loadLink(node_d_Ptr, SPC_MEMORY_ORDER_ACQUIRE);
         if (isMarked_m(node_d))
             return NULL;
         
-        SPCPriorityQueueNode *node = toPtr_m(node_d);
+        SPCPriorityQueueNode *node = toNode(pqueue, node_d);
         assert(node);
+        
+        if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs)
+            return node;
 
-        cmem_retainNode(node, offsetof(SPCPriorityQueueNode, _cmem_refCount_c));
-        SPC_MEMORY_BARRIER_FULL(); // Synchronize a load of the node ptr and a store in the node's reference count simultaneously.
+        // The retain is an acquire-release operation (and a hazard publication is followed by a full barrier),
+        // so the reload below cannot be observed before it.
+        referenceNode(pqueue, node);
 
-        if (node_d == (markable_ptr_t)(SPC_ATOMIC_LOAD(node_d_Ptr))) {
-            assert(isNodeRetained(node));
+        if (node_d == loadLink(node_d_Ptr, SPC_MEMORY_ORDER_ACQUIRE)) {
+            assert(isNodeRetained(pqueue, node));
             
             return node;
         } else {
             // This should never need to use the free list unless we preempted a reclaim.
-            cmem_releaseNode(node,
-                             offsetof(SPCPriorityQueueNode, _cmem_refCount_c),
-                             offsetof(SPCPriorityQueueNode, _next_d),
-                             kMaxLevels,
-                             offsetof(SPCPriorityQueueNode, _rPrev),
-                             (void *volatile *)(&pqueue->_freeList));
+            dereferenceNode(pqueue, node);
         }
     }
 }
 
 
+/**
+ *  Fill in a handle to a node.
+ *
+ *  @param outHandle An optional pointer to a handle.
+ *  @param rNode     A node (retained, or not linked yet).
+ */
+static FORCE_INLINE void fillHandle(SPCPriorityQueueHandle *outHandle, SPCPriorityQueueNode *rNode)
+{
+    if (!outHandle)
+        return;
+    
+    outHandle->_node       = rNode;
+    outHandle->_key        = rNode->_key;
+    outHandle->_sequence   = rNode->_sequence;
+    outHandle->_generation = rNode->_generation;
+}
+
+
 
 #pragma mark - Initialization
 
@@ -224,15 +552,85 @@ static FORCE_INLINE SPCPriorityQueueNode *readAndRetainNode_d(SPCPriorityQueue *
  *  @return true if successful; false, otherwise.
  */
 bool SPCPriorityQueueInit(SPCPriorityQueue *pqueue, size_t length)
+{
+    return SPCPriorityQueueInitWithReclamationScheme(pqueue, length, kSPCMemoryReclamationReferenceCounting);
+}
+
+
+/**
+ *  Initialize a concurrent lock-free priority queue with a given memory reclamation scheme.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param length The priority queue length. (More memory may actually be allocated.)
+ *  @param scheme The memory reclamation scheme.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueInitWithReclamationScheme(SPCPriorityQueue *pqueue, size_t length, SPCMemoryReclamationScheme scheme)
+{
+    return SPCPriorityQueueInitWithMaxHeight(pqueue, length, scheme, 0);
+}
+
+
+/**
+ *  Initialize a concurrent lock-free priority queue with a given memory reclamation scheme and maximum height.
+ *
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param length    The priority queue length. (More memory may actually be allocated.)
+ *  @param scheme    The memory reclamation scheme.
+ *  @param maxHeight The maximum height of the skip list; 0 to derive it from the length.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueInitWithMaxHeight(SPCPriorityQueue *pqueue, size_t length, SPCMemoryReclamationScheme scheme, size_t maxHeight)
 {
     assert(pqueue);
     
+    pqueue->_storage            = NULL;
+    pqueue->_reclamationScheme  = kSPCMemoryReclamationReferenceCounting;
+    pqueue->_keepsDuplicateKeys = false;
+    pqueue->_sequence           = 0;
+    
+    if (scheme == kSPCMemoryReclamationHazardPointers) {
+        if (!cmem_hazardInit(&pqueue->_hazardDomain, &pqueue->_pool))
+            return false;
+        
+        pqueue->_reclamationScheme = scheme;
+    } else if (scheme == kSPCMemoryReclamationEpochs) {
+        if (!cmem_epochInit(&pqueue->_epochDomain, &pqueue->_pool))
+            return false;
+        
+        pqueue->_reclamationScheme = scheme;
+    }
+    
     //
     // Allocate memory for the nodes.
     // (Reserve 2 nodes for head and tail.)
     //
     size_t queueLength = length + 2;
-    pqueue->_storage = calloc(queueLength, sizeof(SPCPriorityQueueNode));
+    
+#if SPC_PQ_COMPACT_LINKS
+    if (queueLength > kLinkIndexMask) {
+        STD_OUTPUT_ERROR("priority queue allocation", "too long for compact links");
+        
+        SPCPriorityQueueDispose(pqueue);
+        return false;
+    }
+#endif
+    
+    //
+    // Size the nodes to the height of the queue. Each level is expected to hold 1/2^kProbabilityExponent of the nodes
+    // of the level below, so the derived height leaves about one node on the top level of a full queue.
+    //
+    if (!maxHeight)
+        for (maxHeight = 1; maxHeight < kMaxLevels && (queueLength - 1) >> (maxHeight * kProbabilityExponent); ++maxHeight);
+    
+    pqueue->_maxHeight = (maxHeight < kMinLevels) ? kMinLevels : (maxHeight > kMaxLevels) ? kMaxLevels : maxHeight;
+    
+    size_t nodeSize = offsetof(SPCPriorityQueueNode, _next_d) + pqueue->_maxHeight * sizeof(pqueue_link_t);
+    nodeSize = (nodeSize + __alignof__(SPCPriorityQueueNode) - 1) & ~(__alignof__(SPCPriorityQueueNode) - 1);
+    
+    pqueue->_storage = calloc(queueLength, nodeSize);
     if (!pqueue->_storage) {
         STD_OUTPUT_ERROR("priority queue allocation", "FAILURE");
         
@@ -245,25 +643,28 @@ bool SPCPriorityQueueInit(SPCPriorityQueue *pqueue, size_t length)
     //
     // Prepare the free list for the custom lock-free memory allocator.
     //
-    cmem_init((void *volatile *)(&pqueue->_freeList),
-              offsetof(SPCPriorityQueueNode, _cmem_refCount_c),
-              offsetof(SPCPriorityQueueNode, _next_d),
-              sizeof(SPCPriorityQueueNode),
-              pqueue->_storage,
-              queueLength);
+    cmem_poolInit(&pqueue->_pool,
+                  offsetof(SPCPriorityQueueNode, _cmem_refCount_c),
+                  offsetof(SPCPriorityQueueNode, _next_d),
+                  nodeSize,
+                  pqueue->_storage,
+                  queueLength);
     
     //
     // Prepare the queue.
     //
-    pqueue->_head = createNode(pqueue, kMaxLevels, SPC_PQ_KEY_MIN, NULL);
-    pqueue->_tail = createNode(pqueue, kMaxLevels, SPC_PQ_KEY_MAX, NULL);
+    pqueue->_head = createNode(pqueue, pqueue->_maxHeight, SPC_PQ_KEY_MIN, NULL, true);
+    pqueue->_tail = createNode(pqueue, pqueue->_maxHeight, SPC_PQ_KEY_MAX, NULL, true);
     
-    pqueue->_head->_validToHeight = kMaxLevels;
-    pqueue->_tail->_validToHeight = kMaxLevels;
+    // The tail comes after any node with the maximum key.
+    pqueue->_tail->_sequence = ULONG_MAX;
+    
+    pqueue->_head->_validToHeight = pqueue->_maxHeight;
+    pqueue->_tail->_validToHeight = pqueue->_maxHeight;
     
     for (int iterLevel = 0; iterLevel < pqueue->_head->_height; ++iterLevel) {
-        pqueue->_head->_next_d[iterLevel] = toMarkable(pqueue->_tail, false);
-        pqueue->_tail->_next_d[iterLevel] = toMarkable(NULL, false);
+        pqueue->_head->_next_d[iterLevel] = toLink(pqueue, pqueue->_tail, false);
+        pqueue->_tail->_next_d[iterLevel] = toLink(pqueue, NULL, false);
     }
     
     // Prevent future changes from being observed before the queue is fully setup.
@@ -274,93 +675,184 @@ bool SPCPriorityQueueInit(SPCPriorityQueue *pqueue, size_t length)
 
 
 /**
- *  Dispose of a concurrent lock-free priority queue.
+ *  Put per-thread magazines of free nodes in front of the queue's shared free list. Call before the queue is shared
+ *  between threads.
  *
- *  @param pqueue A pointer to a lock-free priority queue.
+ *  A thread then allocates and deletes nodes in its own magazine, and only touches the shared free list to refill
+ *  half of an empty magazine or to spill half of a full one. Each thread may keep up to magazineSize free nodes to
+ *  itself, so allow for that in the length.
+ *
+ *  @param pqueue       A pointer to a lock-free priority queue.
+ *  @param magazineSize The number of free nodes a thread can keep (capped at kCMemMaxMagazineSize).
+ *
+ *  @return true if successful; false, otherwise.
  */
-void SPCPriorityQueueDispose(SPCPriorityQueue *pqueue)
+bool SPCPriorityQueueEnableMagazines(SPCPriorityQueue *pqueue, size_t magazineSize)
 {
-    // Prevent old changes from being observed happening after the queue release.
-    SPC_MEMORY_BARRIER_STORE();
-    
-    free(pqueue->_storage);
+    assert(pqueue);
     
-    memset(pqueue, 0, sizeof(SPCPriorityQueue));
+    return cmem_poolEnableMagazines(&pqueue->_pool, magazineSize);
 }
 
 
-
-#pragma mark - Node traversal
-
-
-
 /**
- *  Read next node.
+ *  Let the queue grow by slabs of nodes once its length is used up, instead of failing to insert. Call before the queue
+ *  is shared between threads.
  *
- *  Traverses to the next node of rNodePtr on the given level while helping any marked nodes finish the deletion.
- *  If the starting point is already marked for deletion, as a side effect, it writes the new prev node of the next node to rNodePtr.
- *  The next node is retained unless it is marked for deletion. rNodePtr is assumed to contain a retained pointer.
- *  If rNodePtr is changed, the old node will be released, and the new one will be retained.
+ *  Inserts stay lock-free and never allocate memory: an exhausted queue chains a slab from a reserve of preallocated
+ *  slabs, which SPCPriorityQueueReplenishGrowthReserve() refills. Nodes never move, and slabs are only freed with the queue.
  *
- *  @param pqueue   A priority queue.
- *  @param rNodePtr A pointer to a retained pointer to a node.
- *  @param level    A given level.
+ *  @param pqueue        A pointer to a lock-free priority queue.
+ *  @param slabLength    The number of nodes in a slab.
+ *  @param reserveLength The number of slabs to keep in reserve.
  *
- *  @return The next node (retained).
+ *  @return true if successful; false, otherwise.
  */
-static SPCPriorityQueueNode *readNextNode_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rNodePtr, size_t level)
+bool SPCPriorityQueueEnableGrowth(SPCPriorityQueue *pqueue, size_t slabLength, size_t reserveLength)
 {
     assert(pqueue);
-    assert(rNodePtr);
-    assert(isNodeRetained(*rNodePtr));
     
-    if (isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&(*rNodePtr)->_data_d))))
-        *rNodePtr = helpDeleteAndReleaseNode_r(pqueue, *rNodePtr, level);
-    
-    SPCPriorityQueueNode *rNextNode = readAndRetainNode_d(pqueue, &(*rNodePtr)->_next_d[level]);
-    while (!rNextNode) {
-        *rNodePtr = helpDeleteAndReleaseNode_r(pqueue, *rNodePtr, level);
-        rNextNode = readAndRetainNode_d(pqueue, &(*rNodePtr)->_next_d[level]);
-    }
+#if SPC_PQ_COMPACT_LINKS
+    (void)slabLength;
+    (void)reserveLength;
     
-    assert(level < rNextNode->_height);
-    assert(isNodeRetained(rNextNode));
-    assert(isNodeRetained(*rNodePtr));
-    return rNextNode;
+    // Compact links can only address nodes in the initial storage.
+    STD_OUTPUT_ERROR("SPCPriorityQueueEnableGrowth", "not available with compact links");
+    return false;
+#else
+    return cmem_poolEnableGrowth(&pqueue->_pool, slabLength, reserveLength);
+#endif
 }
 
 
 /**
- *  Scan for a node with key.
+ *  Refill the growth reserve of the queue. Allocates memory, so call it from a non-real-time context, e.g. periodically
+ *  or after an insert has failed. Safe to call while other threads use the queue.
  *
- *  Traverses in several steps through the next pointers (starting from rStartingNodePtr)
- *  until it finds a node that has the same or higher key than the given one.
+ *  @param pqueue A pointer to a lock-free priority queue.
  *
- *  If the given node is marked for deletion or no longer valid, the correct prev node of the found node
- *  is written in rStartingNodePtr. Both the returned node and rNodePtr are retained pointers, so if *rStartingNodePtr is
- *  changed, the old value will be released and the new one will be retained.
+ *  @return true if the reserve is full; false, otherwise.
+ */
+bool SPCPriorityQueueReplenishGrowthReserve(SPCPriorityQueue *pqueue)
+{
+    assert(pqueue);
+    
+    return cmem_poolReplenishReserve(&pqueue->_pool);
+}
+
+
+/**
+ *  Keep elements with equal keys, and extract them in the order they were inserted, instead of replacing the element
+ *  that holds a key. Call before the queue is shared between threads.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ */
+void SPCPriorityQueueEnableDuplicateKeys(SPCPriorityQueue *pqueue)
+{
+    assert(pqueue);
+    
+    pqueue->_keepsDuplicateKeys = true;
+}
+
+
+/**
+ *  Dispose of a concurrent lock-free priority queue.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ */
+void SPCPriorityQueueDispose(SPCPriorityQueue *pqueue)
+{
+    // Prevent old changes from being observed happening after the queue release.
+    SPC_MEMORY_BARRIER_STORE();
+    
+    if (pqueue->_reclamationScheme == kSPCMemoryReclamationHazardPointers)
+        cmem_hazardDispose(&pqueue->_hazardDomain);
+    else if (pqueue->_reclamationScheme == kSPCMemoryReclamationEpochs)
+        cmem_epochDispose(&pqueue->_epochDomain);
+    
+    if (pqueue->_storage)
+        cmem_poolDispose(&pqueue->_pool);
+    
+    free(pqueue->_storage);
+    
+    memset(pqueue, 0, sizeof(SPCPriorityQueue));
+}
+
+
+
+#pragma mark - Node traversal
+
+
+
+/**
+ *  Read next node.
+ *
+ *  Traverses to the next node of rNodePtr on the given level while helping any marked nodes finish the deletion.
+ *  If the starting point is already marked for deletion, as a side effect, it writes the new prev node of the next node to rNodePtr.
+ *  The next node is retained unless it is marked for deletion. rNodePtr is assumed to contain a retained pointer.
+ *  If rNodePtr is changed, the old node will be released, and the new one will be retained.
+ *
+ *  @param pqueue   A priority queue.
+ *  @param rNodePtr A pointer to a retained pointer to a node.
+ *  @param level    A given level.
+ *
+ *  @return The next node (retained).
+ */
+static SPCPriorityQueueNode *readNextNode_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rNodePtr, size_t level)
+{
+    assert(pqueue);
+    assert(rNodePtr);
+    assert(isNodeRetained(pqueue, *rNodePtr));
+    
+    if (isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&(*rNodePtr)->_data_d, SPC_MEMORY_ORDER_ACQUIRE))))
+        *rNodePtr = helpDeleteAndReleaseNode_r(pqueue, *rNodePtr, level);
+    
+    SPCPriorityQueueNode *rNextNode = readAndRetainNode_d(pqueue, &(*rNodePtr)->_next_d[level]);
+    while (!rNextNode) {
+        *rNodePtr = helpDeleteAndReleaseNode_r(pqueue, *rNodePtr, level);
+        rNextNode = readAndRetainNode_d(pqueue, &(*rNodePtr)->_next_d[level]);
+    }
+    
+    assert(level < rNextNode->_height);
+    assert(isNodeRetained(pqueue, rNextNode));
+    assert(isNodeRetained(pqueue, *rNodePtr));
+    return rNextNode;
+}
+
+
+/**
+ *  Scan for a node with key.
+ *
+ *  Traverses in several steps through the next pointers (starting from rStartingNodePtr)
+ *  until it finds a node that has the same or higher key than the given one (and, for the same key,
+ *  the same or higher sequence number).
+ *
+ *  If the given node is marked for deletion or no longer valid, the correct prev node of the found node
+ *  is written in rStartingNodePtr. Both the returned node and rNodePtr are retained pointers, so if *rStartingNodePtr is
+ *  changed, the old value will be released and the new one will be retained.
  *
  *  @param pqueue           A priority queue.
  *  @param rStartingNodePtr A pointer to a pointer to a node defining the starting point.
  *  @param level            A given level.
  *  @param key              A given key.
+ *  @param sequence         A given sequence number.
  *
  *  @return A node with the same or higher key than the given one (retained).
  */
-static SPCPriorityQueueNode *scanForKey_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rStartingNodePtr, size_t level, SPCPriorityQueueKey key)
+static SPCPriorityQueueNode *scanForKey_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rStartingNodePtr, size_t level, SPCPriorityQueueKey key, unsigned long sequence)
 {
     assert(rStartingNodePtr);
-    assert(isNodeRetained(*rStartingNodePtr));
+    assert(isNodeRetained(pqueue, *rStartingNodePtr));
   
     SPCPriorityQueueNode *rNextNode = readNextNode_r(pqueue, rStartingNodePtr, level);
-    while (rNextNode->_key < key) { // We can check if we've reached the tail, but since the tail
-                                    // always has key ST_PQ_MAX, this is not necessary.
+    while (isNodeBefore(rNextNode, key, sequence)) { // We can check if we've reached the tail, but since the tail
+                                                     // always comes last, this is not necessary.
         releaseNode(pqueue, *rStartingNodePtr);
         *rStartingNodePtr = rNextNode;
         rNextNode         = readNextNode_r(pqueue, rStartingNodePtr, level);
     }
     
-    assert(isNodeRetained(rNextNode));
+    assert(isNodeRetained(pqueue, rNextNode));
     return rNextNode;
 }
 
@@ -370,40 +862,49 @@ static SPCPriorityQueueNode *scanForKey_r(SPCPriorityQueue *pqueue, SPCPriorityQ
 
 
 
+static pthread_key_t  s_randomStateKey;
+static pthread_once_t s_randomStateKeyOnce = PTHREAD_ONCE_INIT;
+
+
 /**
- *  Return a random bit with (0.5)^pow probability.
- *
- *  @param pow The probability exponent.
+ *  Create the thread-specific key of the level generators.
+ */
+static void createRandomStateKey(void)
+{
+    if (pthread_key_create(&s_randomStateKey, NULL) != 0)
+        STD_OUTPUT_ERROR("priority queue level generator", "can't create a thread-specific key");
+}
+
+
+/**
+ *  Return a random word from the calling thread's xorshift generator (Marsaglia). The state lives in a thread-specific
+ *  value, so concurrent inserts share nothing.
  *
- *  @return A random bit.
+ *  @return A random word.
  */
-static bool getRandomBit(unsigned int pow)
+static FORCE_INLINE uintptr_t nextRandomWord(void)
 {
-    // Initialize the random seed.
-    //
-    static bool s_init = false;
-    if (!s_init) {
-        s_init = true;
-        srand48((long)(time(NULL)));
+    pthread_once(&s_randomStateKeyOnce, createRandomStateKey);
+    
+    uintptr_t state = (uintptr_t)(pthread_getspecific(s_randomStateKey));
+    if (__builtin_expect(!state, 0)) {
+        // Seed from the time and the stack address of the thread, spread over the word by a golden ratio multiply.
+        state = ((uintptr_t)(time(NULL)) ^ (uintptr_t)(&state)) * (uintptr_t)(0x9E3779B97F4A7C15ull) | 1;
     }
     
-    // Get a random word and keep returning the bits one by one, until we've used them all.
-    //
-    static long s_randomBitSequence;
-    static int  s_currentBit = sizeof(long) * CHAR_BIT - 1;
+#if UINTPTR_MAX > UINT32_MAX
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+#else
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+#endif
     
-    while (pow--) {
-        if (s_currentBit >= sizeof(long) * CHAR_BIT - 1) {
-            s_currentBit = -1;
-            s_randomBitSequence = lrand48();
-        }
-        ++s_currentBit;
-        
-        if (!((s_randomBitSequence & (1 << s_currentBit)) >> s_currentBit))
-            return false;
-    }
+    pthread_setspecific(s_randomStateKey, (void *)(state));
     
-    return true;
+    return state;
 }
 
 
@@ -416,81 +917,78 @@ static bool getRandomBit(unsigned int pow)
  */
 static FORCE_INLINE size_t chooseRandomHeight(size_t maxHeight)
 {
-    // Limit the maximum level to available storage capacity.
-    if (maxHeight > kMaxLevels)
-        maxHeight = kMaxLevels;
+    const uintptr_t levelMask = ((uintptr_t)(1) << kProbabilityExponent) - 1;
+    
+    // Each level takes kProbabilityExponent bits of a single random word.
+    uintptr_t randomBits = nextRandomWord();
     
     size_t height = 1;
-    while (getRandomBit(kProbabilityExponent) && height < maxHeight)
+    while (height < maxHeight && (randomBits & levelMask) == levelMask) {
+        randomBits >>= kProbabilityExponent;
         ++height;
+    }
     
     return height;
 }
 
 
 /**
- *  Insert an element into a priority queue.
+ *  Link a new node into the queue on all its levels, or, if there is a node with the same key, swap the data into it
+ *  instead (within an operation).
  *
- *  @param pqueue A pointer to a lock-free priority queue.
- *  @param key    An element key.
- *  @param data   The element.
+ *  @param pqueue          A pointer to a lock-free priority queue.
+ *  @param rNewNode        The new node (retained), which is released, and discarded if its data is swapped into
+ *                         another node. It is left retained and unlinked if the call fails.
+ *  @param key             The key of the new node.
+ *  @param data            The data of the new node.
+ *  @param rInsertionPoint A node with a smaller key to search from on the lowest level (retained), which is released.
+ *  @param rSavedNodes     Nodes with smaller keys to search from on the higher levels of the new node (retained),
+ *                         which are released.
+ *  @param replacesData    Whether to swap the data into a node with the same key; otherwise, the call fails.
+ *  @param outHandle       An optional pointer that if passed, will be set to a handle to the element.
  *
- *  @return true if successful.
+ *  @return true if the new node was linked or its data swapped in; false if there is a node with the same key.
  */
-bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data)
+static bool linkNewNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rNewNode, SPCPriorityQueueKey key, void *data,
+                        SPCPriorityQueueNode *rInsertionPoint, SPCPriorityQueueNode **rSavedNodes, bool replacesData,
+                        SPCPriorityQueueHandle *outHandle)
 {
     assert(pqueue);
+    assert(rNewNode && rInsertionPoint && rSavedNodes);
     
-    // Reject misaligned data.
-    if (!IS_PTR_ALIGNED(data))
-        return false;
-    
-    //
-    // Create a new node with a height chosen according to the list's probability distribution.
-    //
-    size_t newNodeHeight = chooseRandomHeight(pqueue->_head->_height);
-    
-    SPCPriorityQueueNode *rNewNode = createNode(pqueue, newNodeHeight, key, data);
-    if (!rNewNode)
-        return false;
-    
-    retainNode(rNewNode);
-    
-    //
-    // Search for a position in the list after which to insert the new node.
-    //
-    // The search starts with the head node at the highest level and traverses down to the lowest level
-    // until the correct node is found. When going down one level, the last node traversed on that level
-    // is remembered for later use (this is where we insert the new node at that level).
-    //
-    SPCPriorityQueueNode *rSavedNodes[kMaxLevels];
-    memset(rSavedNodes, 0, kMaxLevels * sizeof(SPCPriorityQueueNode *));
+    const size_t newNodeHeight = rNewNode->_height;
     
-    SPCPriorityQueueNode *rInsertionPoint = retainNode(pqueue->_head);
-    for (int iterLevel = (signed int)(pqueue->_head->_height - 1); iterLevel >= 1; --iterLevel) {
-
-        SPCPriorityQueueNode *rTemp = scanForKey_r(pqueue, &rInsertionPoint, iterLevel, key);
-        releaseNode(pqueue, rTemp);
-        
-        if (iterLevel < newNodeHeight)
-            rSavedNodes[iterLevel] = retainNode(rInsertionPoint);
-    }
+    // The new node can't be deleted before it is linked.
+    fillHandle(outHandle, rNewNode);
     
     //
     // Insert the new node into the queue structure on the lowest level.
     //
     for (spc_backoff_t backoffCounter = SPC_BACKOFF_INIT;;) {
   
-        SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, &rInsertionPoint, 0, key);
+        SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, &rInsertionPoint, 0, key, rNewNode->_sequence);
   
         // If there exists a node with the same priority as the new node, change the value of the old node atomically.
         //
-        markable_ptr_t oldData_d = (markable_ptr_t)(SPC_ATOMIC_LOAD(&rNextNode->_data_d));
-        if (!isMarked_m(oldData_d) && rNextNode->_key == key) {
+        markable_ptr_t oldData_d = (markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNextNode->_data_d, SPC_MEMORY_ORDER_ACQUIRE));
+        if (!isMarked_m(oldData_d) && isNodeAt(rNextNode, key, rNewNode->_sequence)) {
+            
+            if (!replacesData) {
+                releaseNode(pqueue, rInsertionPoint);
+                releaseNode(pqueue, rNextNode);
+                
+                for (int iterLevel = 1; iterLevel < newNodeHeight; ++iterLevel)
+                    releaseNode(pqueue, rSavedNodes[iterLevel]);
+                
+                return false;
+            }
             
-            if (SPC_ATOMIC_COMPARE_AND_SWAP(&rNextNode->_data_d, oldData_d, data)) {
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteQueueInsert,
+                                   SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&rNextNode->_data_d, oldData_d, data, SPC_MEMORY_ORDER_SEQ_CST))) {
                 
                 // If we succeeded in swapping out the old data, then release everything and return.
+                fillHandle(outHandle, rNextNode);
+                
                 releaseNode(pqueue, rInsertionPoint);
                 releaseNode(pqueue, rNextNode);
                 
@@ -499,10 +997,10 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
                 
                 releaseNode(pqueue, rNewNode);
                 assert((({ // Clear the next pointer for the memory allocator.
-                    SPC_ATOMIC_STORE(&rNewNode->_next_d[0], toMarkable(NULL, false));
+                    storeLink(&rNewNode->_next_d[0], toLink(pqueue, NULL, false), SPC_MEMORY_ORDER_RELAXED);
                 }), true));
                 
-                releaseNode(pqueue, rNewNode); // Delete the node.
+                discardNode(pqueue, rNewNode);
                 
                 return true;
                 
@@ -516,13 +1014,16 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
  
         // Otherwise, just add the new node in front of rNextNode (at rInsertionPoint).
         //
-        SPC_ATOMIC_STORE(&rNewNode->_next_d[0], toMarkable(rNextNode, false));
-        SPC_MEMORY_BARRIER_STORE();
+        storeLink(&rNewNode->_next_d[0], toLink(pqueue, rNextNode, false), SPC_MEMORY_ORDER_RELAXED);
         // Since _next_d shouldn't retain pointers, we'll release rNextNode later below,
         // but we shouldn't release it before the CAS, or we might have an ABA problem.
         
-        if (SPC_ATOMIC_COMPARE_AND_SWAP(&rInsertionPoint->_next_d[0], toMarkable(rNextNode, false), toMarkable(rNewNode, false))) {
-            SPC_MEMORY_BARRIER_STORE();
+        // The CAS releases the initialization of the new node along with the link.
+        if (compareAndSwapLink(&rInsertionPoint->_next_d[0],
+                               toLink(pqueue, rNextNode, false),
+                               toLink(pqueue, rNewNode, false),
+                               SPC_MEMORY_ORDER_ACQ_REL,
+                               kSPCContentionSiteQueueInsert)) {
             releaseNode(pqueue, rNextNode);
             releaseNode(pqueue, rInsertionPoint);
             break;
@@ -540,34 +1041,36 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
     //
     for (int iterLevel = 1; iterLevel < newNodeHeight; ++iterLevel) {
         
-        SPC_ATOMIC_STORE(&rNewNode->_validToHeight, (long)iterLevel);
+        SPC_ATOMIC_STORE_EXPLICIT(&rNewNode->_validToHeight, (long)iterLevel, SPC_MEMORY_ORDER_RELEASE);
         
         rInsertionPoint = rSavedNodes[iterLevel];
         for (spc_backoff_t backoffCounter = SPC_BACKOFF_INIT;;) {
-            SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, &rInsertionPoint, iterLevel, key);
+            SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, &rInsertionPoint, iterLevel, key, rNewNode->_sequence);
             
-            SPC_ATOMIC_STORE(&rNewNode->_next_d[iterLevel], toMarkable(rNextNode, false));
-            SPC_MEMORY_BARRIER_STORE(); // Update of _next_d[iterLevel] of the new node is observed before insertion point change.
+            // Update of _next_d[iterLevel] of the new node is released by the insertion point change.
+            storeLink(&rNewNode->_next_d[iterLevel], toLink(pqueue, rNextNode, false), SPC_MEMORY_ORDER_RELAXED);
             // Since _next_d shouldn't retain pointers, we'll release rNextNode later below,
             // but we shouldn't release it before the CAS, or we might have an ABA problem.
             
             bool isMarked = false;
             bool isLinked = false;
-            if ((isMarked = isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNewNode->_data_d)))) ||
-                (isLinked = SPC_ATOMIC_COMPARE_AND_SWAP(&rInsertionPoint->_next_d[iterLevel],
-                                                        toMarkable(rNextNode, false),
-                                                        toMarkable(rNewNode, false)))) {
-                SPC_MEMORY_BARRIER_STORE();
+            // The link and the deletion mark checks below must be sequentially consistent with the
+            // marking of the node by a concurrent extraction.
+            if ((isMarked = isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNewNode->_data_d, SPC_MEMORY_ORDER_SEQ_CST)))) ||
+                (isLinked = compareAndSwapLink(&rInsertionPoint->_next_d[iterLevel],
+                                               toLink(pqueue, rNextNode, false),
+                                               toLink(pqueue, rNewNode, false),
+                                               SPC_MEMORY_ORDER_SEQ_CST,
+                                               kSPCContentionSiteQueueInsertLevel))) {
                 if (isMarked) {
                     // If this was already marked, then clear the next pointer for the memory allocator.
                     //
                     assert((({
-                        SPC_ATOMIC_STORE(&rNewNode->_next_d[iterLevel], toMarkable(NULL, true));
-                        SPC_MEMORY_BARRIER_STORE();
+                        storeLink(&rNewNode->_next_d[iterLevel], toLink(pqueue, NULL, true), SPC_MEMORY_ORDER_RELEASE);
                     }), true));
                 } else if (isLinked &&
-                           isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNewNode->_data_d))) &&
-                           (markable_ptr_t)(SPC_ATOMIC_LOAD(&rNewNode->_next_d[iterLevel])) != NULL_D) {
+                           isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNewNode->_data_d, SPC_MEMORY_ORDER_SEQ_CST))) &&
+                           loadLink(&rNewNode->_next_d[iterLevel], SPC_MEMORY_ORDER_ACQUIRE) != NULL_D) {
                     // If we managed to link the node on this level, but now the mark was set,
                     // make sure it will be unlinked. Otherwise we may get a data race where the thread
                     // that marked the node for deletion already thinks it is unlinked on this level and
@@ -591,8 +1094,8 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
     //
     // If insertion was successful on all levels, set the validLevel. Also, check for deletion.
     //
-    SPC_ATOMIC_STORE(&rNewNode->_validToHeight, newNodeHeight);
-    if (isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNewNode->_data_d))))
+    SPC_ATOMIC_STORE_EXPLICIT(&rNewNode->_validToHeight, newNodeHeight, SPC_MEMORY_ORDER_SEQ_CST);
+    if (isMarked_m((markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNewNode->_data_d, SPC_MEMORY_ORDER_SEQ_CST))))
         rNewNode = helpDeleteAndReleaseNode_r(pqueue, rNewNode, 0);
     
     releaseNode(pqueue, rNewNode);
@@ -601,6 +1104,218 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
 }
 
 
+/**
+ *  Search for the place of a new node from the head, and link it there (within an operation).
+ *
+ *  @param pqueue       A pointer to a lock-free priority queue.
+ *  @param rNewNode     The new node (retained), which is released. It is left retained and unlinked if the call fails.
+ *  @param key          The key of the new node.
+ *  @param data         The data of the new node.
+ *  @param replacesData Whether to swap the data into a node with the same key; otherwise, the call fails.
+ *  @param outHandle    An optional pointer that if passed, will be set to a handle to the element.
+ *
+ *  @return true if successful; false if there is a node with the same key.
+ */
+static bool insertNewNode(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rNewNode, SPCPriorityQueueKey key, void *data, bool replacesData,
+                          SPCPriorityQueueHandle *outHandle)
+{
+    assert(pqueue);
+    assert(rNewNode);
+    
+    const size_t newNodeHeight = rNewNode->_height;
+    
+    //
+    // Search for a position in the list after which to insert the new node.
+    //
+    // The search starts with the head node at the highest level and traverses down to the lowest level
+    // until the correct node is found. When going down one level, the last node traversed on that level
+    // is remembered for later use (this is where we insert the new node at that level).
+    //
+    SPCPriorityQueueNode *rSavedNodes[kMaxLevels];
+    memset(rSavedNodes, 0, newNodeHeight * sizeof(SPCPriorityQueueNode *));
+    
+    SPCPriorityQueueNode *rInsertionPoint = retainNode(pqueue, pqueue->_head);
+    for (int iterLevel = (signed int)(pqueue->_head->_height - 1); iterLevel >= 1; --iterLevel) {
+
+        SPCPriorityQueueNode *rTemp = scanForKey_r(pqueue, &rInsertionPoint, iterLevel, key, rNewNode->_sequence);
+        releaseNode(pqueue, rTemp);
+        
+        if (iterLevel < newNodeHeight)
+            rSavedNodes[iterLevel] = retainNode(pqueue, rInsertionPoint);
+    }
+    
+    return linkNewNode(pqueue, rNewNode, key, data, rInsertionPoint, rSavedNodes, replacesData, outHandle);
+}
+
+
+/**
+ *  Insert an element into a priority queue (within an operation).
+ *
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param key       An element key.
+ *  @param data      The element.
+ *  @param outHandle An optional pointer that if passed, will be set to a handle to the element.
+ *
+ *  @return true if successful.
+ */
+static bool insertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data, SPCPriorityQueueHandle *outHandle)
+{
+    assert(pqueue);
+    
+    // Reject misaligned data.
+    if (!IS_PTR_ALIGNED(data))
+        return false;
+    
+    //
+    // Create a new node with a height chosen according to the list's probability distribution.
+    //
+    size_t newNodeHeight = chooseRandomHeight(pqueue->_maxHeight);
+    
+    SPCPriorityQueueNode *rNewNode = createNode(pqueue, newNodeHeight, key, data, true);
+    if (!rNewNode)
+        return false;
+    
+    retainNode(pqueue, rNewNode);
+    
+    insertNewNode(pqueue, rNewNode, key, data, true, outHandle);
+    
+    return true;
+}
+
+
+/**
+ *  Move a finger to the last nodes before a key on each level, starting either from the head or from the nodes
+ *  before a smaller key.
+ *
+ *  From the head, the search goes down from the highest level as usual. From a finger, it first climbs from the
+ *  lowest level until the finger reaches past the key, and then goes down from there. So it only takes as long as
+ *  the distance between the keys calls for, which is short for keys that follow each other closely.
+ *
+ *  @param pqueue   A pointer to a lock-free priority queue.
+ *  @param rFinger  The nodes before the last key on each level of the head (retained), updated in place;
+ *                  ignored and filled in when starting from the head.
+ *  @param fromHead Whether to start from the head.
+ *  @param key      A key, not less than the last key if starting from the finger.
+ *  @param sequence A sequence number, greater than the last one if starting from the finger with the same key.
+ */
+static void moveFingerToKey(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rFinger, bool fromHead, SPCPriorityQueueKey key, unsigned long sequence)
+{
+    assert(pqueue);
+    assert(rFinger);
+    
+    int topLevel = (signed int)(pqueue->_head->_height - 1);
+    
+    SPCPriorityQueueNode *rNode;
+    if (fromHead)
+        rNode = retainNode(pqueue, pqueue->_head);
+    else {
+        for (int iterLevel = 0; iterLevel < topLevel; ++iterLevel) {
+            SPCPriorityQueueNode *rNextNode = readNextNode_r(pqueue, &rFinger[iterLevel], iterLevel);
+            bool reachesKey = !isNodeBefore(rNextNode, key, sequence);
+            releaseNode(pqueue, rNextNode);
+            
+            if (reachesKey) {
+                topLevel = iterLevel;
+                break;
+            }
+        }
+        
+        rNode = retainNode(pqueue, rFinger[topLevel]);
+    }
+    
+    for (int iterLevel = topLevel; iterLevel >= 0; --iterLevel) {
+        
+        SPCPriorityQueueNode *rTemp = scanForKey_r(pqueue, &rNode, iterLevel, key, sequence);
+        releaseNode(pqueue, rTemp);
+        
+        if (!fromHead)
+            releaseNode(pqueue, rFinger[iterLevel]);
+        rFinger[iterLevel] = retainNode(pqueue, rNode);
+    }
+    
+    releaseNode(pqueue, rNode);
+}
+
+
+/**
+ *  Release the nodes of a finger.
+ *
+ *  @param pqueue  A pointer to a lock-free priority queue.
+ *  @param rFinger The nodes of the finger on each level of the head (retained).
+ */
+static FORCE_INLINE void releaseFinger(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rFinger)
+{
+    for (int iterLevel = 0; iterLevel < pqueue->_head->_height; ++iterLevel)
+        releaseNode(pqueue, rFinger[iterLevel]);
+}
+
+
+/**
+ *  Insert elements in key order into a priority queue, searching for each one from where the previous one went
+ *  (within an operation).
+ *
+ *  @param pqueue   A pointer to a lock-free priority queue.
+ *  @param keys     The element keys, in ascending order.
+ *  @param elements The elements.
+ *  @param count    The number of elements.
+ *
+ *  @return The number of elements inserted, which is less than count if an element is misaligned or the queue is full.
+ */
+static size_t insertSortedElements(SPCPriorityQueue *pqueue, const SPCPriorityQueueKey *keys, void *const *elements, size_t count)
+{
+    assert(pqueue);
+    
+    SPCPriorityQueueNode *rFinger[kMaxLevels];
+    bool                  hasFinger = false;
+    
+    size_t idx = 0;
+    for (; idx < count; ++idx) {
+        
+        // Reject misaligned data.
+        if (!IS_PTR_ALIGNED(elements[idx]))
+            break;
+        
+        //
+        // Create a new node. Reclaiming deleted nodes requires not holding any, so let go of the finger first.
+        //
+        size_t newNodeHeight = chooseRandomHeight(pqueue->_maxHeight);
+        
+        SPCPriorityQueueNode *rNewNode = createNode(pqueue, newNodeHeight, keys[idx], elements[idx], !hasFinger);
+        if (!rNewNode && hasFinger) {
+            releaseFinger(pqueue, rFinger);
+            hasFinger = false;
+            
+            rNewNode = createNode(pqueue, newNodeHeight, keys[idx], elements[idx], true);
+        }
+        if (!rNewNode)
+            break;
+        
+        retainNode(pqueue, rNewNode);
+        
+        //
+        // Search from the finger, unless the keys are out of order.
+        //
+        bool fromHead = !hasFinger || keys[idx] < keys[idx - 1];
+        if (fromHead && hasFinger)
+            releaseFinger(pqueue, rFinger);
+        
+        moveFingerToKey(pqueue, rFinger, fromHead, keys[idx], rNewNode->_sequence);
+        hasFinger = true;
+        
+        SPCPriorityQueueNode *rSavedNodes[kMaxLevels];
+        for (int iterLevel = 1; iterLevel < newNodeHeight; ++iterLevel)
+            rSavedNodes[iterLevel] = retainNode(pqueue, rFinger[iterLevel]);
+        
+        linkNewNode(pqueue, rNewNode, keys[idx], elements[idx], retainNode(pqueue, rFinger[0]), rSavedNodes, true, NULL);
+    }
+    
+    if (hasFinger)
+        releaseFinger(pqueue, rFinger);
+    
+    return idx;
+}
+
+
 
 #pragma mark - Node extraction
 
@@ -623,21 +1338,22 @@ static FORCE_INLINE bool isNodeUnlinkedAtLevel(SPCPriorityQueue *pqueue, SPCPrio
 {
     assert(rNodeToCheck);
     assert(rPrevPtr && *rPrevPtr);
-    assert(isNodeRetained(*rPrevPtr));
-    assert(isNodeRetained(rNodeToCheck));
+    assert(isNodeRetained(pqueue, *rPrevPtr));
+    assert(isNodeRetained(pqueue, rNodeToCheck));
     
-    const SPCPriorityQueueKey key = rNodeToCheck->_key;
+    const SPCPriorityQueueKey key      = rNodeToCheck->_key;
+    const unsigned long       sequence = rNodeToCheck->_sequence;
     
-    SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, rPrevPtr, level, key);
-    if (rNextNode != rNodeToCheck && rNextNode->_key == key) {
+    SPCPriorityQueueNode *rNextNode = scanForKey_r(pqueue, rPrevPtr, level, key, sequence);
+    if (rNextNode != rNodeToCheck && isNodeAt(rNextNode, key, sequence)) {
         //
         // We encountered a duplicate entry with the same key.
         // Try to go forward and see if our node is still somewhere behind.
         //
-        SPCPriorityQueueNode *rTempPrev = retainNode(*rPrevPtr);
+        SPCPriorityQueueNode *rTempPrev = retainNode(pqueue, *rPrevPtr);
         
         rNextNode = readNextNode_r(pqueue, &rTempPrev, level);
-        while (rNextNode->_key == key && rNextNode != rNodeToCheck) {
+        while (isNodeAt(rNextNode, key, sequence) && rNextNode != rNodeToCheck) {
             releaseNode(pqueue, rTempPrev);
             rTempPrev = rNextNode;
             rNextNode = readNextNode_r(pqueue, &rTempPrev, level);
@@ -651,7 +1367,7 @@ static FORCE_INLINE bool isNodeUnlinkedAtLevel(SPCPriorityQueue *pqueue, SPCPrio
     }
     releaseNode(pqueue, rNextNode);
 
-    return rNextNode->_key > key;
+    return !isNodeAt(rNextNode, key, sequence);
 }
 
 
@@ -669,35 +1385,37 @@ static void unlinkNodeAtLevel(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rN
     assert(pqueue);
     assert(rNodeToUnlink);
     assert(rPrevPtr && *rPrevPtr);
-    assert(isNodeRetained(rNodeToUnlink));
-    assert(isNodeRetained(*rPrevPtr));
+    assert(isNodeRetained(pqueue, rNodeToUnlink));
+    assert(isNodeRetained(pqueue, *rPrevPtr));
     assert(level < rNodeToUnlink->_height);
     
     for (spc_backoff_t backOffCounter = SPC_BACKOFF_INIT;;) {
         
-        if ((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNodeToUnlink->_next_d[level])) == NULL_D)
+        if (loadLink(&rNodeToUnlink->_next_d[level], SPC_MEMORY_ORDER_ACQUIRE) == NULL_D)
             break;
         
         //
         // Verify if the node is still part of the linked list structure.
         //
-        if (isNodeUnlinkedAtLevel(pqueue, rNodeToUnlink, rPrevPtr, level) || (markable_ptr_t)(SPC_ATOMIC_LOAD(&rNodeToUnlink->_next_d[level])) == NULL_D)
+        if (isNodeUnlinkedAtLevel(pqueue, rNodeToUnlink, rPrevPtr, level) ||
+            loadLink(&rNodeToUnlink->_next_d[level], SPC_MEMORY_ORDER_ACQUIRE) == NULL_D)
             break;
     
         //
         // Try to change the next pointer of the prev node.
         //
-        if (SPC_ATOMIC_COMPARE_AND_SWAP(&(*rPrevPtr)->_next_d[level],
-                                        toMarkable(rNodeToUnlink, false),
-                                        toMarkable_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNodeToUnlink->_next_d[level])), false))) {
-            SPC_MEMORY_BARRIER_STORE(); // Prevent the following store operation from being observed before
-                                        // the CAS above in a concurrent execution of this function on the same node.
-            SPC_ATOMIC_STORE(&rNodeToUnlink->_next_d[level], NULL_D);
-            SPC_MEMORY_BARRIER_STORE();
+        // The acquire-release CAS prevents the following store operation from being observed before
+        // the CAS in a concurrent execution of this function on the same node.
+        if (compareAndSwapLink(&(*rPrevPtr)->_next_d[level],
+                               toLink(pqueue, rNodeToUnlink, false),
+                               toMarkable_m(loadLink(&rNodeToUnlink->_next_d[level], SPC_MEMORY_ORDER_ACQUIRE), false),
+                               SPC_MEMORY_ORDER_ACQ_REL,
+                               kSPCContentionSiteQueueUnlink)) {
+            storeLink(&rNodeToUnlink->_next_d[level], NULL_D, SPC_MEMORY_ORDER_RELEASE);
             break;
         }
         
-        if ((markable_ptr_t)(SPC_ATOMIC_LOAD(&rNodeToUnlink->_next_d[level])) == NULL_D)
+        if (loadLink(&rNodeToUnlink->_next_d[level], SPC_MEMORY_ORDER_ACQUIRE) == NULL_D)
             break;
         
         // Back off.
@@ -719,37 +1437,41 @@ static SPCPriorityQueueNode *helpDeleteAndReleaseNode_r(SPCPriorityQueue *pqueue
 {
     assert(pqueue);
     assert(rNodeToDelete);
-    assert(isNodeRetained(rNodeToDelete));
+    assert(isNodeRetained(pqueue, rNodeToDelete));
     assert(level < rNodeToDelete->_height);
     
+    SPC_CONTENTION_EVENT(kSPCContentionEventQueueHelp);
+    
     //
     // Set the deletion mark on this level and on higher levels.
     //
     for (size_t iterLevel = level; iterLevel < rNodeToDelete->_height; ++iterLevel)
         for (;;) {
-            markable_ptr_t nextNode = (markable_ptr_t)(SPC_ATOMIC_LOAD(&rNodeToDelete->_next_d[iterLevel]));
+            markable_ptr_t nextNode = loadLink(&rNodeToDelete->_next_d[iterLevel], SPC_MEMORY_ORDER_ACQUIRE);
             if (isMarked_m(nextNode) ||
-                SPC_ATOMIC_COMPARE_AND_SWAP(&rNodeToDelete->_next_d[iterLevel], toMarkable_m(nextNode, false), toMarkable_m(nextNode, true))) {
-                SPC_MEMORY_BARRIER_STORE();
+                compareAndSwapLink(&rNodeToDelete->_next_d[iterLevel],
+                                   toMarkable_m(nextNode, false),
+                                   toMarkable_m(nextNode, true),
+                                   SPC_MEMORY_ORDER_ACQ_REL,
+                                   kSPCContentionSiteQueueMark))
                 break;
-            }
         }
 
     //
     // Check if prev node is valid for deletion.
     // If not, then search for the correct prev node.
     //
-    SPCPriorityQueueNode *rPrev = (void *)(SPC_ATOMIC_LOAD(&rNodeToDelete->_rPrev));
-    if (!rPrev || level >= (size_t)(SPC_ATOMIC_LOAD(&rPrev->_validToHeight))) {
-        rPrev = retainNode(pqueue->_head);
+    SPCPriorityQueueNode *rPrev = (void *)(SPC_ATOMIC_LOAD_EXPLICIT(&rNodeToDelete->_rPrev, SPC_MEMORY_ORDER_ACQUIRE));
+    if (!rPrev || level >= (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rPrev->_validToHeight, SPC_MEMORY_ORDER_ACQUIRE))) {
+        rPrev = retainNode(pqueue, pqueue->_head);
 
         for (int iterLevel = (signed)(pqueue->_head->_height - 1); iterLevel >= (signed)(level); --iterLevel) {
             
-            SPCPriorityQueueNode *rTmpNode = scanForKey_r(pqueue, &rPrev, iterLevel, rNodeToDelete->_key);
+            SPCPriorityQueueNode *rTmpNode = scanForKey_r(pqueue, &rPrev, iterLevel, rNodeToDelete->_key, rNodeToDelete->_sequence);
             releaseNode(pqueue, rTmpNode);
         }
     } else
-        retainNode(rPrev);
+        retainNode(pqueue, rPrev);
     
     //
     // Delete the node on the current level.
@@ -762,28 +1484,29 @@ static SPCPriorityQueueNode *helpDeleteAndReleaseNode_r(SPCPriorityQueue *pqueue
 
 
 /**
- *  Delete and return the element with the minimum key value.
+ *  Claim the first node of the queue for deletion, by setting the deletion mark of its data.
  *
- *  @param pqueue A pointer to a lock-free priority queue.
- *  @param outKey An optional pointer that if passed, will be set to the key of the element.
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param maxKey    The maximum key of the node to claim.
+ *  @param outData_d Set to the data of the claimed node.
  *
- *  @return The element with the minimum key value.
+ *  @return The claimed node (retained); NULL if the queue is empty or its first key is greater than maxKey.
  */
-void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey *outKey)
+static SPCPriorityQueueNode *claimFirstNode_r(SPCPriorityQueue *pqueue, SPCPriorityQueueKey maxKey, markable_ptr_t *outData_d)
 {
     assert(pqueue);
+    assert(outData_d);
     
-    markable_ptr_t     retData_d = 0;
-    SPCPriorityQueueKey retKey;
+    markable_ptr_t retData_d = 0;
     
     //
     // Start from the head and get the first node not marked for deletion.
     //
     SPCPriorityQueueNode *rFirstNode = 0;
-    for (SPCPriorityQueueNode *rPrev = retainNode(pqueue->_head);;) {
+    for (SPCPriorityQueueNode *rPrev = retainNode(pqueue, pqueue->_head);;) {
         
         rFirstNode = readNextNode_r(pqueue, &rPrev, 0);
-        if (rFirstNode == pqueue->_tail) { // The queue is empty.
+        if (rFirstNode == pqueue->_tail || rFirstNode->_key > maxKey) { // The queue is empty, or has nothing up to maxKey.
             releaseNode(pqueue, rPrev);
             releaseNode(pqueue, rFirstNode);
             
@@ -794,22 +1517,29 @@ void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorit
         //
         // Check if this is still the first node.
         //
-        if (rFirstNode != toPtr_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&rPrev->_next_d[0])))) {
+        if (rFirstNode != toNode(pqueue, loadLink(&rPrev->_next_d[0], SPC_MEMORY_ORDER_ACQUIRE))) {
             releaseNode(pqueue, rFirstNode);
             continue;
         }
         
         //
-        // Get the data and key, and then set the deletion mark.
+        // Get the data, and then set the deletion mark.
         //
-        retData_d = (markable_ptr_t)(SPC_ATOMIC_LOAD(&rFirstNode->_data_d));
-        retKey    = rFirstNode->_key;
+        retData_d = (markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rFirstNode->_data_d, SPC_MEMORY_ORDER_ACQUIRE));
         
         if (!isMarked_m((markable_ptr_t)(retData_d))) {
             
-            if (SPC_ATOMIC_COMPARE_AND_SWAP(&rFirstNode->_data_d, toMarkable_m(retData_d, false), toMarkable_m(retData_d, true))) {
-                SPC_MEMORY_BARRIER_STORE(); // _rPrev update is observed after the deletion marker is set.
-                SPC_ATOMIC_STORE(&rFirstNode->_rPrev, rPrev);
+            // The deletion mark is sequentially consistent with the checks made by a concurrent insertion,
+            // and the _rPrev update is observed after it.
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteQueueExtract,
+                                   SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&rFirstNode->_data_d,
+                                                                        toMarkable_m(retData_d, false),
+                                                                        toMarkable_m(retData_d, true),
+                                                                        SPC_MEMORY_ORDER_SEQ_CST))) {
+                if (pqueue->_reclamationScheme == kSPCMemoryReclamationReferenceCounting)
+                    SPC_ATOMIC_STORE_EXPLICIT(&rFirstNode->_rPrev, rPrev, SPC_MEMORY_ORDER_RELEASE);
+                else
+                    releaseNode(pqueue, rPrev); // Only a reference count can be handed over to the node, so helpers search from the head.
                 break;
             } else
                 goto retry;
@@ -821,30 +1551,209 @@ void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorit
         rPrev = rFirstNode;
     }
     
-    //
-    // Set delete mark on all pointers to next nodes.
-    //
-    for (int iterLevel = 0; iterLevel < rFirstNode->_height; ++iterLevel) {
+    *outData_d = retData_d;
+    return rFirstNode;
+}
+
+
+/**
+ *  Claim the node that follows a run of claimed nodes, if it holds the next element up to a given key.
+ *
+ *  The links of the claimed nodes must already be marked, so that no node can be inserted behind them.
+ *
+ *  @param pqueue     A pointer to a lock-free priority queue.
+ *  @param rFirstNode The first claimed node of the run (retained).
+ *  @param rLastNode  The last claimed node of the run (retained).
+ *  @param maxKey     The maximum key of the node to claim.
+ *  @param outData_d  Set to the data of the claimed node.
+ *
+ *  @return The claimed node (retained); NULL if the next node is the tail, has a greater key than maxKey,
+ *          or is being deleted by another thread, or if the run is no longer at the front of the queue.
+ */
+static SPCPriorityQueueNode *claimNextNode_r(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rFirstNode, SPCPriorityQueueNode *rLastNode, SPCPriorityQueueKey maxKey, markable_ptr_t *outData_d)
+{
+    assert(pqueue);
+    assert(rFirstNode && rLastNode);
+    assert(outData_d);
+    
+    markable_ptr_t nextNode_d = loadLink(&rLastNode->_next_d[0], SPC_MEMORY_ORDER_ACQUIRE);
+    assert(isMarked_m(nextNode_d));
+    
+    SPCPriorityQueueNode *rNextNode = toNode(pqueue, nextNode_d);
+    if (!rNextNode || rNextNode == pqueue->_tail)
+        return NULL;
+    
+    // The marked links of the run stay put while the run is linked, and so does the next node. But a helper may have
+    // unlinked the run without clearing the links yet, and the next node may since have been deleted and reused.
+    // So take the reference, and then check that the head still links to the run.
+    if (pqueue->_reclamationScheme != kSPCMemoryReclamationEpochs) {
+        referenceNode(pqueue, rNextNode);
+        
+        if (loadLink(&rLastNode->_next_d[0], SPC_MEMORY_ORDER_ACQUIRE) != nextNode_d ||
+            loadLink(&pqueue->_head->_next_d[0], SPC_MEMORY_ORDER_ACQUIRE) != toLink(pqueue, rFirstNode, false)) {
+            dereferenceNode(pqueue, rNextNode);
+            return NULL;
+        }
+    }
+    
+    if (rNextNode->_key > maxKey) {
+        releaseNode(pqueue, rNextNode);
+        return NULL;
+    }
+    
+    for (;;) {
+        markable_ptr_t data_d = (markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNextNode->_data_d, SPC_MEMORY_ORDER_ACQUIRE));
+        if (isMarked_m(data_d)) {
+            releaseNode(pqueue, rNextNode);
+            return NULL;
+        }
+        
+        // Helpers find the previous node from the head, as the claimed node is about to be unlinked.
+        if (SPC_CONTENTION_CAS(kSPCContentionSiteQueueExtract,
+                               SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&rNextNode->_data_d,
+                                                                    toMarkable_m(data_d, false),
+                                                                    toMarkable_m(data_d, true),
+                                                                    SPC_MEMORY_ORDER_SEQ_CST))) {
+            *outData_d = data_d;
+            return rNextNode;
+        }
+    }
+}
+
+
+/**
+ *  Set the deletion mark on all the links of a claimed node, so that nothing can be inserted behind it.
+ *
+ *  @param pqueue       A pointer to a lock-free priority queue.
+ *  @param rClaimedNode A claimed node (retained).
+ */
+static FORCE_INLINE void markNodeLinks(SPCPriorityQueue *pqueue, SPCPriorityQueueNode *rClaimedNode)
+{
+    (void)pqueue;
+    
+    for (int iterLevel = 0; iterLevel < rClaimedNode->_height; ++iterLevel) {
         for (;;) {
-            markable_ptr_t nextNode = (markable_ptr_t)(SPC_ATOMIC_LOAD(&rFirstNode->_next_d[iterLevel]));
+            markable_ptr_t nextNode = loadLink(&rClaimedNode->_next_d[iterLevel], SPC_MEMORY_ORDER_ACQUIRE);
             if (isMarked_m(nextNode) ||
-                SPC_ATOMIC_COMPARE_AND_SWAP(&rFirstNode->_next_d[iterLevel], toMarkable_m(nextNode, false), toMarkable_m(nextNode, true))) {
-                SPC_MEMORY_BARRIER_STORE();
+                compareAndSwapLink(&rClaimedNode->_next_d[iterLevel],
+                                   toMarkable_m(nextNode, false),
+                                   toMarkable_m(nextNode, true),
+                                   SPC_MEMORY_ORDER_ACQ_REL,
+                                   kSPCContentionSiteQueueMark))
                 break;
-            }
         }
     }
+}
+
+
+/**
+ *  Unlink a run of claimed nodes, which followed each other from the head when they were claimed, and delete them.
+ *
+ *  On each level, the nodes of the run are unlinked together by swinging the link of the head past them, if they
+ *  are still the first nodes on that level. Otherwise, they are unlinked one by one.
+ *
+ *  @param pqueue          A pointer to a lock-free priority queue.
+ *  @param rClaimedNodes   The claimed nodes (retained) with marked links, in key order.
+ *  @param numClaimedNodes The number of claimed nodes.
+ */
+static void unlinkAndDeleteClaimedNodes(SPCPriorityQueue *pqueue, SPCPriorityQueueNode **rClaimedNodes, size_t numClaimedNodes)
+{
+    assert(pqueue);
+    assert(rClaimedNodes && numClaimedNodes);
+    
+    size_t height = 0;
+    for (size_t idx = 0; idx < numClaimedNodes; ++idx)
+        if (rClaimedNodes[idx]->_height > height)
+            height = rClaimedNodes[idx]->_height;
+    
+    for (int iterLevel = (signed)(height - 1); iterLevel >= 0; --iterLevel) {
+        
+        //
+        // Check that the nodes on this level link to each other.
+        //
+        SPCPriorityQueueNode *rFirstNode = NULL;
+        SPCPriorityQueueNode *rLastNode  = NULL;
+        bool isRun = true;
+        
+        for (size_t idx = 0; idx < numClaimedNodes; ++idx) {
+            if (rClaimedNodes[idx]->_height <= iterLevel)
+                continue;
+            
+            if (!rFirstNode)
+                rFirstNode = rClaimedNodes[idx];
+            else if (loadLink(&rLastNode->_next_d[iterLevel], SPC_MEMORY_ORDER_ACQUIRE) != toLink(pqueue, rClaimedNodes[idx], true))
+                isRun = false;
+            
+            rLastNode = rClaimedNodes[idx];
+        }
+        
+        //
+        // Marked links only change when their node is unlinked, and the nodes of a run can only be unlinked
+        // after the first one, so the run is still whole if the head still links to its first node.
+        //
+        markable_ptr_t afterRun_d = loadLink(&rLastNode->_next_d[iterLevel], SPC_MEMORY_ORDER_ACQUIRE);
+        
+        if (isRun && toNode(pqueue, afterRun_d) &&
+            compareAndSwapLink(&pqueue->_head->_next_d[iterLevel],
+                               toLink(pqueue, rFirstNode, false),
+                               toMarkable_m(afterRun_d, false),
+                               SPC_MEMORY_ORDER_ACQ_REL,
+                               kSPCContentionSiteQueueUnlink)) {
+            for (size_t idx = 0; idx < numClaimedNodes; ++idx)
+                if (rClaimedNodes[idx]->_height > iterLevel)
+                    storeLink(&rClaimedNodes[idx]->_next_d[iterLevel], NULL_D, SPC_MEMORY_ORDER_RELEASE);
+            continue;
+        }
+        
+        SPCPriorityQueueNode *rPrev = retainNode(pqueue, pqueue->_head);
+        for (size_t idx = 0; idx < numClaimedNodes; ++idx)
+            if (rClaimedNodes[idx]->_height > iterLevel)
+                unlinkNodeAtLevel(pqueue, rClaimedNodes[idx], &rPrev, iterLevel);
+        releaseNode(pqueue, rPrev);
+    }
+    
+    for (size_t idx = 0; idx < numClaimedNodes; ++idx) {
+        releaseNode(pqueue, rClaimedNodes[idx]);
+        deleteNode(pqueue, rClaimedNodes[idx]);
+    }
+}
+
+
+/**
+ *  Delete and return the element with the minimum key value (within an operation).
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param outKey An optional pointer that if passed, will be set to the key of the element.
+ *
+ *  @return The element with the minimum key value.
+ */
+static void *extractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey *outKey)
+{
+    assert(pqueue);
+    
+    markable_ptr_t retData_d = 0;
+    
+    SPCPriorityQueueNode *rFirstNode = claimFirstNode_r(pqueue, SPC_PQ_KEY_MAX, &retData_d);
+    if (!rFirstNode)
+        return NULL;
+    
+    SPCPriorityQueueKey retKey = rFirstNode->_key;
+    
+    //
+    // Set delete mark on all pointers to next nodes.
+    //
+    markNodeLinks(pqueue, rFirstNode);
     
     //
     // Unlink the node and then delete it.
     //
-    SPCPriorityQueueNode *rPrev = retainNode(pqueue->_head);
+    SPCPriorityQueueNode *rPrev = retainNode(pqueue, pqueue->_head);
     for (int iterLevel = (signed)(rFirstNode->_height - 1); iterLevel >= 0; --iterLevel)
         unlinkNodeAtLevel(pqueue, rFirstNode, &rPrev, iterLevel);
     releaseNode(pqueue, rPrev);
 
     releaseNode(pqueue, rFirstNode);
-    releaseNode(pqueue, rFirstNode); // Delete the node.
+    deleteNode(pqueue, rFirstNode);
     
     //
     // Return the data.
@@ -856,6 +1765,353 @@ void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorit
 }
 
 
+/**
+ *  Delete the elements with keys up to a given key, in key order (within an operation).
+ *
+ *  @param pqueue      A pointer to a lock-free priority queue.
+ *  @param maxKey      The maximum key of the elements to delete.
+ *  @param outElements An array that will be filled in with the elements.
+ *  @param outKeys     An optional array that if passed, will be filled in with the keys of the elements.
+ *  @param maxCount    The maximum number of elements to delete.
+ *
+ *  @return The number of elements deleted.
+ */
+static size_t extractElementsUpToKey(SPCPriorityQueue *pqueue, SPCPriorityQueueKey maxKey, void **outElements, SPCPriorityQueueKey *outKeys, size_t maxCount)
+{
+    assert(pqueue);
+    
+    size_t count = 0;
+    while (count < maxCount) {
+        
+        //
+        // Claim a run of nodes from the head: each one is marked before moving on, so the next one follows it directly.
+        //
+        SPCPriorityQueueNode *rClaimedNodes[kMaxExtractionRunLength];
+        size_t                numClaimedNodes = 0;
+        
+        markable_ptr_t        data_d;
+        SPCPriorityQueueNode *rNode = claimFirstNode_r(pqueue, maxKey, &data_d);
+        while (rNode) {
+            markNodeLinks(pqueue, rNode);
+            
+            rClaimedNodes[numClaimedNodes++] = rNode;
+            
+            outElements[count] = toPtr_m(data_d);
+            if (outKeys)
+                outKeys[count] = rNode->_key;
+            
+            if (++count == maxCount || numClaimedNodes == kMaxExtractionRunLength)
+                break;
+            
+            rNode = claimNextNode_r(pqueue, rClaimedNodes[0], rNode, maxKey, &data_d);
+        }
+        
+        // Nothing left up to maxKey.
+        if (!numClaimedNodes)
+            break;
+        
+        unlinkAndDeleteClaimedNodes(pqueue, rClaimedNodes, numClaimedNodes);
+    }
+    
+    return count;
+}
+
+
+/**
+ *  Find the node of a handle and claim it for deletion, by setting the deletion mark of its data.
+ *
+ *  The node is searched for by its key, and only matches if it is still the same use of the node as the handle's.
+ *
+ *  @param pqueue      A pointer to a lock-free priority queue.
+ *  @param handle      A handle.
+ *  @param rPrevNodes  Set to the last nodes before the node on each level of the head (retained), if it is claimed.
+ *  @param outData_d   Set to the data of the claimed node.
+ *
+ *  @return The claimed node (retained); NULL if the element of the handle is no longer in the queue.
+ */
+static SPCPriorityQueueNode *claimHandleNode_r(SPCPriorityQueue *pqueue, const SPCPriorityQueueHandle *handle, SPCPriorityQueueNode **rPrevNodes, markable_ptr_t *outData_d)
+{
+    assert(pqueue);
+    assert(handle && rPrevNodes && outData_d);
+    
+    moveFingerToKey(pqueue, rPrevNodes, true, handle->_key, handle->_sequence);
+    
+    // A node is only reused once it is out of the queue, so a retained node that is still in it can't change its use.
+    SPCPriorityQueueNode *rNode = readNextNode_r(pqueue, &rPrevNodes[0], 0);
+    if (rNode == handle->_node && rNode->_generation == handle->_generation) {
+    
+        for (;;) {
+            markable_ptr_t data_d = (markable_ptr_t)(SPC_ATOMIC_LOAD_EXPLICIT(&rNode->_data_d, SPC_MEMORY_ORDER_ACQUIRE));
+            if (isMarked_m(data_d)) // Already being extracted or deleted.
+                break;
+    
+            // The deletion mark is sequentially consistent with the checks made by a concurrent insertion,
+            // and the _rPrev update is observed after it.
+            if (SPC_CONTENTION_CAS(kSPCContentionSiteQueueExtract,
+                                   SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&rNode->_data_d,
+                                                                        toMarkable_m(data_d, false),
+                                                                        toMarkable_m(data_d, true),
+                                                                        SPC_MEMORY_ORDER_SEQ_CST))) {
+                if (pqueue->_reclamationScheme == kSPCMemoryReclamationReferenceCounting)
+                    SPC_ATOMIC_STORE_EXPLICIT(&rNode->_rPrev, retainNode(pqueue, rPrevNodes[0]), SPC_MEMORY_ORDER_RELEASE);
+    
+                *outData_d = data_d;
+                return rNode;
+            }
+        }
+    }
+    
+    releaseNode(pqueue, rNode);
+    releaseFinger(pqueue, rPrevNodes);
+    
+    return NULL;
+}
+
+
+/**
+ *  Delete and return the element of a handle (within an operation).
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle.
+ *
+ *  @return The element; NULL if it is no longer in the queue.
+ */
+static void *deleteElement(SPCPriorityQueue *pqueue, const SPCPriorityQueueHandle *handle)
+{
+    assert(pqueue);
+    
+    SPCPriorityQueueNode *rPrevNodes[kMaxLevels];
+    markable_ptr_t        retData_d = 0;
+    
+    SPCPriorityQueueNode *rNode = claimHandleNode_r(pqueue, handle, rPrevNodes, &retData_d);
+    if (!rNode)
+        return NULL;
+    
+    //
+    // Set delete mark on all pointers to next nodes, and then unlink the node from the nodes before it on each level.
+    //
+    markNodeLinks(pqueue, rNode);
+    
+    for (int iterLevel = (signed)(rNode->_height - 1); iterLevel >= 0; --iterLevel)
+        unlinkNodeAtLevel(pqueue, rNode, &rPrevNodes[iterLevel], iterLevel);
+    releaseFinger(pqueue, rPrevNodes);
+    
+    releaseNode(pqueue, rNode);
+    deleteNode(pqueue, rNode);
+    
+    return toPtr_m(retData_d);
+}
+
+
+/**
+ *  Change the key of the element of a handle (within an operation).
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle, which is updated.
+ *  @param key    The new key.
+ *
+ *  @return true if successful; false if the element is no longer in the queue, the queue is full, or another element
+ *          has the new key.
+ */
+static bool updateElementKey(SPCPriorityQueue *pqueue, SPCPriorityQueueHandle *handle, SPCPriorityQueueKey key)
+{
+    assert(pqueue);
+    assert(handle);
+    
+    const SPCPriorityQueueKey oldKey = handle->_key;
+    
+    //
+    // Create the node for the new key first, while no nodes are held, so that the element can't be left out.
+    //
+    size_t newNodeHeight = chooseRandomHeight(pqueue->_maxHeight);
+    
+    SPCPriorityQueueNode *rNewNode = createNode(pqueue, newNodeHeight, key, NULL, true);
+    if (!rNewNode)
+        return false;
+    
+    void *data = deleteElement(pqueue, handle);
+    if (!data) {
+        discardNode(pqueue, rNewNode);
+        return false;
+    }
+    
+    rNewNode->_data_d = data;
+    retainNode(pqueue, rNewNode);
+    
+    if (insertNewNode(pqueue, rNewNode, key, data, false, handle))
+        return true;
+    
+    //
+    // Another element has the new key, so put the element back under its old key. Another element may have been
+    // inserted there while the element was out of the queue, and replacing it would lose its data, so try the two
+    // keys in turn until one of them is free.
+    //
+    for (;;) {
+        rNewNode->_key = oldKey;
+        if (insertNewNode(pqueue, rNewNode, oldKey, data, false, handle))
+            return false;
+        
+        rNewNode->_key = key;
+        if (insertNewNode(pqueue, rNewNode, key, data, false, handle))
+            return true;
+    }
+}
+
+
+/**
+ *  Insert an element into a priority queue.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param key    An element key.
+ *  @param data   The element.
+ *
+ *  @return true if successful.
+ */
+bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data)
+{
+    assert(pqueue);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    bool successful = insertElement(pqueue, key, data, NULL);
+    endOperation(pqueue, record);
+    
+    return successful;
+}
+
+
+/**
+ *  Insert an element into a lock-free priority queue, and get a handle to it.
+ *
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param key       A key.
+ *  @param data      The element.
+ *  @param outHandle An optional pointer that if passed, will be set to a handle to the element.
+ *
+ *  @return true if successful.
+ */
+bool SPCPriorityQueueInsertElementWithHandle(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data, SPCPriorityQueueHandle *outHandle)
+{
+    assert(pqueue);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    bool successful = insertElement(pqueue, key, data, outHandle);
+    endOperation(pqueue, record);
+    
+    return successful;
+}
+
+
+/**
+ *  Insert elements given in key order into a lock-free priority queue.
+ *
+ *  @param pqueue   A pointer to a lock-free priority queue.
+ *  @param keys     The element keys, in ascending order.
+ *  @param elements The elements.
+ *  @param count    The number of elements.
+ *
+ *  @return The number of elements inserted, which is less than count if an element is misaligned or the queue is full.
+ */
+size_t SPCPriorityQueueInsertSortedElements(SPCPriorityQueue *pqueue, const SPCPriorityQueueKey *keys, void *const *elements, size_t count)
+{
+    assert(pqueue);
+    assert((keys && elements) || !count);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    size_t numInserted = insertSortedElements(pqueue, keys, elements, count);
+    endOperation(pqueue, record);
+    
+    return numInserted;
+}
+
+
+/**
+ *  Delete and return the element with the minimum key value.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param outKey An optional pointer that if passed, will be set to the key of the element.
+ *
+ *  @return The element with the minimum key value.
+ */
+void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey *outKey)
+{
+    assert(pqueue);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    void *data = extractMinimumElement(pqueue, outKey);
+    endOperation(pqueue, record);
+    
+    return data;
+}
+
+
+/**
+ *  Delete the elements with keys up to a given key, in key order.
+ *
+ *  @param pqueue      A pointer to a lock-free priority queue.
+ *  @param maxKey      The maximum key of the elements to delete.
+ *  @param outElements An array that will be filled in with the elements.
+ *  @param outKeys     An optional array that if passed, will be filled in with the keys of the elements.
+ *  @param maxCount    The maximum number of elements to delete (the length of the arrays).
+ *
+ *  @return The number of elements deleted.
+ */
+size_t SPCPriorityQueueExtractElementsUpToKey(SPCPriorityQueue *pqueue, SPCPriorityQueueKey maxKey, void **outElements, SPCPriorityQueueKey *outKeys, size_t maxCount)
+{
+    assert(pqueue);
+    assert(outElements || !maxCount);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    size_t count = extractElementsUpToKey(pqueue, maxKey, outElements, outKeys, maxCount);
+    endOperation(pqueue, record);
+    
+    return count;
+}
+
+
+/**
+ *  Delete and return the element of a handle, wherever it is in the queue.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle to the element, from the same queue.
+ *
+ *  @return The element; NULL if it is no longer in the queue.
+ */
+void *SPCPriorityQueueDeleteElement(SPCPriorityQueue *pqueue, const SPCPriorityQueueHandle *handle)
+{
+    assert(pqueue);
+    assert(handle);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    void *data = deleteElement(pqueue, handle);
+    endOperation(pqueue, record);
+    
+    return data;
+}
+
+
+/**
+ *  Change the key of the element of a handle.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle to the element, from the same queue. Updated to refer to the element under its new key
+ *                (or under its old key again).
+ *  @param key    The new key.
+ *
+ *  @return true if successful; false if the element is no longer in the queue, the queue is full, or another element
+ *          has the new key.
+ */
+bool SPCPriorityQueueUpdateElementKey(SPCPriorityQueue *pqueue, SPCPriorityQueueHandle *handle, SPCPriorityQueueKey key)
+{
+    assert(pqueue);
+    
+    cmem_epoch_record_t *record = beginOperation(pqueue);
+    bool successful = updateElementKey(pqueue, handle, key);
+    endOperation(pqueue, record);
+    
+    return successful;
+}
+
+
 
 #pragma mark - MPSC methods
 
@@ -877,7 +2133,7 @@ void *SPCPriorityQueuePeek_MPSC(SPCPriorityQueue *pqueue, SPCPriorityQueueKey *o
     
     // Get the first node.
     //
-    SPCPriorityQueueNode *firstNode = toPtr_m((markable_ptr_t)(SPC_ATOMIC_LOAD(&pqueue->_head->_next_d[0])));
+    SPCPriorityQueueNode *firstNode = toNode(pqueue, loadLink(&pqueue->_head->_next_d[0], SPC_MEMORY_ORDER_ACQUIRE));
     if (firstNode == pqueue->_tail) // The queue is empty.
         return NULL;
     
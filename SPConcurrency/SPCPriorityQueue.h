@@ -18,6 +18,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "SPCMemoryReclamation.h"
+
 
 
 struct _SPCPriorityQueueNode;
@@ -31,6 +33,17 @@ typedef uint64_t SPCPriorityQueueKey;
 #define SPC_PQ_KEY_MIN LLONG_MIN
 
 
+// Define as 1 to link queue nodes by 32-bit indices into the queue's storage instead of by pointers. This halves the
+// links of a node and tags each link with the generation of the node it points to. Queues are then limited to
+// 2^24 - 3 elements and can't grow, and the C11 primitives backend is required. The tag keeps only 7 bits of the
+// generation, so it only guards a CAS against ABA while its node is reused fewer than 128 times in between.
+// The define changes the node layout, so the whole library must be built with the same value (the
+// SPConcurrencyCompactLinksTests target runs the priority queue tests this way).
+#ifndef SPC_PQ_COMPACT_LINKS
+#    define SPC_PQ_COMPACT_LINKS 0
+#endif
+
+
 
 /**
  *  A concurrent priority queue structure.
@@ -38,14 +51,36 @@ typedef uint64_t SPCPriorityQueueKey;
 struct SPCPriorityQueue {
     SPCPriorityQueueNode          *_head;
     SPCPriorityQueueNode          *_tail;
-    SPCPriorityQueueNode *volatile _freeList;
+    cmem_pool_t                    _pool;
     void                          *_storage;
     size_t                         _size;
+    size_t                         _maxHeight;
+    SPCMemoryReclamationScheme     _reclamationScheme;
+    cmem_hazard_domain_t           _hazardDomain;
+    cmem_epoch_domain_t            _epochDomain;
+    bool                           _keepsDuplicateKeys;
+    volatile long                  _sequence;
 };
 
 typedef struct SPCPriorityQueue SPCPriorityQueue;
 
 
+/**
+ *  A handle to an element in a priority queue, for deleting the element or changing its key later on.
+ *
+ *  A handle only identifies the element and never keeps it alive: once the element has been extracted or deleted,
+ *  operations on the handle simply fail, even if its node has been reused for another element since.
+ */
+struct SPCPriorityQueueHandle {
+    SPCPriorityQueueNode          *_node;
+    SPCPriorityQueueKey            _key;
+    unsigned long                  _sequence;
+    uint32_t                       _generation;
+};
+
+typedef struct SPCPriorityQueueHandle SPCPriorityQueueHandle;
+
+
 
 /**
  *  Initialize a concurrent lock-free priority queue.
@@ -58,6 +93,100 @@ typedef struct SPCPriorityQueue SPCPriorityQueue;
 bool SPCPriorityQueueInit(SPCPriorityQueue *pqueue, size_t length);
 
 
+/**
+ *  Initialize a concurrent lock-free priority queue with a given memory reclamation scheme.
+ *
+ *  Under hazard pointers, traversals leave the nodes they visit untouched, which keeps read-heavy workloads from
+ *  contending on the reference counts of the first nodes. Each thread may hold back a few deleted nodes
+ *  (up to kCMemRetiredSlotCount) before they are reused, so allow for that in the length.
+ *
+ *  Under epochs, operations only announce the global epoch when they start, and neither traversals nor deletions
+ *  touch the reference counts. Deleted nodes are reused two epochs later, so a thread stalled inside an operation
+ *  holds back every node deleted in the meantime.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param length The priority queue length. (More memory may actually be allocated.)
+ *  @param scheme The memory reclamation scheme.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueInitWithReclamationScheme(SPCPriorityQueue *pqueue, size_t length, SPCMemoryReclamationScheme scheme);
+
+
+/**
+ *  Initialize a concurrent lock-free priority queue with a given memory reclamation scheme and maximum height.
+ *
+ *  The other initializers derive the height from the length, so that a full queue keeps logarithmic searches.
+ *  Nodes are sized to hold a link per level, so a lower height saves memory at the cost of longer searches.
+ *  A queue that is expected to grow well beyond its length may want a greater height.
+ *
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param length    The priority queue length. (More memory may actually be allocated.)
+ *  @param scheme    The memory reclamation scheme.
+ *  @param maxHeight The maximum height of the skip list (clamped to 2...32); 0 to derive it from the length.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueInitWithMaxHeight(SPCPriorityQueue *pqueue, size_t length, SPCMemoryReclamationScheme scheme, size_t maxHeight);
+
+
+/**
+ *  Put per-thread magazines of free nodes in front of the queue's shared free list. Call before the queue is shared
+ *  between threads.
+ *
+ *  A thread then allocates and deletes nodes in its own magazine, and only touches the shared free list to refill
+ *  half of an empty magazine or to spill half of a full one. Each thread may keep up to magazineSize free nodes to
+ *  itself, so allow for that in the length.
+ *
+ *  @param pqueue       A pointer to a lock-free priority queue.
+ *  @param magazineSize The number of free nodes a thread can keep (capped at kCMemMaxMagazineSize).
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueEnableMagazines(SPCPriorityQueue *pqueue, size_t magazineSize);
+
+
+/**
+ *  Let the queue grow by slabs of nodes once its length is used up, instead of failing to insert. Call before the queue
+ *  is shared between threads.
+ *
+ *  Inserts stay lock-free and never allocate memory: an exhausted queue chains a slab from a reserve of preallocated
+ *  slabs, which SPCPriorityQueueReplenishGrowthReserve() refills. Nodes never move, and slabs are only freed with the queue.
+ *
+ *  @param pqueue        A pointer to a lock-free priority queue.
+ *  @param slabLength    The number of nodes in a slab.
+ *  @param reserveLength The number of slabs to keep in reserve.
+ *
+ *  @return true if successful; false, otherwise.
+ */
+bool SPCPriorityQueueEnableGrowth(SPCPriorityQueue *pqueue, size_t slabLength, size_t reserveLength);
+
+
+/**
+ *  Refill the growth reserve of the queue. Allocates memory, so call it from a non-real-time context, e.g. periodically
+ *  or after an insert has failed. Safe to call while other threads use the queue.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *
+ *  @return true if the reserve is full; false, otherwise.
+ */
+bool SPCPriorityQueueReplenishGrowthReserve(SPCPriorityQueue *pqueue);
+
+
+/**
+ *  Keep elements with equal keys, and extract them in the order they were inserted, instead of replacing the element
+ *  that holds a key. Call before the queue is shared between threads.
+ *
+ *  Each inserted element draws a sequence number from a counter shared by the queue, which orders it after the
+ *  elements already holding its key. Elements inserted concurrently with the same key are extracted in the order
+ *  they drew their numbers. The counter is as wide as a long, so on 32-bit targets the order only holds between
+ *  elements inserted less than 2^32 inserts apart.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ */
+void SPCPriorityQueueEnableDuplicateKeys(SPCPriorityQueue *pqueue);
+
+
 /**
  *  Dispose of a concurrent lock-free priority queue.
  *
@@ -78,6 +207,41 @@ void SPCPriorityQueueDispose(SPCPriorityQueue *pqueue);
 bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data);
 
 
+/**
+ *  Insert an element into a lock-free priority queue, and get a handle to it.
+ *
+ *  If the queue already holds an element with the same key, that element is replaced, and the handle refers to it
+ *  (unless duplicate keys are enabled).
+ *
+ *  @param pqueue    A pointer to a lock-free priority queue.
+ *  @param key       A key.
+ *  @param data      The element.
+ *  @param outHandle An optional pointer that if passed, will be set to a handle to the element.
+ *
+ *  @return true if successful.
+ */
+bool SPCPriorityQueueInsertElementWithHandle(SPCPriorityQueue *pqueue, SPCPriorityQueueKey key, void *data, SPCPriorityQueueHandle *outHandle);
+
+
+/**
+ *  Insert elements given in key order into a lock-free priority queue.
+ *
+ *  Each element is searched for from where the previous one went, rather than from the head, so a run of keys that
+ *  are close together costs about one search plus a splice per element. Keys out of order are still inserted
+ *  correctly, but start a new search from the head. Each element is inserted on its own, as if by
+ *  SPCPriorityQueueInsertElement(), so other threads may see some of them before others.
+ *
+ *  @param pqueue   A pointer to a lock-free priority queue.
+ *  @param keys     The element keys, in ascending order.
+ *  @param elements The elements.
+ *  @param count    The number of elements.
+ *
+ *  @return The number of elements inserted (from the start of the arrays), which is less than count if an element
+ *          is misaligned or the queue is full.
+ */
+size_t SPCPriorityQueueInsertSortedElements(SPCPriorityQueue *pqueue, const SPCPriorityQueueKey *keys, void *const *elements, size_t count);
+
+
 /**
  *  Delete and return the element with the minimum key value.
  *
@@ -89,6 +253,61 @@ bool SPCPriorityQueueInsertElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey
 void *SPCPriorityQueueExtractMinimumElement(SPCPriorityQueue *pqueue, SPCPriorityQueueKey *outKey);
 
 
+/**
+ *  Delete the elements with keys up to a given key, in key order, and unlink each run of them from the front of the
+ *  queue together.
+ *
+ *  Not atomic as a whole: the result is the same as that of repeated SPCPriorityQueueExtractMinimumElement() calls
+ *  that stop at the first key greater than maxKey, so elements inserted or extracted meanwhile by other threads may
+ *  or may not be included.
+ *
+ *  @param pqueue      A pointer to a lock-free priority queue.
+ *  @param maxKey      The maximum key of the elements to delete.
+ *  @param outElements An array that will be filled in with the elements.
+ *  @param outKeys     An optional array that if passed, will be filled in with the keys of the elements.
+ *  @param maxCount    The maximum number of elements to delete (the length of the arrays).
+ *
+ *  @return The number of elements deleted.
+ */
+size_t SPCPriorityQueueExtractElementsUpToKey(SPCPriorityQueue *pqueue, SPCPriorityQueueKey maxKey, void **outElements, SPCPriorityQueueKey *outKeys, size_t maxCount);
+
+
+/**
+ *  Delete and return the element of a handle, wherever it is in the queue.
+ *
+ *  The element is found by its key, so this takes about as long as an insert. It competes with concurrent extractions
+ *  for the element, and exactly one of them gets it.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle to the element, from the same queue.
+ *
+ *  @return The element; NULL if it is no longer in the queue.
+ */
+void *SPCPriorityQueueDeleteElement(SPCPriorityQueue *pqueue, const SPCPriorityQueueHandle *handle);
+
+
+/**
+ *  Change the key of the element of a handle.
+ *
+ *  The element is deleted and then inserted again with the new key, as if by SPCPriorityQueueInsertElement(), so other
+ *  threads may briefly find it in neither place, but never in both. The node for the new key is taken up front, so the
+ *  element isn't lost if the queue is full.
+ *
+ *  Unless duplicate keys are enabled, an element that already has the new key is left alone, and the element goes back
+ *  under its old key instead. An element inserted under the old key in the meantime is never replaced either: the call
+ *  then keeps trying the two keys in turn until one of them is free.
+ *
+ *  @param pqueue A pointer to a lock-free priority queue.
+ *  @param handle A handle to the element, from the same queue. Updated to refer to the element under its new key
+ *                (or under its old key again).
+ *  @param key    The new key.
+ *
+ *  @return true if successful; false if the element is no longer in the queue, the queue is full, or another element
+ *          has the new key.
+ */
+bool SPCPriorityQueueUpdateElementKey(SPCPriorityQueue *pqueue, SPCPriorityQueueHandle *handle, SPCPriorityQueueKey key);
+
+
 /**
  *  Peek at the current minimum element in the queue without actually deleting it.
  *
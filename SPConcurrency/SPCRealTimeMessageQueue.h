@@ -8,6 +8,10 @@
 
 #import <Foundation/Foundation.h>
 
+#import <stddef.h>
+
+#import "SPCMessageEngine.h"
+
 
 @class SPCMessageQueue;
 
@@ -37,26 +41,77 @@
  *
  *  @param block         The block to be executed on the real-time thread.
  *  @param responseBlock The response to be executed on the main thread (it will be sent to the response queue).
+ *
+ *  @return YES if successful; NO if the queue was full, in which case neither block is executed.
  */
-- (void)dispatchAsynchronously:(void (^)(void))block
+- (BOOL)dispatchAsynchronously:(void (^)(void))block
                  responseBlock:(void (^)(void))responseBlock;
 
 
 /**
  *  Dispatch a block for synchronous execution on the real-time thread and wait for it to finish.
  *
+ *  The real-time thread signals the caller directly when the block has run; the caller spins briefly and
+ *  then sleeps on a futex, so the round trip does not go through the response queue. If the block hasn't run
+ *  within a second and the real-time thread isn't processing the queue, the caller runs the queued messages itself;
+ *  while the real-time thread is processing them, the caller keeps waiting, for as long as it takes.
+ *
  *  @param block The block to be executed on the real-time thread.
+ *
+ *  @return YES if the block has run; NO if the queue was full, in which case the block is not executed.
  */
-- (void)dispatchSynchronously:(void (^)(void))block;
+- (BOOL)dispatchSynchronously:(void (^)(void))block;
 
 
 /**
- *  Proccess messages posted on the queue.
+ *  Dispatch a command for asynchronous execution on the real-time thread.
+ *
+ *  The handler and a copy of its arguments are written straight into the queue's buffer: no memory is allocated,
+ *  nothing is retained and no lock is taken. Safe to call from any number of threads concurrently.
+ *  The handler runs on the real-time thread, and the arguments are only valid until it returns.
+ *
+ *  @param realTimeMessageQueue A real-time message queue.
+ *  @param handler              The command handler.
+ *  @param arguments            The command arguments.
+ *  @param argumentsLength      The command arguments length.
+ *
+ *  @return kSPCMessageQueueDispatchQueued if the command was queued; kSPCMessageQueueDispatchFull if the queue was full.
+ */
+SPCMessageQueueDispatchStatus SPCRealTimeMessageQueueDispatch(SPCRealTimeMessageQueue *realTimeMessageQueue,
+                                                              SPCMessageHandler handler,
+                                                              const void *arguments,
+                                                              size_t argumentsLength);
+
+
+/**
+ *  Proccess messages posted on the queue. Only call this from the real-time thread.
  *
  *  @param realTimeMessageQueue A real-time message queue.
  */
 void SPCRealTimeMessageQueueProccessMessages(SPCRealTimeMessageQueue *realTimeMessageQueue);
 
 
+/**
+ *  Proccess messages posted on the queue, within a budget.
+ *
+ *  Stops before the budget is exceeded, leaving the remaining messages in place for the next call, so the time
+ *  spent in a real-time callback can be bounded. A message always runs to completion, so the elapsed time can
+ *  exceed the tick budget by at most the length of one message. Also stops early if the response queue is full,
+ *  keeping the completed blocks until the next call. Only call this from the real-time thread. Skips the pass,
+ *  processing nothing, while another thread processes the messages offline.
+ *
+ *  @param realTimeMessageQueue A real-time message queue.
+ *  @param maxMessages          The maximum number of messages to process.
+ *  @param maxTicks             The maximum time to spend, in host ticks (0 for no time limit).
+ *  @param remainingMessages    On return, the number of messages left in the queue (optional).
+ *
+ *  @return The number of messages processed.
+ */
+size_t SPCRealTimeMessageQueueProccessMessagesWithBudget(SPCRealTimeMessageQueue *realTimeMessageQueue,
+                                                         size_t maxMessages,
+                                                         uint64_t maxTicks,
+                                                         size_t *remainingMessages);
+
+
 
 @end
@@ -13,9 +13,10 @@
 #endif
 
 #include <assert.h>
-#include <mach/mach.h>
+#include <mach/mach_time.h>
 #include <string.h>
 
+#import "SPCFutex.h"
 #import "SPCMessageQueue.h"
 #import "SPCRingBuffer.h"
 
@@ -24,7 +25,54 @@
 #pragma mark - Real-time message queue
 
 
+
+/**
+ *  A block that has run on the real-time thread, waiting to be released on the main thread together
+ *  with running its response.
+ */
+struct completed_block_t {
+    void *block;
+    void *responseBlock;
+};
+
+typedef struct completed_block_t completed_block_t;
+
+
+/**
+ *  The maximum number of completed blocks sent to the response queue in one message.
+ */
+enum { kCompletedBlockBatchSize = 64 };
+
+
+/**
+ *  The completed blocks of a processing pass, waiting to be sent to the response queue. A batch belongs to
+ *  the thread that processes the messages.
+ */
+struct completed_batch_t {
+    completed_block_t  blocks[kCompletedBlockBatchSize];
+    size_t             count;
+};
+
+typedef struct completed_batch_t completed_batch_t;
+
+
+
+/**
+ *  The states of the consumer flag. Only one thread at a time may consume the messages.
+ */
+enum {
+    kConsumerIdle            = 0,
+    kConsumerBusy            = 1,
+    kConsumerBusyWithWaiters = 2,
+};
+
+
+
 @interface SPCRealTimeMessageQueue ()
+{
+    completed_batch_t  _completedBatch;         // Only used by the real-time thread.
+    spc_futex_t        _consumer;               // Held while a thread consumes the messages.
+}
 
 @property (nonatomic, weak) SPCMessageQueue *responseQueue;
 @property (nonatomic)       SPCRingBuffer    messageBuffer;
@@ -71,158 +119,429 @@ static const int32_t kMessageBufferSize = 16384;
 
 
 
-static void SPReleaseBlockHandler(void *refCon, size_t refConSize)
+/**
+ *  A command header, followed in the buffer by the inline argument bytes.
+ */
+struct command_t {
+    SPCMessageHandler  handler;
+    size_t             argumentsLength;
+};
+
+typedef struct command_t command_t;
+
+
+static void SPExecuteBlockCommandHandler(void *refCon, size_t refConSize);
+static void addCompletedBlock(completed_batch_t *batch, const void *arguments);
+
+
+/**
+ *  Take the consumer flag if no other thread holds it. Doesn't wait, so the real-time thread can call it.
+ *
+ *  @return true if the flag was taken; false if another thread is consuming the messages.
+ */
+static bool tryBeginConsuming(SPCRealTimeMessageQueue *this)
 {
-    assert(refCon && refConSize == sizeof(void *));
+    uint32_t state = kConsumerIdle;
+    return SPCFutexCompareAndSwap(&this->_consumer, &state, kConsumerBusy);
+}
+
+
+/**
+ *  Take the consumer flag, sleeping until the thread that holds it lets go. Never call it from the real-time thread.
+ */
+static void beginConsuming(SPCRealTimeMessageQueue *this)
+{
+    uint32_t state = kConsumerIdle;
+    if (SPCFutexCompareAndSwap(&this->_consumer, &state, kConsumerBusy))
+        return;
     
-    void *blockPtr = *(void **)refCon;
-    if (blockPtr) {
-        CFBridgingRelease(blockPtr);
+    for (;;) {
+        // Announce the wait, and sleep until the consumer lets go.
+        if (state == kConsumerBusyWithWaiters || SPCFutexCompareAndSwap(&this->_consumer, &state, kConsumerBusyWithWaiters))
+            SPCFutexWait(&this->_consumer, kConsumerBusyWithWaiters, 0);
+        
+        // Other threads may still be waiting, so keep the flag marked as waited on.
+        state = kConsumerIdle;
+        if (SPCFutexCompareAndSwap(&this->_consumer, &state, kConsumerBusyWithWaiters))
+            return;
     }
 }
 
 
+/**
+ *  Let go of the consumer flag, waking up a waiting thread if there is one.
+ */
+static void endConsuming(SPCRealTimeMessageQueue *this)
+{
+    if (__atomic_exchange_n(&this->_consumer, kConsumerIdle, __ATOMIC_RELEASE) == kConsumerBusyWithWaiters)
+        SPCFutexWake(&this->_consumer, false);
+}
+
+
 //
-// Proccess messages posted on the queue.
+// Dispatch a command for asynchronous execution on the real-time thread.
 //
-void SPCRealTimeMessageQueueProccessMessages(SPCRealTimeMessageQueue *this)
+SPCMessageQueueDispatchStatus SPCRealTimeMessageQueueDispatch(SPCRealTimeMessageQueue *this,
+                                                              SPCMessageHandler handler,
+                                                              const void *arguments,
+                                                              size_t argumentsLength)
 {
+    command_t *command = SPCRingBufferReserveForWrite_MPSC(&this->_messageBuffer, sizeof(command_t) + argumentsLength);
+    if (!command)
+        return kSPCMessageQueueDispatchFull;
     
-    size_t availableBytes;
-    void **messagePtr = SPCRingBufferGetForRead(&this->_messageBuffer, &availableBytes);
-    void *end = (char *)messagePtr + availableBytes;
+    command->handler         = handler;
+    command->argumentsLength = argumentsLength;
+    
+    if (argumentsLength > 0)
+        memcpy(command + 1, arguments, argumentsLength);
+    
+    SPCRingBufferCommitWrite_MPSC(&this->_messageBuffer, command, sizeof(command_t) + argumentsLength);
+    
+    return kSPCMessageQueueDispatchQueued;
+}
+
+
+static void SPReleaseBlocksAndExecuteResponsesHandler(void *refCon, size_t refConSize)
+{
+    assert(refCon && refConSize % sizeof(completed_block_t) == 0);
     
-    while ((void *)messagePtr < (void *)end) {
+    completed_block_t *completedBlocks = refCon;
+    
+    for (size_t idx = 0; idx < refConSize / sizeof(completed_block_t); ++idx) {
+        
+        if (completedBlocks[idx].block)
+            CFBridgingRelease(completedBlocks[idx].block);
         
-        __unsafe_unretained void (^executionBlock)(void) = (__bridge void (^)(void))(*messagePtr);
-        SPCRingBufferMarkRead(&this->_messageBuffer, sizeof(void *));
+        if (completedBlocks[idx].responseBlock) {
+            void (^responseBlock)(void) = CFBridgingRelease(completedBlocks[idx].responseBlock);
+            if (responseBlock)
+                responseBlock();
+        }
+    }
+}
+
+
+/**
+ *  Send the blocks completed so far to the response queue, as a single message.
+ *
+ *  @param batch A batch of completed blocks, which is kept if the response queue is full.
+ *
+ *  @return true if the batch is empty now; false if the response queue is full.
+ */
+static bool flushCompletedBlocks(SPCRealTimeMessageQueue *this, completed_batch_t *batch)
+{
+    if (batch->count == 0)
+        return true;
     
-        if (executionBlock) {
-            
-            // Run the block.
-            //
-            executionBlock();
+    if (SPCMessageQueueTryDispatch(this->_responseQueue,
+                                   SPReleaseBlocksAndExecuteResponsesHandler,
+                                   batch->blocks,
+                                   batch->count * sizeof(completed_block_t)) != kSPCMessageQueueDispatchQueued)
+        return false;
+    
+    batch->count = 0;
+    return true;
+}
+
+
+/**
+ *  Proccess messages posted on the queue, within a budget, collecting the completed blocks in a batch.
+ *
+ *  Stops early, leaving the remaining messages in place, if a block command finds the batch full and the response
+ *  queue full too. A command is only marked read once it has run, so the caller must hold the consumer flag.
+ *
+ *  @param batch             A batch of completed blocks, owned by the calling thread.
+ *  @param maxMessages       The maximum number of messages to process.
+ *  @param maxTicks          The maximum time to spend, in host ticks (0 for no time limit).
+ *  @param remainingMessages On return, the number of messages left in the queue (optional).
+ *
+ *  @return The number of messages processed.
+ */
+static size_t processMessages(SPCRealTimeMessageQueue *this,
+                              completed_batch_t *batch,
+                              size_t maxMessages,
+                              uint64_t maxTicks,
+                              size_t *remainingMessages)
+{
+    const uint64_t giveUpTime = maxTicks ? mach_absolute_time() + maxTicks : 0;
+    
+    size_t processed = 0;
+    size_t availableBytes;
+    command_t *command;
+    while (processed < maxMessages &&
+           (!giveUpTime || mach_absolute_time() < giveUpTime) &&
+           (command = SPCRingBufferGetForRead_MPSC(&this->_messageBuffer, &availableBytes))) {
+        
+        // A block command adds its blocks to the batch, so make room for them first.
+        const bool isBlockCommand = (command->handler == SPExecuteBlockCommandHandler);
+        if (isBlockCommand && batch->count == kCompletedBlockBatchSize && !flushCompletedBlocks(this, batch))
+            break;
+        
+        if (command->handler) {
             
-            // Release the block on the main thread.
-            //
-            void *executionBlockToRelease = (__bridge void *)(executionBlock);
-            SPCMessageQueueDispatch(this->_responseQueue, SPReleaseBlockHandler, &executionBlockToRelease, sizeof(void *));
+            // Run the command.
+            command->handler(command->argumentsLength > 0 ? command + 1 : NULL, command->argumentsLength);
         }
         
-        messagePtr++;
+        if (isBlockCommand)
+            addCompletedBlock(batch, command + 1);
+        
+        SPCRingBufferMarkReadAndClear_MPSC(&this->_messageBuffer);
+        ++processed;
     }
+    
+    (void)flushCompletedBlocks(this, batch);
+    
+    if (remainingMessages)
+        *remainingMessages = SPCRingBufferGetCommittedCount_MPSC(&this->_messageBuffer);
+    
+    return processed;
 }
 
 
+//
+// Proccess messages posted on the queue, within a budget.
+//
+size_t SPCRealTimeMessageQueueProccessMessagesWithBudget(SPCRealTimeMessageQueue *this,
+                                                         size_t maxMessages,
+                                                         uint64_t maxTicks,
+                                                         size_t *remainingMessages)
+{
+    // Skip the pass while a thread processes the messages offline; the messages wait for the next pass.
+    if (!tryBeginConsuming(this)) {
+        if (remainingMessages)
+            *remainingMessages = SPCRingBufferGetCommittedCount_MPSC(&this->_messageBuffer);
+        
+        return 0;
+    }
+    
+    size_t processed = processMessages(this, &this->_completedBatch, maxMessages, maxTicks, remainingMessages);
+    
+    endConsuming(this);
+    
+    return processed;
+}
+
 
-static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
+//
+// Proccess messages posted on the queue.
+//
+void SPCRealTimeMessageQueueProccessMessages(SPCRealTimeMessageQueue *this)
 {
-    assert(refCon && refConSize == sizeof(void *));
+    (void)SPCRealTimeMessageQueueProccessMessagesWithBudget(this, SIZE_MAX, 0, NULL);
+}
+
+
+/**
+ *  Proccess all the messages posted on the queue in place of the real-time thread, from any other thread holding
+ *  the consumer flag.
+ *
+ *  Collects the completed blocks in a batch of its own, and hands a batch that the response queue has no room for
+ *  to the main queue instead, so that processing never stops.
+ */
+static void drainMessagesOffline(SPCRealTimeMessageQueue *this)
+{
+    completed_batch_t batch = { .count = 0 };
     
-    void *responseBlockPtr = *(void **)refCon;
-    if (responseBlockPtr) {
-        void (^responseBlock)(void) = CFBridgingRelease(responseBlockPtr);
-        if (responseBlock)
-            responseBlock();
+    for (;;) {
+        (void)processMessages(this, &batch, SIZE_MAX, 0, NULL);
+        if (batch.count == 0)
+            break;
+        
+        NSData *completedBlocks = [NSData dataWithBytes:batch.blocks length:batch.count * sizeof(completed_block_t)];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            SPReleaseBlocksAndExecuteResponsesHandler((void *)completedBlocks.bytes, completedBlocks.length);
+        });
+        
+        batch.count = 0;
     }
 }
 
 
-- (void)dispatchAsynchronously:(void (^)(void))block
+/**
+ *  Proccess messages posted on the queue in place of the real-time thread, from any other thread.
+ *
+ *  Waits for the real-time thread to finish its pass first, so that no message runs twice.
+ */
+static void processMessagesOffline(SPCRealTimeMessageQueue *this)
+{
+    beginConsuming(this);
+    drainMessagesOffline(this);
+    endConsuming(this);
+}
+
+
+
+#pragma mark - Block messaging
+
+
+
+/**
+ *  The arguments of a block command. The blocks are retained by the dispatching thread, and released on
+ *  the main thread together with running the response, so that the real-time thread never frees memory.
+ *  Completed blocks are batched per processing pass.
+ */
+struct block_command_t {
+    void *block;
+    void *responseBlock;
+};
+
+typedef struct block_command_t block_command_t;
+
+
+static void SPExecuteBlockCommandHandler(void *refCon, size_t refConSize)
+{
+    assert(refCon && refConSize == sizeof(block_command_t));
+    
+    block_command_t *command = refCon;
+    
+    __unsafe_unretained void (^block)(void) = (__bridge void (^)(void))command->block;
+    
+    // Run the block. The processing pass then adds it to its batch of completed blocks.
+    block();
+}
+
+
+/**
+ *  Queue the blocks of a block command that has run for release and the response for the main thread; they are sent
+ *  when the batch fills up or at the end of the pass.
+ *
+ *  @param batch     A batch of completed blocks with room for one more.
+ *  @param arguments The arguments of the block command.
+ */
+static void addCompletedBlock(completed_batch_t *batch, const void *arguments)
+{
+    assert(batch->count < kCompletedBlockBatchSize);
+    
+    const block_command_t *command = arguments;
+    
+    batch->blocks[batch->count++] = (completed_block_t){
+        .block         = command->block,
+        .responseBlock = command->responseBlock,
+    };
+}
+
+
+- (BOOL)dispatchAsynchronously:(void (^)(void))block
                  responseBlock:(void (^)(void))responseBlock
 {
-    if (!block) return;
+    if (!block) return NO;
     
-    @synchronized (self) {
-        
-        //
-        // Retain the response block if available.
-        //
-        void *responseBlockPtr = NULL;
-        if (responseBlock) {
-            responseBlockPtr = (void *)CFBridgingRetain(responseBlock);
-        }
-        
-        //
-        // Construct the block to send to the real-time thread.
-        //
-        void (^executionBlock)(void) = ^{
+    //
+    // Retain the blocks for the duration of the round trip.
+    //
+    block_command_t command = {
+        .block         = (void *)CFBridgingRetain(block),
+        .responseBlock = responseBlock ? (void *)CFBridgingRetain(responseBlock) : NULL,
+    };
+    
+    //
+    // Write the command to the real-time thread.
+    //
+    SPCMessageQueueDispatchStatus status = SPCRealTimeMessageQueueDispatch(self, SPExecuteBlockCommandHandler, &command, sizeof(command));
+    if (status != kSPCMessageQueueDispatchQueued) {
+        DLog(@"Failed to dispatch block");
         
-            // Execute the main block.
-            block();
-            
-            // Dispatch the response block to the main thread.
-            void *responseBlockPtrHolder = responseBlockPtr;
-            SPCMessageQueueDispatch(_responseQueue, SPExecuteAndReleaseBlockHandler, &responseBlockPtrHolder, sizeof(void *));
-            
-        };
-        void *executionBlockPtr = (void *)CFBridgingRetain(executionBlock);
-
+        // Release resources.
         //
-        // Write the block to the real-time thread.
-        //
-        size_t availableBytes;
-        void **message = SPCRingBufferGetForWrite(&_messageBuffer, &availableBytes);
-        assert(availableBytes >= sizeof(void *));
-        *message = executionBlockPtr;
-        
-        SPCRingBufferMarkWritten(&_messageBuffer, sizeof(void *));
+        CFBridgingRelease(command.block);
+        if (command.responseBlock)
+            CFBridgingRelease(command.responseBlock);
         
-        //
-        // If the response queue is not running, just do the exchange offline.
-        //
-        if (![self.responseQueue isRunning]) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                SPCRealTimeMessageQueueProccessMessages(self);
-                [self.responseQueue flushQueue];
-            });
-        }
+        return NO;
     }
+    
+    //
+    // If the response queue is not running, just do the exchange offline.
+    //
+    if (![self.responseQueue isRunning]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            processMessagesOffline(self);
+            [self.responseQueue flushQueue];
+        });
+    }
+    
+    return YES;
+}
+
+
+
+/**
+ *  The arguments of a synchronous block command. The caller waits for the completion, so the block
+ *  needs no retaining.
+ */
+struct synchronous_command_t {
+    void           *block;
+    SPCCompletion  *completion;
+};
+
+typedef struct synchronous_command_t synchronous_command_t;
+
+
+static void SPExecuteSynchronousBlockCommandHandler(void *refCon, size_t refConSize)
+{
+    assert(refCon && refConSize == sizeof(synchronous_command_t));
+    
+    synchronous_command_t *command = refCon;
+    
+    __unsafe_unretained void (^block)(void) = (__bridge void (^)(void))command->block;
+    
+    // Run the block, and signal the waiting thread directly.
+    block();
+    SPCCompletionSignal(command->completion);
 }
 
 
 
-static const NSTimeInterval kSynchronousResponseWaitTimeout = 1.00;
-static const NSTimeInterval kThreadWaitTimeout              = 0.01;
+static const unsigned int kSynchronousResponseSpinCount   = 4096;
+static const uint64_t     kSynchronousResponseWaitTimeout = 1000000000;   // In nanoseconds.
 
 
 
-- (void)dispatchSynchronously:(void (^)(void))block
+- (BOOL)dispatchSynchronously:(void (^)(void))block
 {
-    if (!block) return;
+    if (!block) return NO;
+    
+    SPCCompletion completion;
+    SPCCompletionInit(&completion);
     
     //
-    // Send asynchronous message with a completion notification response block.
+    // Send the block to the real-time thread, which signals the completion when the block has run.
     //
-    __block BOOL finished = NO;
-    [self dispatchAsynchronously:block responseBlock:^{
-        finished = YES;
-    }];
-
+    synchronous_command_t command = {
+        .block      = (__bridge void *)block,
+        .completion = &completion,
+    };
+    
+    SPCMessageQueueDispatchStatus status = SPCRealTimeMessageQueueDispatch(self, SPExecuteSynchronousBlockCommandHandler, &command, sizeof(command));
+    if (status != kSPCMessageQueueDispatchQueued) {
+        DLog(@"Failed to dispatch block");
+        return NO;
+    }
     
     //
-    // Wait for the response.
+    // If the response queue is not running, just do the exchange offline.
     //
-    uint64_t giveUpTime = mach_absolute_time() + (kSynchronousResponseWaitTimeout / SPUMachHostTicksToSeconds());
-    while (!finished && mach_absolute_time() < giveUpTime) {
-        if ([NSThread isMainThread]) {
-            [self.responseQueue flushQueue];
-        } else {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [self.responseQueue flushQueue];
-            });
-        }
-        if (finished) break;
-        [NSThread sleepForTimeInterval:kThreadWaitTimeout];
+    if (![self.responseQueue isRunning]) {
+        processMessagesOffline(self);
     }
     
-    if (!finished) {
+    //
+    // Wait for the block to run. Each time the wait times out, process the queue offline, unless the real-time thread
+    // is processing it right now (it may well be running this very block), in which case keep waiting. Once the queue
+    // has been processed offline, the block has run and the next wait returns straight away.
+    //
+    while (!SPCCompletionWait(&completion, kSynchronousResponseSpinCount, kSynchronousResponseWaitTimeout)) {
         DLog(@"Timed out while waiting for response from the real-time thread.");
-        @synchronized (self) {
-            SPCRealTimeMessageQueueProccessMessages(self);
-            [self.responseQueue flushQueue];
+        
+        if (tryBeginConsuming(self)) {
+            drainMessagesOffline(self);
+            endConsuming(self);
         }
     }
+    
+    return YES;
 }
 
 
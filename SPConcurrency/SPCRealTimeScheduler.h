@@ -8,6 +8,8 @@
 
 #import <Foundation/Foundation.h>
 
+#import "SPCPriorityQueue.h"
+
 
 @class SPCMessageQueue;
 
@@ -44,6 +46,14 @@ OSStatus SPCRealTimeSchedulerInvokeCallback(void   *inRTSchedulerPtr,
 typedef void (^SPCRealTimeSchedulerBlock)(UInt64 inIntervalStart, UInt64 inTimeOffset, BOOL isLastRepetition);
 
 
+/**
+ *  A handle to a scheduled block, for cancelling or rescheduling it before it runs. A repeating block gets a new entry
+ *  for each repetition after the first, so its handle only covers the first run: once a repeating block has started,
+ *  it can no longer be cancelled or rescheduled, and runs all its repetitions. Handles are invalidated by a reset.
+ */
+typedef SPCPriorityQueueHandle SPCRealTimeSchedulerHandle;
+
+
 /**
  *  A real-time scheduler providing time-based event scheduling.
  */
@@ -117,6 +127,49 @@ typedef void (^SPCRealTimeSchedulerBlock)(UInt64 inIntervalStart, UInt64 inTimeO
                          block:(SPCRealTimeSchedulerBlock)block
                  responseBlock:(void (^)(void))responseBlock;
 
+/**
+ *  Schedule a block for execution at a later time, and get a handle to cancel or reschedule it.
+ *
+ *  @param relativeTime       The time interval after which the block should be executed.
+ *  @param repetitions        Number of times the block is to be repeated.
+ *  @param repetitionWaitTime Time to wait between repetitions.
+ *  @param block              A block.
+ *  @param responseBlock      A response block (optional). Will be executed after every repetition.
+ *  @param outHandle          An optional pointer that if passed, will be set to a handle to the scheduled block.
+ *
+ *  @return YES if successful.
+ */
+- (BOOL)scheduleBlockAfterTime:(NSTimeInterval)relativeTime
+                   repetitions:(unsigned long)repetitions
+             delayBeforeRepeat:(NSTimeInterval)repetitionWaitTime
+                         block:(SPCRealTimeSchedulerBlock)block
+                 responseBlock:(void (^)(void))responseBlock
+                        handle:(SPCRealTimeSchedulerHandle *)outHandle;
+
+
+/**
+ *  Cancel a scheduled block before it runs. The block and its response block are released without being executed.
+ *  Call from a non-real-time thread.
+ *
+ *  @param handle A handle to the scheduled block.
+ *
+ *  @return YES if the block was cancelled; NO if it has already run or is running (or, for a repeating block, has
+ *          started running).
+ */
+- (BOOL)cancelScheduledBlock:(SPCRealTimeSchedulerHandle)handle;
+
+
+/**
+ *  Move a scheduled block to another time before it runs.
+ *
+ *  @param handle       A handle to the scheduled block. Updated to refer to the block at its new time.
+ *  @param relativeTime The new time interval after which the block should be executed.
+ *
+ *  @return YES if the block was rescheduled; NO if it has already run or is running (or, for a repeating block, has
+ *          started running).
+ */
+- (BOOL)rescheduleBlock:(SPCRealTimeSchedulerHandle *)handle afterTime:(NSTimeInterval)relativeTime;
+
 
 
 @end
@@ -27,13 +27,30 @@ struct sched_control_data_t {
     UInt64         time_between_reps;
     unsigned long  num_reps;
     void          *execution_block;
+    void          *response_block;
 };
 
 typedef struct sched_control_data_t sched_control_data_t;
 
 
+/**
+ *  The maximum number of finished control data sent to the response queue for release in one message.
+ */
+enum { kReleaseBatchSize = 64 };
+
+
+/**
+ *  The maximum number of due control data extracted from the scheduler queue at a time.
+ */
+enum { kInvokeBatchSize = 32 };
+
+
 
 @interface SPCRealTimeScheduler ()
+{
+    sched_control_data_t *_finishedControlData[kReleaseBatchSize];
+    size_t                _finishedControlDataCount;
+}
 
 @property (nonatomic)       SPCPriorityQueue  schedulerQueue;
 @property (nonatomic, weak) SPCMessageQueue  *responseQueue;
@@ -75,6 +92,9 @@ typedef struct sched_control_data_t sched_control_data_t;
     
     SPCPriorityQueueInit(&_schedulerQueue, queueSize);
     
+    // Blocks scheduled for the same time all run, in the order they were scheduled.
+    SPCPriorityQueueEnableDuplicateKeys(&_schedulerQueue);
+    
     return self;
 }
 
@@ -86,6 +106,7 @@ typedef struct sched_control_data_t sched_control_data_t;
 {
     SPCPriorityQueueDispose(&_schedulerQueue);
     SPCPriorityQueueInit(&_schedulerQueue, _queueSize);
+    SPCPriorityQueueEnableDuplicateKeys(&_schedulerQueue);
 }
 
 
@@ -163,6 +184,34 @@ static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
              delayBeforeRepeat:(NSTimeInterval)repetitionWaitTime
                          block:(SPCRealTimeSchedulerBlock)block
                  responseBlock:(void (^)(void))responseBlock
+{
+    return [self scheduleBlockAfterTime:relativeTime
+                            repetitions:repetitions
+                      delayBeforeRepeat:repetitionWaitTime
+                                  block:block
+                          responseBlock:responseBlock
+                                 handle:NULL];
+}
+
+
+/**
+ *  Schedule a block for execution at a later time, and get a handle to cancel or reschedule it.
+ *
+ *  @param relativeTime       The time interval after which the block should be executed.
+ *  @param repetitions        Number of times the block is to be repeated.
+ *  @param repetitionWaitTime Time to wait between repetitions.
+ *  @param block              A block.
+ *  @param responseBlock      A response block (optional). Will be executed after every repetition.
+ *  @param outHandle          An optional pointer that if passed, will be set to a handle to the scheduled block.
+ *
+ *  @return YES if successful.
+ */
+- (BOOL)scheduleBlockAfterTime:(NSTimeInterval)relativeTime
+                   repetitions:(unsigned long)repetitions
+             delayBeforeRepeat:(NSTimeInterval)repetitionWaitTime
+                         block:(SPCRealTimeSchedulerBlock)block
+                 responseBlock:(void (^)(void))responseBlock
+                        handle:(SPCRealTimeSchedulerHandle *)outHandle
 {
     if (repetitions == 0) {
         DLog(@"Scheduled block for 0 repetitions.");
@@ -202,6 +251,7 @@ static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
     //
     sched_control_data_t *controlData = calloc(1, sizeof(sched_control_data_t));
     controlData->execution_block      = (void *)CFBridgingRetain(executionBlock);
+    controlData->response_block       = responseBlockPtr;
     controlData->num_reps             = repetitions;
     controlData->time_between_reps    = repetitionWaitTime * (1.0 / SPUMachHostTicksToSeconds());
     
@@ -211,7 +261,7 @@ static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
     SPCPriorityQueueKey  key  = relativeTime * (1.0 / SPUMachHostTicksToSeconds());
     void                *data = controlData;
     
-    BOOL scheduled = SPCPriorityQueueInsertElement(&_schedulerQueue, key, data);
+    BOOL scheduled = SPCPriorityQueueInsertElementWithHandle(&_schedulerQueue, key, data, outHandle);
     if (!scheduled) {
         DLog(@"Failed to schedule block");
         
@@ -226,6 +276,49 @@ static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
 }
 
 
+/**
+ *  Cancel a scheduled block before it runs. The block and its response block are released without being executed.
+ *
+ *  @param handle A handle to the scheduled block.
+ *
+ *  @return YES if the block was cancelled; NO if it has already run or is running (or, for a repeating block, has
+ *          started running).
+ */
+- (BOOL)cancelScheduledBlock:(SPCRealTimeSchedulerHandle)handle
+{
+    // Once deleted from the queue, the control data can't reach the real-time thread any more.
+    sched_control_data_t *controlData = SPCPriorityQueueDeleteElement(&_schedulerQueue, &handle);
+    if (!controlData)
+        return NO;
+    
+    CFBridgingRelease(controlData->execution_block);
+    if (controlData->response_block)
+        CFBridgingRelease(controlData->response_block);
+    free(controlData);
+    
+    return YES;
+}
+
+
+/**
+ *  Move a scheduled block to another time before it runs.
+ *
+ *  @param handle       A handle to the scheduled block. Updated to refer to the block at its new time.
+ *  @param relativeTime The new time interval after which the block should be executed.
+ *
+ *  @return YES if the block was rescheduled; NO if it has already run or is running (or, for a repeating block, has
+ *          started running).
+ */
+- (BOOL)rescheduleBlock:(SPCRealTimeSchedulerHandle *)handle afterTime:(NSTimeInterval)relativeTime
+{
+    assert(handle);
+    
+    SPCPriorityQueueKey key = relativeTime * (1.0 / SPUMachHostTicksToSeconds());
+    
+    return SPCPriorityQueueUpdateElementKey(&_schedulerQueue, handle, key);
+}
+
+
 
 #pragma mark - Scheduler callback
 
@@ -233,18 +326,45 @@ static void SPExecuteAndReleaseBlockHandler(void *refCon, size_t refConSize)
 
 static void SPReleaseSchedulerControlDataHandler(void *refCon, size_t refConSize)
 {
-    assert(refCon && refConSize == sizeof(sched_control_data_t *));
+    assert(refCon && refConSize % sizeof(sched_control_data_t *) == 0);
+    
+    sched_control_data_t **finishedControlData = refCon;
     
-    sched_control_data_t *controlData = *(sched_control_data_t **)refCon;
-    if (controlData) {
-        if (controlData->execution_block)
-            CFBridgingRelease(controlData->execution_block);
+    for (size_t idx = 0; idx < refConSize / sizeof(sched_control_data_t *); ++idx) {
         
-        free(controlData);
+        sched_control_data_t *controlData = finishedControlData[idx];
+        if (controlData) {
+            if (controlData->execution_block)
+                CFBridgingRelease(controlData->execution_block);
+            
+            free(controlData);
+        }
     }
 }
 
 
+/**
+ *  Send the control data finished so far to the response queue for release, as a single message.
+ *
+ *  @return true if no finished control data is left; false if the response queue is full, in which case the batch
+ *          is kept for the next call.
+ */
+static bool flushFinishedControlData(SPCRealTimeScheduler *this)
+{
+    if (this->_finishedControlDataCount == 0)
+        return true;
+    
+    if (SPCMessageQueueTryDispatch(this->_responseQueue,
+                                   SPReleaseSchedulerControlDataHandler,
+                                   this->_finishedControlData,
+                                   this->_finishedControlDataCount * sizeof(sched_control_data_t *)) != kSPCMessageQueueDispatchQueued)
+        return false;
+    
+    this->_finishedControlDataCount = 0;
+    return true;
+}
+
+
 /**
  *  Scheduler callback.
  *
@@ -266,53 +386,68 @@ OSStatus SPCRealTimeSchedulerInvokeCallback(void   *inRTSchedulerPtr,
     assert(this);
     
     //
-    // Calculate the end time and peek at the top item of the scheduler queue.
+    // Calculate the end time.
     //
 
     UInt64 relativeEndTime = inIntervalEnd - this->_hostBaseTime;
     
-    UInt64 relativeTime = 0;
-    void  *data         = SPCPriorityQueuePeek_MPSC(&this->_schedulerQueue, &relativeTime);
+    //
+    // Extract the control data due by the end time from the scheduler queue, a batch at a time. Repetitions
+    // scheduled by the blocks that are still due are picked up by a later batch. A batch never outgrows the room
+    // left for finished control data, so while the response queue is full, the remaining blocks stay due in the
+    // scheduler queue until a later interval.
+    //
+    void   *dueData[kInvokeBatchSize];
+    UInt64  dueTimes[kInvokeBatchSize];
     
-    while (data && relativeTime <= relativeEndTime) {
+    for (;;) {
         
-        //
-        // Extract the control data from the scheduler queue.
-        //
-        data = SPCPriorityQueueExtractMinimumElement(&this->_schedulerQueue, &relativeTime);
+        if (this->_finishedControlDataCount > kReleaseBatchSize - kInvokeBatchSize)
+            (void)flushFinishedControlData(this);
         
-        //
-        // Compute the time offset, and then execute the block.
-        //
-        UInt64 eventTime  = this->_hostBaseTime + relativeTime;
-        UInt64 timeOffset = (eventTime > inIntervalStart) ? (eventTime - inIntervalStart) : 0;
-
-        sched_control_data_t *controlData = (sched_control_data_t *)data;
-        __unsafe_unretained SPCRealTimeSchedulerBlock executionBlock = (__bridge SPCRealTimeSchedulerBlock)(controlData->execution_block);
-        if (executionBlock) {
+        size_t maxDue = MIN((size_t)kInvokeBatchSize, kReleaseBatchSize - this->_finishedControlDataCount);
+        if (maxDue == 0)
+            break;
+        
+        size_t numDue = SPCPriorityQueueExtractElementsUpToKey(&this->_schedulerQueue, relativeEndTime, dueData, dueTimes, maxDue);
+        if (numDue == 0)
+            break;
+        
+        for (size_t idx = 0; idx < numDue; ++idx) {
             
-            // Run the block.
             //
-            BOOL isLastRepetition = (--controlData->num_reps <= 0);
-            executionBlock(inIntervalStart, timeOffset, isLastRepetition);
-
-            if (!isLastRepetition) {
-                // If the block requires repeated executions, schedule the next one.
-                //
-                SPCPriorityQueueInsertElement(&this->_schedulerQueue, relativeTime + controlData->time_between_reps, controlData);
-            } else {
-                // Release the block on the main thread.
+            // Compute the time offset, and then execute the block.
+            //
+            UInt64 relativeTime = dueTimes[idx];
+            UInt64 eventTime    = this->_hostBaseTime + relativeTime;
+            UInt64 timeOffset   = (eventTime > inIntervalStart) ? (eventTime - inIntervalStart) : 0;
+
+            sched_control_data_t *controlData = (sched_control_data_t *)dueData[idx];
+            __unsafe_unretained SPCRealTimeSchedulerBlock executionBlock = (__bridge SPCRealTimeSchedulerBlock)(controlData->execution_block);
+            if (executionBlock) {
+                
+                // Run the block.
                 //
-                SPCMessageQueueDispatch(this->_responseQueue, SPReleaseSchedulerControlDataHandler, &controlData, sizeof(void *));
+                BOOL isLastRepetition = (--controlData->num_reps <= 0);
+                executionBlock(inIntervalStart, timeOffset, isLastRepetition);
+
+                if (!isLastRepetition) {
+                    // If the block requires repeated executions, schedule the next one. (The handle of the first run isn't
+                    // carried over, so a repeating block can't be cancelled or rescheduled once it has started.)
+                    //
+                    SPCPriorityQueueInsertElement(&this->_schedulerQueue, relativeTime + controlData->time_between_reps, controlData);
+                } else {
+                    // Release the block on the main thread, batched with the others finishing in this interval.
+                    //
+                    assert(this->_finishedControlDataCount < kReleaseBatchSize);
+                    this->_finishedControlData[this->_finishedControlDataCount++] = controlData;
+                }
             }
         }
-        
-        //
-        // Take a peek at the next one.
-        //
-        data = SPCPriorityQueuePeek_MPSC(&this->_schedulerQueue, &relativeTime);
     }
     
+    (void)flushFinishedControlData(this);
+    
     return noErr;
 }
 
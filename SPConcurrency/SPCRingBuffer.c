@@ -6,6 +6,10 @@
 //  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
 //
 
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
+
 #include "SPCRingBuffer.h"
 
 #ifndef DEBUG
@@ -13,13 +17,48 @@
 #endif
 
 #include <assert.h>
-#include <mach/mach.h>
 #include <stdio.h>
 
+#if defined __APPLE__
+#include <mach/mach.h>
+#elif defined __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "SPUtils.h"
 
 
 
+#pragma mark - Helpers
+
+
+
+/**
+ *  Round a length up to the nearest power of two, so that offsets can be computed by masking.
+ *  Page sizes are powers of two, so a page-rounded length stays page-rounded.
+ */
+static size_t roundToPowerOfTwo(size_t length)
+{
+    size_t result = 1;
+    while (result < length)
+        result <<= 1;
+    
+    return result;
+}
+
+
+
+#pragma mark - Darwin
+
+
+
+#if defined __APPLE__
+
+
 bool SPCRingBufferInit(SPCRingBuffer *buffer, size_t length)
 {
     assert(buffer);
@@ -29,7 +68,7 @@ bool SPCRingBufferInit(SPCRingBuffer *buffer, size_t length)
     int retries = 3;
     for (;;) {
         
-        buffer->_length = (int32_t) round_page(length);    // Allocate whole page sizes.
+        buffer->_length = roundToPowerOfTwo(round_page(length));    // Allocate whole page sizes.
         
         //
         // Temporarily allocate twice the length, so we have the contiguous address space to
@@ -109,9 +148,10 @@ bool SPCRingBufferInit(SPCRingBuffer *buffer, size_t length)
             continue;
         }
         
-        buffer->_buffer     = (void*) bufferAddress;
-        buffer->_fillCount  = 0;
-        buffer->_headOffset = buffer->_tailOffset = 0;
+        buffer->_buffer = (void*) bufferAddress;
+        buffer->_mask   = buffer->_length - 1;
+        buffer->_head   = buffer->_cachedHead = 0;
+        buffer->_tail   = buffer->_cachedTail = 0;
         
         return true;
     }
@@ -129,12 +169,123 @@ void SPCRingBufferDispose(SPCRingBuffer *buffer)
 }
 
 
-void SPCRingBufferClear(SPCRingBuffer *buffer)
+#endif
+
+
+
+#pragma mark - Linux
+
+
+
+#if defined __linux__
+
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+
+static int memfd_create(const char *name, unsigned int flags)
+{
+    return (int)syscall(SYS_memfd_create, name, flags);
+}
+#endif
+
+
+bool SPCRingBufferInit(SPCRingBuffer *buffer, size_t length)
 {
     assert(buffer);
     
-    size_t fillCount;
-    if (SPCRingBufferGetForRead(buffer, &fillCount)) {
-        SPCRingBufferMarkRead(buffer, fillCount);
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    buffer->_length = roundToPowerOfTwo((length + pageSize - 1) & ~(pageSize - 1));    // Allocate whole page sizes.
+    
+    //
+    // Back the buffer with an anonymous shared memory file, so that it can be mapped twice.
+    //
+    int fd = memfd_create("SPCRingBuffer", MFD_CLOEXEC);
+    if (fd < 0) {
+        STD_OUTPUT_ERROR("buffer file creation", strerror(errno));
+        return false;
+    }
+    
+    if (ftruncate(fd, (off_t)buffer->_length) != 0) {
+        STD_OUTPUT_ERROR("buffer file resize", strerror(errno));
+        close(fd);
+        return false;
     }
+    
+    // Keep trying until we get the buffer (needed to handle race conditions).
+    //
+    int retries = 3;
+    for (;;) {
+        
+        //
+        // Reserve twice the length, so we have the contiguous address space to
+        // support a second instance of the buffer directly after.
+        //
+        void *bufferAddress = mmap(NULL, buffer->_length * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufferAddress == MAP_FAILED) {
+            if (!retries--) {
+                STD_OUTPUT_ERROR("buffer allocation", strerror(errno));
+                close(fd);
+                return false;
+            }
+            continue; // Try again.
+        }
+        
+        //
+        // Map the file over both halves of the reservation. Since we own the whole reserved range,
+        // nobody else can take the second half from under us in the meantime.
+        //
+        void *virtualAddress = bufferAddress + buffer->_length;
+        if (mmap(bufferAddress,  buffer->_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != bufferAddress ||
+            mmap(virtualAddress, buffer->_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != virtualAddress) {
+            
+            munmap(bufferAddress, buffer->_length * 2);
+            if (!retries--) {
+                STD_OUTPUT_ERROR("remap buffer memory", strerror(errno));
+                close(fd);
+                return false;
+            }
+            continue; // Try again.
+        }
+        
+        // The mappings keep the file alive.
+        close(fd);
+        
+        buffer->_buffer = bufferAddress;
+        buffer->_mask   = buffer->_length - 1;
+        buffer->_head   = buffer->_cachedHead = 0;
+        buffer->_tail   = buffer->_cachedTail = 0;
+        
+        return true;
+    }
+    
+    return false;
+}
+
+
+void SPCRingBufferDispose(SPCRingBuffer *buffer)
+{
+    assert(buffer);
+    
+    munmap(buffer->_buffer, buffer->_length * 2);
+    memset(buffer, 0, sizeof(SPCRingBuffer));
+}
+
+
+#endif
+
+
+
+#pragma mark - Common
+
+
+
+
+void SPCRingBufferClear(SPCRingBuffer *buffer)
+{
+    assert(buffer);
+    
+    // Synchronize with the producer once, and drop everything written up to that point.
+    buffer->_cachedHead = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_head, SPC_MEMORY_ORDER_ACQUIRE));
+    SPCRingBufferMarkRead(buffer, buffer->_cachedHead - buffer->_tail);
 }
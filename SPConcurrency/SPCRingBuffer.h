@@ -28,15 +28,26 @@
  *  A wait-free ring buffer structure. 
  *
  *  Guaranteed to be thread-safe and reentrant in an SPSC (single-producer, single-consumer) model.
+ *
+ *  The producer and the consumer only write to their own index, and each index lives on its own cache line.
+ *  Both indices are free-running byte counts, masked with the (power of two) length to get offsets.
+ *  Each side keeps a cached copy of the other side's index, and only reloads it when the cached value
+ *  is not sufficient, so that in the common case neither side touches the other's cache line.
  */
 
 struct SPCRingBuffer {
     void            *_buffer;
     size_t           _length;
-    size_t           _tailOffset;
-    size_t           _headOffset;
-    volatile size_t  _fillCount;
-};
+    size_t           _mask;
+    
+    // Producer side.
+    volatile size_t  _head SPC_CACHE_LINE_ALIGNED;
+    size_t           _cachedTail;
+    
+    // Consumer side.
+    volatile size_t  _tail SPC_CACHE_LINE_ALIGNED;
+    size_t           _cachedHead;
+} SPC_CACHE_LINE_ALIGNED;
 
 typedef struct SPCRingBuffer SPCRingBuffer;
 
@@ -46,7 +57,7 @@ typedef struct SPCRingBuffer SPCRingBuffer;
  *  Init a ring buffer.
  *
  *  @param buffer A pointer to the buffer.
- *  @param length The buffer length. (More memory may actually be allocated.)
+ *  @param length The buffer length. (Rounded up to a power of two no smaller than a page; more memory may actually be allocated.)
  *
  *  @return true if successful; false, otherwise.
  */
@@ -72,6 +83,9 @@ void SPCRingBufferClear(SPCRingBuffer *buffer);
 /**
  *  Access the buffer tail for reading.
  *
+ *  The number of bytes reported may be smaller than the number actually written, if the producer wrote more
+ *  since the last time the consumer synchronized with it, but it will always be a sum of whole written chunks.
+ *
  *  @param buffer         A pointer to a ring buffer.
  *  @param availableBytes The number of bytes ready for reading.
  *
@@ -81,9 +95,17 @@ static FORCE_INLINE void *SPCRingBufferGetForRead(SPCRingBuffer *buffer, size_t
 {
     assert(buffer && availableBytes);
     
-    *availableBytes = (size_t)(SPC_ATOMIC_LOAD(&buffer->_fillCount));
+    const size_t tail = buffer->_tail;
+    
+    *availableBytes = buffer->_cachedHead - tail;
+    if (!*availableBytes) {
+        // Acquire the producer's writes to the chunk.
+        buffer->_cachedHead = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_head, SPC_MEMORY_ORDER_ACQUIRE));
+        *availableBytes = buffer->_cachedHead - tail;
+    }
+    
     if (*availableBytes)
-        return (void *)((char *)(buffer->_buffer + buffer->_tailOffset));
+        return (void *)((char *)(buffer->_buffer + (tail & buffer->_mask)));
     
     return NULL;
 }
@@ -98,35 +120,60 @@ static FORCE_INLINE void *SPCRingBufferGetForRead(SPCRingBuffer *buffer, size_t
 static FORCE_INLINE void SPCRingBufferMarkRead(SPCRingBuffer *buffer, size_t bytesRead)
 {
     assert(buffer);
+    assert(bytesRead <= buffer->_cachedHead - buffer->_tail);
     
-    buffer->_tailOffset = (buffer->_tailOffset + bytesRead) % buffer->_length;
-    SPC_MEMORY_BARRIER_STORE();
-    SPC_ATOMIC_FETCH_AND_ADD(&buffer->_fillCount, -bytesRead);
-    
-    assert((size_t)(SPC_ATOMIC_LOAD(&buffer->_fillCount)) >= 0);
+    // Release our reads of the chunk before the producer may overwrite it.
+    SPC_ATOMIC_STORE_EXPLICIT(&buffer->_tail, buffer->_tail + bytesRead, SPC_MEMORY_ORDER_RELEASE);
 }
 
 
 /**
- *  Access the head of the buffer for writing.
+ *  Access the head of the buffer for writing, making sure a minimum number of bytes is available.
  *
  *  @param buffer         A pointer to a ring buffer.
+ *  @param minimumBytes   The minimum number of bytes needed.
  *  @param availableBytes The number of bytes available for writing.
  *
- *  @return A pointer to the chunk of data available for writing; NULL if the buffer is full.
+ *  @return A pointer to the chunk of data available for writing; NULL if less than minimumBytes are available.
  */
-static FORCE_INLINE void *SPCRingBufferGetForWrite(SPCRingBuffer *buffer, size_t *availableBytes)
+static FORCE_INLINE void *SPCRingBufferGetForWriteMinimum(SPCRingBuffer *buffer, size_t minimumBytes, size_t *availableBytes)
 {
     assert(buffer && availableBytes);
+    assert(minimumBytes > 0);
     
-    *availableBytes = (buffer->_length - (size_t)(SPC_ATOMIC_LOAD(&buffer->_fillCount)));
-    if (*availableBytes)
-        return (void *)((char *)(buffer->_buffer + buffer->_headOffset));
+    const size_t head = buffer->_head;
+    
+    *availableBytes = buffer->_length - (head - buffer->_cachedTail);
+    if (*availableBytes < minimumBytes) {
+        // Acquire the consumer's reads of the chunk, so that we do not overwrite it too early.
+        buffer->_cachedTail = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_tail, SPC_MEMORY_ORDER_ACQUIRE));
+        *availableBytes = buffer->_length - (head - buffer->_cachedTail);
+    }
+    
+    if (*availableBytes >= minimumBytes)
+        return (void *)((char *)(buffer->_buffer + (head & buffer->_mask)));
     
     return NULL;
 }
 
 
+/**
+ *  Access the head of the buffer for writing.
+ *
+ *  The number of bytes reported may be smaller than the number actually free, if the consumer read more since
+ *  the last time the producer synchronized with it. Use SPCRingBufferGetForWriteMinimum() to ask for a given size.
+ *
+ *  @param buffer         A pointer to a ring buffer.
+ *  @param availableBytes The number of bytes available for writing.
+ *
+ *  @return A pointer to the chunk of data available for writing; NULL if the buffer is full.
+ */
+static FORCE_INLINE void *SPCRingBufferGetForWrite(SPCRingBuffer *buffer, size_t *availableBytes)
+{
+    return SPCRingBufferGetForWriteMinimum(buffer, 1, availableBytes);
+}
+
+
 /**
  *  Mark a chunk of bytes in a buffer as written, making them available for reading.
  *
@@ -136,12 +183,187 @@ static FORCE_INLINE void *SPCRingBufferGetForWrite(SPCRingBuffer *buffer, size_t
 static FORCE_INLINE void SPCRingBufferMarkWritten(SPCRingBuffer *buffer, size_t bytesWritten)
 {
     assert(buffer);
+    assert(bytesWritten <= buffer->_length - (buffer->_head - buffer->_cachedTail));
+    
+    // Publish the chunk to the consumer.
+    SPC_ATOMIC_STORE_EXPLICIT(&buffer->_head, buffer->_head + bytesWritten, SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+
+#pragma mark - MPSC methods
+
+
+
+//
+// In the MPSC (multi-producer, single-consumer) model, producers reserve chunks by advancing the head
+// with a CAS, and commit them by storing a (non-zero) header word in front of the chunk. The consumer reads
+// chunks in reservation order and stops at the first one whose header is still zero, i.e. not yet committed.
+// It zeroes every chunk after reading it, so the free part of the buffer is always zero-filled.
+//
+// The MPSC methods must not be mixed with the SPSC ones on the same buffer.
+//
+
+
+/**
+ *  Get the length of a chunk including its header, rounded up to keep headers word-aligned.
+ */
+static FORCE_INLINE size_t SPC__RingBufferRecordLength(size_t bytes)
+{
+    return sizeof(size_t) + ((bytes + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1));
+}
+
+
+/**
+ *  Check if a chunk fits between a head and a tail sampled by a producer.
+ *
+ *  The shared cached tail can lag by more than a lap, and a fresh tail can be ahead of a stale head,
+ *  so the distance is compared as a signed value instead of computing the free space.
+ */
+static FORCE_INLINE bool SPC__RingBufferHasSpace(SPCRingBuffer *buffer, size_t head, size_t tail, size_t recordLength)
+{
+    return (ptrdiff_t)(head - tail) + (ptrdiff_t)recordLength <= (ptrdiff_t)buffer->_length;
+}
+
+
+/**
+ *  Reserve a chunk of bytes for writing.
+ *
+ *  Valid for MPSC (multi-producer, single-consumer) model only.
+ *
+ *  @param buffer A pointer to a ring buffer.
+ *  @param bytes  The number of bytes to reserve.
+ *
+ *  @return A pointer to the reserved chunk; NULL if there is not enough space in the buffer.
+ */
+static FORCE_INLINE void *SPCRingBufferReserveForWrite_MPSC(SPCRingBuffer *buffer, size_t bytes)
+{
+    assert(buffer);
+    
+    const size_t recordLength = SPC__RingBufferRecordLength(bytes);
+    
+    for (;;) {
+        size_t head = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_head, SPC_MEMORY_ORDER_RELAXED));
+        size_t tail = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_cachedTail, SPC_MEMORY_ORDER_ACQUIRE));
+        
+        if (!SPC__RingBufferHasSpace(buffer, head, tail, recordLength)) {
+            // Acquire the consumer's clearing of the chunk, and share it with the other producers.
+            tail = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(&buffer->_tail, SPC_MEMORY_ORDER_ACQUIRE));
+            if (!SPC__RingBufferHasSpace(buffer, head, tail, recordLength))
+                return NULL;
+            
+            SPC_ATOMIC_STORE_EXPLICIT(&buffer->_cachedTail, tail, SPC_MEMORY_ORDER_RELEASE);
+        }
+        
+        // The chunk is published by its header, so the reservation itself needs no ordering.
+        if (SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&buffer->_head, head, head + recordLength, SPC_MEMORY_ORDER_RELAXED)) {
+            size_t *header = (size_t *)(buffer->_buffer + (head & buffer->_mask));
+            assert(!*header);
+            
+            return header + 1;
+        }
+        
+        SPC_STALL();
+    }
+}
+
+
+/**
+ *  Commit a reserved chunk, making it available for reading.
+ *
+ *  Valid for MPSC (multi-producer, single-consumer) model only.
+ *
+ *  @param buffer A pointer to a ring buffer.
+ *  @param chunk  A chunk returned by SPCRingBufferReserveForWrite_MPSC().
+ *  @param bytes  The number of bytes the chunk was reserved with.
+ */
+static FORCE_INLINE void SPCRingBufferCommitWrite_MPSC(SPCRingBuffer *buffer, void *chunk, size_t bytes)
+{
+    assert(buffer && chunk);
+    (void)buffer;
+    
+    // Publish the chunk to the consumer.
+    SPC_ATOMIC_STORE_EXPLICIT((size_t *)(chunk) - 1, SPC__RingBufferRecordLength(bytes), SPC_MEMORY_ORDER_RELEASE);
+}
+
+
+/**
+ *  Access the next committed chunk for reading.
+ *
+ *  Valid for MPSC (multi-producer, single-consumer) model only.
+ *
+ *  @param buffer         A pointer to a ring buffer.
+ *  @param availableBytes The size of the chunk (the reserved size rounded up to a multiple of the word size).
+ *
+ *  @return A pointer to the chunk; NULL if the next chunk is not committed yet or the buffer is empty.
+ */
+static FORCE_INLINE void *SPCRingBufferGetForRead_MPSC(SPCRingBuffer *buffer, size_t *availableBytes)
+{
+    assert(buffer && availableBytes);
+    
+    size_t *header = (size_t *)(buffer->_buffer + (buffer->_tail & buffer->_mask));
+    
+    // Acquire the producer's writes to the chunk.
+    const size_t recordLength = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT(header, SPC_MEMORY_ORDER_ACQUIRE));
+    if (!recordLength) {
+        *availableBytes = 0;
+        return NULL;
+    }
+    
+    *availableBytes = recordLength - sizeof(size_t);
+    return header + 1;
+}
+
+
+/**
+ *  Count the committed chunks waiting to be read, up to the first one that is not committed yet.
+ *
+ *  Valid for MPSC (multi-producer, single-consumer) model only. Walks the chunk headers, so it takes time
+ *  proportional to the count.
+ *
+ *  @param buffer A pointer to a ring buffer.
+ *
+ *  @return The number of chunks.
+ */
+static FORCE_INLINE size_t SPCRingBufferGetCommittedCount_MPSC(SPCRingBuffer *buffer)
+{
+    assert(buffer);
+    
+    size_t count = 0;
+    size_t tail  = buffer->_tail;
+    size_t recordLength;
+    
+    // A full buffer has no zero header to stop at, so stop after a lap.
+    while (tail - buffer->_tail < buffer->_length &&
+           (recordLength = (size_t)(SPC_ATOMIC_LOAD_EXPLICIT((size_t *)(buffer->_buffer + (tail & buffer->_mask)),
+                                                             SPC_MEMORY_ORDER_ACQUIRE)))) {
+        tail += recordLength;
+        ++count;
+    }
+    
+    return count;
+}
+
+
+/**
+ *  Mark the chunk returned by the last SPCRingBufferGetForRead_MPSC() as read, clearing it and making it available for writing.
+ *
+ *  Valid for MPSC (multi-producer, single-consumer) model only.
+ *
+ *  @param buffer A pointer to a ring buffer.
+ */
+static FORCE_INLINE void SPCRingBufferMarkReadAndClear_MPSC(SPCRingBuffer *buffer)
+{
+    assert(buffer);
+    
+    size_t *header = (size_t *)(buffer->_buffer + (buffer->_tail & buffer->_mask));
+    const size_t recordLength = *header;
+    assert(recordLength);
     
-    buffer->_headOffset = (buffer->_headOffset + bytesWritten) % buffer->_length;
-    SPC_MEMORY_BARRIER_STORE();
-    SPC_ATOMIC_FETCH_AND_ADD(&buffer->_fillCount, bytesWritten);
+    memset(header, 0, recordLength);
     
-    assert((size_t)(SPC_ATOMIC_LOAD(&buffer->_fillCount)) <= buffer->_length);
+    // Release the cleared chunk to the producers.
+    SPC_ATOMIC_STORE_EXPLICIT(&buffer->_tail, buffer->_tail + recordLength, SPC_MEMORY_ORDER_RELEASE);
 }
 
 
@@ -13,3 +13,6 @@
 #import <SPConcurrency/SPCLockFreeList.h>
 #import <SPConcurrency/SPCPriorityQueue.h>
 #import <SPConcurrency/SPCRingBuffer.h>
+#import <SPConcurrency/SPCFutex.h>
+#import <SPConcurrency/SPCContention.h>
+#import <SPConcurrency/SPCMessageEngine.h>
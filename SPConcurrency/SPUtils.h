@@ -10,7 +10,9 @@
 #define PZ_SPUtils_h
 
 
+#ifdef __APPLE__
 #include <MacTypes.h>
+#endif
 #include <pthread.h>
 
 #ifndef DEBUG
@@ -28,12 +30,18 @@
 #ifdef DEBUG
 # ifdef __OBJC__
 #  define DLog(fmt, ...) NSLog((@"%s:%d:%s: " fmt), strrchr(__FILE__, '/') + 1, __LINE__, __PRETTY_FUNCTION__, ##__VA_ARGS__)
-# else
+# elif defined __APPLE__
 #  define DLog(fmt, ...)                                                                                                   \
    do {                                                                                                                    \
        mach_port_t tid = pthread_mach_thread_np(pthread_self());                                                           \
        fprintf(stderr, ("%s:%d:[%d]:%s: " fmt "\n"), strrchr(__FILE__, '/') + 1, __LINE__, tid,  __func__, ##__VA_ARGS__); \
    } while (0)
+# else
+#  define DLog(fmt, ...)                                                                                                                 \
+   do {                                                                                                                                  \
+       unsigned long tid = (unsigned long)pthread_self();                                                                                \
+       fprintf(stderr, ("%s:%d:[%lx]:%s: " fmt "\n"), strrchr(__FILE__, '/') + 1, __LINE__, tid,  __func__, ##__VA_ARGS__);            \
+   } while (0)
 # endif
 #else
 # define DLog(...)
@@ -81,6 +89,8 @@
 
 
 
+#ifdef __APPLE__
+
 //
 // OSStatus handling.
 //
@@ -100,14 +110,19 @@ do {
 
 void SPHandleOSStatus(OSStatus error, const char *operation, const char* func, const char* file, int line);
 
+#endif
 
-//
-// kern_return_t handling.
-//
 
 #define STD_OUTPUT_ERROR(operation, errorString) \
     (fprintf(stderr, "%s:%d:%s: Error in %s (%s)\n", strrchr(__FILE__, '/') + 1, __LINE__, __PRETTY_FUNCTION__, (operation), (errorString)))
 
+
+#ifdef __APPLE__
+
+//
+// kern_return_t handling.
+//
+
 #define HANDLE_KERN_ERROR_AND_CLEANUP(operation, result, cleanupBlock)                                          \
 do {                                                                                                            \
     kern_return_t __return = (result);                                                                          \
@@ -118,12 +133,16 @@ do {
 
 #define HANDLE_KERN_ERROR(operation, result) HANDLE_KERN_ERROR_AND_CLEANUP(operation, result, {})
 
+#endif
+
 
 //
 // Misc.
 //
 
+#ifdef __APPLE__
 double SPUMachHostTicksToSeconds();
+#endif
 
 
 #define IS_PTR_ALIGNED_TO(ptr, byte_count) (((uintptr_t)(const void *)(ptr)) % (byte_count) == 0)
@@ -137,6 +137,38 @@ const size_t kDefaultListSize = 4096;
 }
 
 
+- (void)testGrowsBeyondItsLength
+{
+    SPCLockFreeList list;
+    
+    const size_t initialNumElems = 4;
+    const size_t slabLength = 8, reserveLength = 16;
+    const size_t totalNumElems = initialNumElems + slabLength * reserveLength;
+    XCTAssertTrue(SPCLockFreeListInit(&list, initialNumElems));
+    XCTAssertTrue(SPCLockFreeListEnableGrowth(&list, slabLength, reserveLength));
+    
+    for (long numElem = 1; numElem <= totalNumElems; ++numElem)
+        XCTAssertTrue(SPCLockFreeListInsertElement(&list, numElem, (void *)(sizeof(void *) * numElem)),
+                      @"Can't insert element into list.");
+    
+    XCTAssertFalse(SPCLockFreeListInsertElement(&list, totalNumElems + 1, (void *)(sizeof(void *))),
+                   @"Another element was inserted into a list with an empty reserve.");
+    
+    XCTAssertTrue(SPCLockFreeListReplenishGrowthReserve(&list));
+    XCTAssertTrue(SPCLockFreeListInsertElement(&list, totalNumElems + 1, (void *)(sizeof(void *))),
+                  @"Can't insert element into list after replenishing its reserve.");
+    
+    long prevKey = 0, key;
+    while (SPCLockFreeListExtractMinimumElement(&list, &key)) {
+        XCTAssertTrue(key == prevKey + 1, @"List returns wrong element.");
+        prevKey = key;
+    }
+    XCTAssertTrue(prevKey == totalNumElems + 1, @"List lost elements.");
+    
+    SPCLockFreeListDispose(&list);
+}
+
+
 - (void)testParallelInsertAndDelete
 {
     [self runParallelInsertAndDeleteForNumberOfElems:5 numberOfThreads:1 numberOfRuns:100];
@@ -223,4 +255,200 @@ const size_t kDefaultListSize = 4096;
 }
 
 
+
+#pragma mark - Reclamation schemes
+
+
+
+- (void)runParallelInsertAndDeleteWithReclamationScheme:(SPCMemoryReclamationScheme)scheme
+                                           magazineSize:(size_t)magazineSize
+{
+    const size_t numElems = 64, numThreads = 16;
+    
+    for (int reps = 0; reps < 50; ++reps) {
+        __block SPCLockFreeList list;
+        
+        // Every thread may strand a full magazine of nodes.
+        XCTAssertTrue(SPCLockFreeListInitWithReclamationScheme(&list,
+                                                               numElems * numThreads + 2 * numThreads * magazineSize,
+                                                               scheme));
+        if (magazineSize)
+            XCTAssertTrue(SPCLockFreeListEnableMagazines(&list, magazineSize));
+        
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+        
+        dispatch_suspend(queue);
+        
+        // Insert and delete.
+        for (int iter = 1; iter <= numThreads; ++iter) {
+            dispatch_group_async(group, queue, ^{
+                [self fillListWithOrderedElements:&list
+                                     startingFrom:1
+                                             upTo:numElems];
+            });
+            dispatch_group_async(group, queue, ^{
+                for (int numElem = 0; numElem < numElems * 2; ++numElem)
+                    (void)SPCLockFreeListExtractMinimumElement(&list, NULL);
+            });
+        }
+        
+        dispatch_resume(queue);
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        
+        // Whatever is left is still in order.
+        long prevKey = LONG_MIN, key;
+        while (SPCLockFreeListExtractMinimumElement(&list, &key)) {
+            XCTAssertTrue(prevKey < key, @"List does not enforce priorities.");
+            prevKey = key;
+        }
+        
+        SPCLockFreeListDispose(&list);
+    }
+}
+
+
+- (void)testParallelInsertAndDeleteWithHazardPointers
+{
+    [self runParallelInsertAndDeleteWithReclamationScheme:kSPCMemoryReclamationHazardPointers magazineSize:0];
+}
+
+
+- (void)testParallelInsertAndDeleteWithEpochs
+{
+    [self runParallelInsertAndDeleteWithReclamationScheme:kSPCMemoryReclamationEpochs magazineSize:0];
+}
+
+
+- (void)testParallelInsertAndDeleteWithMagazines
+{
+    [self runParallelInsertAndDeleteWithReclamationScheme:kSPCMemoryReclamationReferenceCounting magazineSize:16];
+}
+
+
+static NSString *reclamationSchemeName(SPCMemoryReclamationScheme scheme)
+{
+    switch (scheme) {
+        case kSPCMemoryReclamationHazardPointers: return @"hazard pointers";
+        case kSPCMemoryReclamationEpochs:         return @"epochs";
+        default:                                  return @"reference counting";
+    }
+}
+
+
+static const size_t kBenchmarkNumElems        = 128;
+static const size_t kBenchmarkNumOpsPerThread = 10000;
+static const size_t kBenchmarkMaxNumThreads   = 32;
+
+
+/**
+ *  Run a mix of minimum extractions (put back further down the list) and lookups of missing keys behind them.
+ *
+ *  @return The elapsed time.
+ */
+- (NSTimeInterval)runMixWithExtractPercentage:(unsigned int)extractPercentage
+                            reclamationScheme:(SPCMemoryReclamationScheme)scheme
+                              numberOfThreads:(size_t)numThreads
+{
+    __block SPCLockFreeList list;
+    XCTAssertTrue(SPCLockFreeListInitWithReclamationScheme(&list,
+                                                           2 * kBenchmarkNumElems + numThreads * (kCMemRetiredSlotCount + 1),
+                                                           scheme));
+    
+    const long fixedBandStart = LONG_MAX / 2;
+    
+    [self fillListWithOrderedElements:&list startingFrom:1 upTo:kBenchmarkNumElems];
+    for (long key = fixedBandStart; key < fixedBandStart + 2 * (long)kBenchmarkNumElems; key += 2)
+        SPCLockFreeListInsertElement(&list, key, (void *)(sizeof(void *)));
+    
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+    
+    dispatch_suspend(queue);
+    
+    for (size_t iter = 0; iter < numThreads; ++iter) {
+        dispatch_group_async(group, queue, ^{
+            unsigned int seed = (unsigned int)iter + 1;
+            
+            for (size_t op = 0; op < kBenchmarkNumOpsPerThread; ++op) {
+                seed = seed * 1103515245 + 12345;
+                
+                if ((seed >> 16) % 100 < extractPercentage) {
+                    long key;
+                    void *data = SPCLockFreeListExtractMinimumElement(&list, &key);
+                    if (data)
+                        SPCLockFreeListInsertElement(&list, key + kBenchmarkNumElems, data);
+                } else
+                    (void)SPCLockFreeListExtractElementWithKey(&list, fixedBandStart + 2 * ((seed >> 16) % kBenchmarkNumElems) + 1);
+            }
+        });
+    }
+    
+    NSDate *startDate = [NSDate date];
+    
+    dispatch_resume(queue);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    NSTimeInterval elapsed = -[startDate timeIntervalSinceNow];
+    
+    SPCLockFreeListDispose(&list);
+    
+    return elapsed;
+}
+
+
+- (void)measureMixWithExtractPercentage:(unsigned int)extractPercentage
+                      reclamationScheme:(SPCMemoryReclamationScheme)scheme
+{
+    [self measureBlock:^{
+        for (size_t numThreads = 1; numThreads <= kBenchmarkMaxNumThreads; numThreads *= 2) {
+            NSTimeInterval elapsed = [self runMixWithExtractPercentage:extractPercentage
+                                                     reclamationScheme:scheme
+                                                       numberOfThreads:numThreads];
+            NSLog(@"%u%% extractions, %@, %zu threads: %.0f ns/op",
+                  extractPercentage,
+                  reclamationSchemeName(scheme),
+                  numThreads,
+                  elapsed * 1e9 / (numThreads * kBenchmarkNumOpsPerThread));
+        }
+    }];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithReferenceCounting
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationReferenceCounting];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithHazardPointers
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationHazardPointers];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithReferenceCounting
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationReferenceCounting];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithHazardPointers
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationHazardPointers];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithEpochs
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationEpochs];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithEpochs
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationEpochs];
+}
+
+
 @end
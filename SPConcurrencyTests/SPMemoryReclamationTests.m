@@ -9,6 +9,10 @@
 #import <XCTest/XCTest.h>
 
 
+// Count the compare-and-swaps of the (inlined) free list functions used here, whether or not the library itself
+// is built with contention statistics.
+#define SPC_CONTENTION_STATS 1
+
 #include "SPUtils.h"
 #include "SPCPrimitives.h"
 #include "SPCMemoryReclamation.h"
@@ -181,5 +185,84 @@ const size_t kNumElems = 512;
 }
 
 
+- (void)testCountsContention
+{
+    SPCContentionCounters counters;
+    
+    SPCContentionReset();
+    SPCContentionSnapshotThread(&counters);
+    XCTAssertTrue(counters._casAttempts[kSPCContentionSiteFreeListPush] == 0 && counters._casFailures[kSPCContentionSiteFreeListPush] == 0,
+                  @"Counters should start from zero after a reset.");
+    
+    // A compare-and-swap against a stale value always fails.
+    volatile long word = 1;
+    for (int iter = 0; iter < 10; ++iter)
+        XCTAssertFalse(SPC_CONTENTION_CAS(kSPCContentionSiteFreeListPush, SPC_ATOMIC_COMPARE_AND_SWAP_EXPLICIT(&word, 0, 2, SPC_MEMORY_ORDER_RELAXED)),
+                       @"Compare-and-swap should fail.");
+    
+    // Without other threads, every node is popped and pushed exactly once, and the last allocation finds the list empty.
+    [self allocAndReleaseElements:kNumElems checkIfEmpty:YES];
+    
+    SPCContentionSnapshotThread(&counters);
+    XCTAssertTrue(counters._casAttempts[kSPCContentionSiteFreeListPop] == kNumElems && counters._casFailures[kSPCContentionSiteFreeListPop] == 0,
+                  @"Uncontended pops should be counted once each.");
+    XCTAssertTrue(counters._casAttempts[kSPCContentionSiteFreeListPush] == kNumElems + 10 && counters._casFailures[kSPCContentionSiteFreeListPush] == 10,
+                  @"Failed pushes should be counted.");
+    XCTAssertTrue(counters._events[kSPCContentionEventPoolExhausted] == 1, @"Running out of nodes should be counted.");
+    
+    // Push and pop from many threads at once. Whether any of their compare-and-swaps fail depends on scheduling,
+    // so only the counts that don't are checked, relative to the counters before.
+    SPCContentionCounters countersBefore;
+    SPCContentionSnapshot(&countersBefore);
+    
+    const size_t numThreads = 64;
+    
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestContention", DISPATCH_QUEUE_CONCURRENT);
+    
+    dispatch_suspend(queue);
+    for (int iter = 0; iter < numThreads; ++iter) {
+        dispatch_group_async(group, queue, ^{
+            for (int reps = 0; reps < 100; ++reps)
+                [self allocAndReleaseElements:kNumElems / numThreads checkIfEmpty:NO];
+        });
+    }
+    dispatch_resume(queue);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    // The snapshot adds up all threads, including the ones that have exited.
+    SPCContentionSnapshot(&counters);
+    const uint64_t numAttempts = counters._casAttempts[kSPCContentionSiteFreeListPush] - countersBefore._casAttempts[kSPCContentionSiteFreeListPush];
+    const uint64_t numFailures = counters._casFailures[kSPCContentionSiteFreeListPush] - countersBefore._casFailures[kSPCContentionSiteFreeListPush];
+    XCTAssertTrue(numAttempts - numFailures >= 100 * kNumElems, @"Pushes of all threads should be counted.");
+    
+    SPCContentionReset();
+    SPCContentionSnapshot(&counters);
+    for (size_t idx = 0; idx < kSPCContentionSiteCount; ++idx)
+        XCTAssertTrue(!counters._casAttempts[idx] && !counters._casFailures[idx], @"A reset should clear the counters of all threads.");
+    for (size_t idx = 0; idx < kSPCContentionEventCount; ++idx)
+        XCTAssertTrue(!counters._events[idx], @"A reset should clear the counters of all threads.");
+}
+
+
+- (void)testPerformanceAllocNode
+{
+    [self measureBlock:^{
+        for (int reps = 0; reps < 1000000; ++reps) {
+
+            SPTestNode *allocElem = cmem_allocNode((void *volatile *)(&_freeList),
+                                                   offsetof(SPTestNode, _cmem_refCount_c),
+                                                   offsetof(SPTestNode, _next_d));
+            cmem_releaseNode(allocElem,
+                             offsetof(SPTestNode, _cmem_refCount_c),
+                             offsetof(SPTestNode, _next_d),
+                             1,
+                             -1,
+                             (void *volatile *)(&_freeList));
+        }
+    }];
+}
+
+
 
 @end
@@ -0,0 +1,102 @@
+//
+//  SPMessageEngineTests.m
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 06/01/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#include <poll.h>
+
+#include "SPCMessageEngine.h"
+
+
+
+@interface SPMessageEngineTests : XCTestCase
+{
+    SPCMessageEngine _engine;
+}
+
+@end
+
+
+static const size_t kEngineBufferLength = 16384;
+
+static size_t numHandledMessages;
+
+
+static void countMessageHandler(void *userInfo, size_t userInfoLength)
+{
+    (void)userInfo;
+    (void)userInfoLength;
+
+    ++numHandledMessages;
+}
+
+
+/**
+ *  Whether a descriptor is readable right now, without waiting.
+ */
+static bool isReadable(int descriptor)
+{
+    struct pollfd pollDescriptor = { .fd = descriptor, .events = POLLIN };
+
+    return poll(&pollDescriptor, 1, 0) == 1 && (pollDescriptor.revents & POLLIN);
+}
+
+
+
+@implementation SPMessageEngineTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    numHandledMessages = 0;
+
+    XCTAssertTrue(SPCMessageEngineInit(&_engine, "com.pzhivkov.testMessageEngine", kEngineBufferLength), @"Message engine can't be initialized.");
+}
+
+- (void)tearDown
+{
+    SPCMessageEngineDispose(&_engine);
+    [super tearDown];
+}
+
+
+
+- (void)testDrainsWithinBudgetWhileDescriptorStaysReadable
+{
+    const size_t numMessages = 10;
+    const size_t budget      = 4;
+
+    int descriptor = SPCMessageEngineOpenEventDescriptor(&_engine);
+    XCTAssertTrue(descriptor >= 0, @"Event descriptor can't be opened.");
+    XCTAssertTrue(!isReadable(descriptor), @"Descriptor shouldn't be readable without pending messages.");
+
+    for (size_t idx = 0; idx < numMessages; ++idx)
+        SPCMessageEngineDispatch(&_engine, countMessageHandler, &idx, sizeof(idx));
+
+    XCTAssertTrue(isReadable(descriptor), @"Descriptor should be readable with pending messages.");
+
+    // Every pass but the last one uses up the whole budget, and leaves the descriptor readable for the rest.
+    size_t numDrained = 0;
+    while (numMessages - numDrained > budget) {
+        XCTAssertTrue(SPCMessageEngineDrain(&_engine, budget) == budget, @"Draining should process exactly the budget.");
+        numDrained += budget;
+
+        XCTAssertTrue(numHandledMessages == numDrained, @"Draining should run exactly the messages it reports.");
+        XCTAssertTrue(isReadable(descriptor), @"Descriptor should stay readable while messages are left.");
+    }
+
+    XCTAssertTrue(SPCMessageEngineDrain(&_engine, budget) == numMessages - numDrained, @"The last pass should process what is left.");
+    XCTAssertTrue(numHandledMessages == numMessages, @"Every message should run exactly once.");
+    XCTAssertTrue(!isReadable(descriptor), @"Descriptor shouldn't be readable once the engine is drained.");
+
+    XCTAssertTrue(SPCMessageEngineDrain(&_engine, budget) == 0, @"A drained engine has nothing to process.");
+    XCTAssertTrue(!isReadable(descriptor), @"Descriptor shouldn't become readable again by itself.");
+}
+
+@end
@@ -0,0 +1,156 @@
+//
+//  SPMessageQueueTests.m
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 06/01/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "SPCMessageQueue.h"
+
+
+
+struct test_message_t {
+    uint64_t sequence;
+    uint64_t padding[5];
+};
+
+typedef struct test_message_t test_message_t;
+
+
+static volatile long numHandledMessages;
+
+
+static void countMessageHandler(void *refCon, size_t refConSize)
+{
+    (void)refCon;
+    (void)refConSize;
+
+    __atomic_fetch_add(&numHandledMessages, 1, __ATOMIC_RELAXED);
+}
+
+
+
+@interface SPMessageQueueTests : XCTestCase
+{
+    SPCMessageQueue *_messageQueue;
+}
+
+@end
+
+
+
+@implementation SPMessageQueueTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    numHandledMessages = 0;
+
+    // The queue isn't started, so messages stay in it until it is flushed.
+    _messageQueue = [[SPCMessageQueue alloc] initWithName:@"com.pzhivkov.testMessageQueue"];
+    XCTAssertNotNil(_messageQueue, @"Message queue can't be initialized.");
+}
+
+- (void)tearDown
+{
+    _messageQueue = nil;
+    [super tearDown];
+}
+
+
+
+/**
+ *  Fill the queue up, and return the number of messages that fit.
+ */
+- (size_t)fillQueue
+{
+    test_message_t message = { .sequence = 0 };
+
+    while (SPCMessageQueueTryDispatch(_messageQueue, countMessageHandler, &message, sizeof(message)) == kSPCMessageQueueDispatchQueued)
+        ++message.sequence;
+
+    return (size_t)message.sequence;
+}
+
+
+- (void)testTryDispatchReportsFullQueue
+{
+    size_t numQueued = [self fillQueue];
+    XCTAssertTrue(numQueued > 0, @"Queue should have space for messages.");
+
+    // Filling the queue up has already dropped one message.
+    XCTAssertTrue(_messageQueue.droppedMessageCount == 1, @"A message that didn't fit should be counted.");
+
+    test_message_t message = { .sequence = numQueued };
+    for (int iter = 0; iter < 10; ++iter)
+        XCTAssertTrue(SPCMessageQueueTryDispatch(_messageQueue, countMessageHandler, &message, sizeof(message)) == kSPCMessageQueueDispatchFull,
+                      @"A full queue should refuse messages.");
+
+    XCTAssertTrue(_messageQueue.droppedMessageCount == 11, @"Every message that didn't fit should be counted.");
+
+    // Flushing runs the queued messages, and makes space again.
+    [_messageQueue flushQueue];
+    XCTAssertTrue(numHandledMessages == numQueued, @"Flushing should run every queued message, and only those.");
+
+    XCTAssertTrue(SPCMessageQueueTryDispatch(_messageQueue, countMessageHandler, &message, sizeof(message)) == kSPCMessageQueueDispatchQueued,
+                  @"A flushed queue should take messages again.");
+    XCTAssertTrue(_messageQueue.droppedMessageCount == 11, @"A queued message shouldn't be counted as dropped.");
+}
+
+
+- (void)testDispatchWaitingTimesOutOnFullQueue
+{
+    size_t numQueued = [self fillQueue];
+    NSUInteger numDropped = _messageQueue.droppedMessageCount;
+
+    const NSTimeInterval timeout = 0.2;
+    test_message_t message = { .sequence = numQueued };
+
+    NSDate *startDate = [NSDate date];
+    SPCMessageQueueDispatchStatus status = SPCMessageQueueDispatchWaiting(_messageQueue, countMessageHandler, &message, sizeof(message), timeout);
+    NSTimeInterval elapsed = -[startDate timeIntervalSinceNow];
+
+    XCTAssertTrue(status == kSPCMessageQueueDispatchFull, @"Waiting on a queue that nobody flushes should time out.");
+    XCTAssertTrue(elapsed >= timeout && elapsed < timeout + 1.0, @"Waiting should last for the timeout, and not much longer.");
+    XCTAssertTrue(_messageQueue.droppedMessageCount == numDropped + 1, @"A message that timed out should be counted as dropped.");
+
+    [_messageQueue flushQueue];
+    XCTAssertTrue(numHandledMessages == numQueued, @"The message that timed out shouldn't run.");
+}
+
+
+- (void)testDispatchWaitingSucceedsOnceQueueIsFlushed
+{
+    size_t numQueued = [self fillQueue];
+    NSUInteger numDropped = _messageQueue.droppedMessageCount;
+
+    // Flush the queue from another thread while the dispatch waits for space.
+    SPCMessageQueue *messageQueue = _messageQueue;
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        [NSThread sleepForTimeInterval:0.1];
+        [messageQueue flushQueue];
+    });
+
+    const NSTimeInterval timeout = 5.0;
+    test_message_t message = { .sequence = numQueued };
+
+    NSDate *startDate = [NSDate date];
+    SPCMessageQueueDispatchStatus status = SPCMessageQueueDispatchWaiting(_messageQueue, countMessageHandler, &message, sizeof(message), timeout);
+    NSTimeInterval elapsed = -[startDate timeIntervalSinceNow];
+
+    XCTAssertTrue(status == kSPCMessageQueueDispatchQueued, @"Waiting should succeed once the queue is flushed.");
+    XCTAssertTrue(elapsed < timeout, @"Waiting should end when the flush frees up space.");
+    XCTAssertTrue(_messageQueue.droppedMessageCount == numDropped, @"A queued message shouldn't be counted as dropped.");
+
+    // The flush may or may not have run the new message already.
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    [_messageQueue flushQueue];
+    XCTAssertTrue(numHandledMessages == numQueued + 1, @"Every queued message should run exactly once.");
+}
+
+@end
@@ -122,6 +122,52 @@ const size_t kDefaultQueueSize = 4096;
 }
 
 
+- (void)testKeepsDuplicateKeysInInsertionOrder
+{
+    const size_t totalNumElems = 1024;
+    const size_t numKeys       = 8;
+    SPCPriorityQueueHandle handles[1024 + 1];
+    
+    SPCPriorityQueueEnableDuplicateKeys(&_pqueue);
+    
+    // Insert the elements round-robin over the keys, from the highest key down.
+    for (int numElem = 1; numElem <= totalNumElems; ++numElem)
+        XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&_pqueue, numKeys - numElem % numKeys, (void *)(sizeof(void *) * numElem), &handles[numElem]),
+                      @"Can't insert element into queue.");
+    
+    // Delete every fourth element from among the others with its key.
+    for (int numElem = 4; numElem <= totalNumElems; numElem += 4)
+        XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &handles[numElem]) == (void *)(sizeof(void *) * numElem),
+                      @"Queue deletes wrong element.");
+    
+    // Elements inserted in one go with an existing key go after the elements already holding it.
+    const SPCPriorityQueueKey sortedKeys[] = { numKeys, numKeys, numKeys };
+    void *const sortedElements[] = { (void *)(sizeof(void *) * (totalNumElems + 1)),
+                                     (void *)(sizeof(void *) * (totalNumElems + 2)),
+                                     (void *)(sizeof(void *) * (totalNumElems + 3)) };
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, sortedKeys, sortedElements, 3) == 3,
+                  @"Can't insert sorted elements into queue.");
+    
+    // Each key comes out in insertion order.
+    for (int numKey = 1; numKey <= numKeys; ++numKey) {
+        for (int numElem = 1; numElem <= totalNumElems + 3; ++numElem) {
+            if (numElem <= totalNumElems && (numElem % 4 == 0 || numKeys - numElem % numKeys != numKey))
+                continue;
+            if (numElem > totalNumElems && numKey != numKeys)
+                continue;
+            
+            test_elem_t retrieveElem;
+            retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+            XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * numElem) && retrieveElem.key == numKey,
+                          @"Queue returns wrong element.");
+        }
+    }
+    
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&_pqueue, 0) == NULL,
+                  @"Queue still holds elements after extracting everything from it.");
+}
+
+
 - (void)testMemoryAllocatorWorks
 {
     test_elem_t retrieveElem;
@@ -231,6 +277,312 @@ const size_t kDefaultQueueSize = 4096;
 }
 
 
+- (void)testGrowsBeyondItsLength
+{
+    SPCPriorityQueue localQueue;
+    
+    const size_t initialNumElems = 16;
+    const size_t slabLength = 64, reserveLength = 4;
+    const size_t totalNumElems = initialNumElems + slabLength * reserveLength;
+    XCTAssertTrue(SPCPriorityQueueInit(&localQueue, initialNumElems));
+    
+#if SPC_PQ_COMPACT_LINKS
+    // Compact links only address the initial storage, so the queue can't grow.
+    XCTAssertFalse(SPCPriorityQueueEnableGrowth(&localQueue, slabLength, reserveLength),
+                   @"Growth was enabled for a queue with compact links.");
+    
+    SPCPriorityQueueDispose(&localQueue);
+    return;
+#endif
+    
+    XCTAssertTrue(SPCPriorityQueueEnableGrowth(&localQueue, slabLength, reserveLength));
+    
+    // Use up the initial length and the whole reserve.
+    for (int numElem = 1; numElem <= totalNumElems; ++numElem)
+        XCTAssertTrue(SPCPriorityQueueInsertElement(&localQueue, numElem, (void *)(sizeof(void *) * numElem)),
+                      @"Can't insert element into queue.");
+    
+    XCTAssertFalse(SPCPriorityQueueInsertElement(&localQueue, totalNumElems + 1, (void *)(sizeof(void *) * (totalNumElems + 1))),
+                   @"Another element was inserted into a queue with an empty reserve.");
+    
+    // Refill the reserve and keep going.
+    XCTAssertTrue(SPCPriorityQueueReplenishGrowthReserve(&localQueue));
+    
+    for (int numElem = (int)totalNumElems + 1; numElem <= totalNumElems + slabLength; ++numElem)
+        XCTAssertTrue(SPCPriorityQueueInsertElement(&localQueue, numElem, (void *)(sizeof(void *) * numElem)),
+                      @"Can't insert element into queue after replenishing its reserve.");
+    
+    [self extractOrderedElementsFromQueue:&localQueue upTo:totalNumElems + slabLength];
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) == NULL,
+                  @"Queue still holds elements after extracting everything from it.");
+    
+    SPCPriorityQueueDispose(&localQueue);
+}
+
+
+- (void)testEnforcesPrioritiesWithAnyMaxHeight
+{
+    const size_t totalNumElems = 512;
+    const size_t maxHeights[] = { 0, 1, 2, 5, 32, 64 };
+    
+    for (int idx = 0; idx < sizeof(maxHeights) / sizeof(maxHeights[0]); ++idx) {
+        SPCPriorityQueue localQueue;
+        XCTAssertTrue(SPCPriorityQueueInitWithMaxHeight(&localQueue, totalNumElems, kSPCMemoryReclamationReferenceCounting, maxHeights[idx]),
+                      @"Can't init a queue with a max height of %zu.", maxHeights[idx]);
+        
+        [self fillQueueWithOrderedElements:&localQueue startingFrom:1 upTo:totalNumElems];
+        [self extractOrderedElementsFromQueue:&localQueue upTo:totalNumElems];
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) == NULL,
+                      @"Queue still holds elements after extracting everything from it.");
+        
+        SPCPriorityQueueDispose(&localQueue);
+    }
+}
+
+
+- (void)testExtractsElementsUpToKey
+{
+    const size_t totalNumElems = 1024;
+    void                *elements[1024];
+    SPCPriorityQueueKey  keys[1024];
+
+    XCTAssertTrue(SPCPriorityQueueExtractElementsUpToKey(&_pqueue, SPC_PQ_KEY_MAX, elements, keys, totalNumElems) == 0,
+                  @"An empty queue returns elements.");
+
+    [self fillQueueWithOrderedElements:&_pqueue startingFrom:1 upTo:totalNumElems];
+
+    XCTAssertTrue(SPCPriorityQueueExtractElementsUpToKey(&_pqueue, 0, elements, keys, totalNumElems) == 0,
+                  @"Queue returns elements beyond the given key.");
+
+    // Up to a key, over several runs.
+    size_t numExtracted = SPCPriorityQueueExtractElementsUpToKey(&_pqueue, 300, elements, keys, totalNumElems);
+    XCTAssertTrue(numExtracted == 300, @"Queue returns the wrong number of elements.");
+    for (int idx = 0; idx < numExtracted; ++idx)
+        XCTAssertTrue(elements[idx] == (void *)(sizeof(void *) * (idx + 1)) && keys[idx] == idx + 1,
+                      @"Queue returns wrong element.");
+
+    // Up to a count, without keys.
+    numExtracted = SPCPriorityQueueExtractElementsUpToKey(&_pqueue, SPC_PQ_KEY_MAX, elements, NULL, 5);
+    XCTAssertTrue(numExtracted == 5, @"Queue returns the wrong number of elements.");
+    for (int idx = 0; idx < numExtracted; ++idx)
+        XCTAssertTrue(elements[idx] == (void *)(sizeof(void *) * (idx + 301)), @"Queue returns wrong element.");
+
+    // The rest is still in order.
+    for (int numElem = 306; numElem <= totalNumElems; ++numElem) {
+        test_elem_t retrieveElem;
+
+        retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+        XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * numElem) && retrieveElem.key == numElem,
+                      @"Queue returns wrong element.");
+    }
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&_pqueue, 0) == NULL,
+                  @"Queue still holds elements after extracting everything from it.");
+}
+
+
+- (void)testInsertsSortedElements
+{
+    const size_t totalNumElems = 2048;
+    void                *elements[1024];
+    SPCPriorityQueueKey  keys[1024];
+
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, keys, elements, 0) == 0,
+                  @"Queue inserts elements that weren't given.");
+
+    // Two interleaved runs, so that the second one has to splice between the elements of the first.
+    for (int idx = 0; idx < totalNumElems / 2; ++idx) {
+        keys[idx]     = 2 * idx + 2;
+        elements[idx] = (void *)(sizeof(void *) * keys[idx]);
+    }
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, keys, elements, totalNumElems / 2) == totalNumElems / 2,
+                  @"Can't insert elements into queue.");
+
+    for (int idx = 0; idx < totalNumElems / 2; ++idx) {
+        keys[idx]     = 2 * idx + 1;
+        elements[idx] = (void *)(sizeof(void *) * keys[idx]);
+    }
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, keys, elements, totalNumElems / 2) == totalNumElems / 2,
+                  @"Can't insert elements into queue.");
+
+    // Keys out of order still go to the right place.
+    const SPCPriorityQueueKey unorderedKeys[] = { 3000, 2500, 2800 };
+    for (int idx = 0; idx < 3; ++idx)
+        elements[idx] = (void *)(sizeof(void *) * unorderedKeys[idx]);
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, unorderedKeys, elements, 3) == 3,
+                  @"Can't insert elements into queue.");
+
+    // Stops at misaligned data.
+    keys[0] = 3001; elements[0] = (void *)(sizeof(void *) * 3001);
+    keys[1] = 3002; elements[1] = (void *)1;
+    XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&_pqueue, keys, elements, 2) == 1,
+                  @"Queue accepts misaligned data.");
+
+    for (int numElem = 1; numElem <= totalNumElems; ++numElem) {
+        test_elem_t retrieveElem;
+
+        retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+        XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * numElem) && retrieveElem.key == numElem,
+                      @"Queue returns wrong element.");
+    }
+
+    const SPCPriorityQueueKey lastKeys[] = { 2500, 2800, 3000, 3001 };
+    for (int idx = 0; idx < 4; ++idx) {
+        test_elem_t retrieveElem;
+
+        retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+        XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * lastKeys[idx]) && retrieveElem.key == lastKeys[idx],
+                      @"Queue returns wrong element.");
+    }
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&_pqueue, 0) == NULL,
+                  @"Queue still holds elements after extracting everything from it.");
+}
+
+
+- (void)testDeletesAndUpdatesElementsByHandle
+{
+    const size_t totalNumElems = 1024;
+    SPCPriorityQueueHandle handles[1024 + 1];
+
+    for (int numElem = 1; numElem <= totalNumElems; ++numElem)
+        XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&_pqueue, numElem, (void *)(sizeof(void *) * numElem), &handles[numElem]),
+                      @"Can't insert element into queue.");
+
+    // Delete the even elements, from the middle of the queue.
+    for (int numElem = 2; numElem <= totalNumElems; numElem += 2)
+        XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &handles[numElem]) == (void *)(sizeof(void *) * numElem),
+                      @"Queue deletes wrong element.");
+    for (int numElem = 2; numElem <= totalNumElems; numElem += 2)
+        XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &handles[numElem]) == NULL,
+                      @"Queue deletes an element twice.");
+
+    // Elements inserted again under the same keys, likely into the same nodes, are not the deleted ones.
+    SPCPriorityQueueHandle oldHandles[1024 + 1];
+    memcpy(oldHandles, handles, sizeof(handles));
+    for (int numElem = 2; numElem <= totalNumElems; numElem += 2)
+        XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&_pqueue, numElem, (void *)(sizeof(void *) * numElem), &handles[numElem]),
+                      @"Can't insert element into queue.");
+    for (int numElem = 2; numElem <= totalNumElems; numElem += 2)
+        XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &oldHandles[numElem]) == NULL,
+                      @"Queue deletes an element by a stale handle.");
+
+    // Move the multiples of three behind the rest.
+    for (int numElem = 3; numElem <= totalNumElems; numElem += 3)
+        XCTAssertTrue(SPCPriorityQueueUpdateElementKey(&_pqueue, &handles[numElem], totalNumElems + numElem),
+                      @"Can't change the key of an element.");
+
+    for (int numElem = 1; numElem <= totalNumElems; ++numElem) {
+        if (numElem % 3 == 0)
+            continue;
+
+        test_elem_t retrieveElem;
+        retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+        XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * numElem) && retrieveElem.key == numElem,
+                      @"Queue returns wrong element.");
+    }
+    for (int numElem = 3; numElem <= totalNumElems; numElem += 3) {
+        test_elem_t retrieveElem;
+        retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&_pqueue, &retrieveElem.key);
+        XCTAssertTrue(retrieveElem.data == (void *)(sizeof(void *) * numElem) && retrieveElem.key == totalNumElems + numElem,
+                      @"Queue returns wrong element.");
+    }
+
+    XCTAssertFalse(SPCPriorityQueueUpdateElementKey(&_pqueue, &handles[3], 1),
+                   @"Queue changes the key of an extracted element.");
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&_pqueue, 0) == NULL,
+                  @"Queue still holds elements after extracting everything from it.");
+}
+
+
+- (void)testDoesNotUpdateKeyOverAnotherElement
+{
+    SPCPriorityQueueHandle firstHandle;
+    SPCPriorityQueueHandle secondHandle;
+
+    XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&_pqueue, 1, (void *)(sizeof(void *)), &firstHandle),
+                  @"Can't insert element into queue.");
+    XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&_pqueue, 2, (void *)(2 * sizeof(void *)), &secondHandle),
+                  @"Can't insert element into queue.");
+
+    // The element whose key is taken stays where it was, and so does the element that has the key.
+    XCTAssertFalse(SPCPriorityQueueUpdateElementKey(&_pqueue, &firstHandle, 2),
+                   @"Queue changes the key of an element to the key of another one.");
+    XCTAssertTrue(firstHandle._key == 1, @"Handle doesn't refer to the element under its old key.");
+
+    XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &secondHandle) == (void *)(2 * sizeof(void *)),
+                  @"Queue loses the element that has the key.");
+    XCTAssertTrue(SPCPriorityQueueDeleteElement(&_pqueue, &firstHandle) == (void *)(sizeof(void *)),
+                  @"Queue loses the element whose key was to be changed.");
+    XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&_pqueue, 0) == NULL,
+                  @"Queue still holds elements after deleting everything from it.");
+}
+
+
+- (void)testDoesNotReplaceElementInsertedUnderOldKeyWhileUpdating
+{
+    void *const movingData   = (void *)(sizeof(void *));
+    void *const blockingData = (void *)(2 * sizeof(void *));
+    void *const racingData   = (void *)(3 * sizeof(void *));
+
+    const int numIters = 200;
+
+    for (int reps = 0; reps < 2000; ++reps) {
+        __block SPCPriorityQueue localQueue;
+        XCTAssertTrue(SPCPriorityQueueInit(&localQueue, 64));
+
+        // The moving element can never take the key of the blocking one, so every update puts it back under its old key.
+        SPCPriorityQueueHandle movingHandle;
+        XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&localQueue, 1, movingData, &movingHandle));
+        XCTAssertTrue(SPCPriorityQueueInsertElement(&localQueue, 2, blockingData));
+
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+
+        dispatch_suspend(queue);
+
+        // Keep updating the key of the moving element.
+        dispatch_group_async(group, queue, ^{
+            SPCPriorityQueueHandle handle = movingHandle;
+            for (int iter = 0; iter < numIters; ++iter)
+                XCTAssertFalse(SPCPriorityQueueUpdateElementKey(&localQueue, &handle, 2),
+                               @"Queue changes the key of an element to the key of another one.");
+        });
+
+        // Meanwhile, insert another element under the old key, which lands there while the moving element is out of the
+        // queue, and take it out again. The update must not replace its data.
+        dispatch_group_async(group, queue, ^{
+            for (int iter = 0; iter < numIters; ++iter) {
+                SPCPriorityQueueHandle handle;
+                if (SPCPriorityQueueInsertElementWithHandle(&localQueue, 1, racingData, &handle)) {
+                    void *data = SPCPriorityQueueDeleteElement(&localQueue, &handle);
+                    XCTAssertTrue(data == NULL || data == racingData,
+                                  @"Updating an element replaced the data of an element inserted under its old key.");
+                }
+            }
+        });
+
+        dispatch_resume(queue);
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+        // Inserting over the moving element replaces it, but otherwise it is still there, and only once.
+        size_t numMoving = 0, numBlocking = 0, numOther = 0;
+        void *data;
+        while ((data = SPCPriorityQueueExtractMinimumElement(&localQueue, 0))) {
+            if (data == movingData)
+                ++numMoving;
+            else if (data == blockingData)
+                ++numBlocking;
+            else
+                ++numOther;
+        }
+
+        XCTAssertTrue(numMoving <= 1 && numBlocking == 1 && numOther == 0,
+                      @"Queue lost or duplicated elements while updating a key.");
+
+        SPCPriorityQueueDispose(&localQueue);
+    }
+}
+
+
 
 - (void)fillQueueWithOrderedElements:(SPCPriorityQueue *)localQueue
                         startingFrom:(const size_t)startIdx
@@ -509,6 +861,130 @@ const size_t kDefaultQueueSize = 4096;
 }
 
 
+- (void)testHandlesParallelBatchDeletions
+{
+    for (int reps = 0; reps < 2000; ++reps) {
+        __block SPCPriorityQueue localQueue;
+        __block SPCPriorityQueue resultQueue;
+        
+        const size_t totalNumElems = 64;
+        const size_t numDelThreads = 32;
+        XCTAssertTrue(SPCPriorityQueueInit(&localQueue, totalNumElems));
+        XCTAssertTrue(SPCPriorityQueueInit(&resultQueue, totalNumElems));
+        
+        
+        [self fillQueueWithOrderedElements:&localQueue
+                              startingFrom:1
+                                      upTo:totalNumElems];
+        
+        
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+        
+        dispatch_suspend(queue);
+        
+        // Delete in batches and move to results.
+        for (int iter = 1; iter <= numDelThreads; ++iter) {
+            
+            dispatch_group_async(group, queue, ^{
+                
+                // Retrieve the elements.
+                void                *elements[4];
+                SPCPriorityQueueKey  keys[4];
+                
+                SPCPriorityQueueKey prevKey = 0;
+                for (int numBatch = 0; numBatch < totalNumElems; ++numBatch) {
+                    size_t numExtracted = SPCPriorityQueueExtractElementsUpToKey(&localQueue, 3 * totalNumElems / 4, elements, keys, 1 + numBatch % 4);
+                    for (int idx = 0; idx < numExtracted; ++idx) {
+                        SPCPriorityQueueInsertElement(&resultQueue, keys[idx], elements[idx]);
+                        
+                        XCTAssertTrue(prevKey < keys[idx], @"The queue does not enforce priorities");
+                        XCTAssertTrue(keys[idx] <= 3 * totalNumElems / 4, @"Queue returns elements beyond the given key.");
+                        prevKey = keys[idx];
+                    }
+                }
+            });
+        }
+        
+        dispatch_resume(queue);
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        
+        [self extractOrderedElementsFromQueue:&resultQueue upTo:3 * totalNumElems / 4];
+        
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) == (void *)(sizeof(void *) * (3 * totalNumElems / 4 + 1)),
+                      @"Queue lost the elements beyond the given key.");
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&resultQueue, 0) == NULL,
+                      @"Queue still holds elements after extracting everything from it.");
+        SPCPriorityQueueDispose(&localQueue);
+        SPCPriorityQueueDispose(&resultQueue);
+    }
+}
+
+- (void)testHandlesParallelDeletionsByHandle
+{
+    for (int reps = 0; reps < 2000; ++reps) {
+        __block SPCPriorityQueue localQueue;
+        __block SPCPriorityQueue resultQueue;
+
+        const size_t totalNumElems = 64;
+        const size_t numDelThreads = 32;
+        XCTAssertTrue(SPCPriorityQueueInit(&localQueue, totalNumElems));
+        XCTAssertTrue(SPCPriorityQueueInit(&resultQueue, totalNumElems));
+
+        SPCPriorityQueueHandle *handles      = calloc(totalNumElems + 1, sizeof(SPCPriorityQueueHandle));
+        size_t                 *numRetrieved = calloc(numDelThreads, sizeof(size_t));
+
+        for (int numElem = 1; numElem <= totalNumElems; ++numElem)
+            XCTAssertTrue(SPCPriorityQueueInsertElementWithHandle(&localQueue, numElem, (void *)(sizeof(void *) * numElem), &handles[numElem]),
+                          @"Can't insert element into queue.");
+
+
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+
+        dispatch_suspend(queue);
+
+        // Half of the threads delete by handle, from the back, while the other half extract from the front.
+        for (int iter = 0; iter < numDelThreads; ++iter) {
+
+            dispatch_group_async(group, queue, ^{
+
+                for (int idx = 0; idx < totalNumElems; ++idx) {
+                    SPCPriorityQueueKey key = totalNumElems - idx;
+                    void *data = (iter % 2) ? SPCPriorityQueueDeleteElement(&localQueue, &handles[key])
+                                            : SPCPriorityQueueExtractMinimumElement(&localQueue, &key);
+                    if (data) {
+                        XCTAssertTrue(data == (void *)(sizeof(void *) * key), @"Queue returns wrong element.");
+                        SPCPriorityQueueInsertElement(&resultQueue, key, data);
+                        ++numRetrieved[iter];
+                    }
+                }
+            });
+        }
+
+        dispatch_resume(queue);
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+        size_t totalNumRetrieved = 0;
+        for (int iter = 0; iter < numDelThreads; ++iter)
+            totalNumRetrieved += numRetrieved[iter];
+        XCTAssertTrue(totalNumRetrieved == totalNumElems, @"Queue returns an element more than once.");
+
+        [self extractOrderedElementsFromQueue:&resultQueue upTo:totalNumElems];
+
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) == NULL,
+                      @"Queue still holds elements after deleting everything from it.");
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&resultQueue, 0) == NULL,
+                      @"Queue still holds elements after extracting everything from it.");
+        SPCPriorityQueueDispose(&localQueue);
+        SPCPriorityQueueDispose(&resultQueue);
+        free(handles);
+        free(numRetrieved);
+    }
+}
+
+
+
 - (void)runParallelInsertAndDeleteForNumberOfElems:(size_t)numElems
                                    numberOfThreads:(size_t)numThreads
                                       numberOfRuns:(size_t)numRuns
@@ -634,4 +1110,285 @@ const size_t kDefaultQueueSize = 4096;
 }
 
 
+
+#pragma mark - Reclamation schemes
+
+
+
+- (void)runParallelDeletionsWithReclamationScheme:(SPCMemoryReclamationScheme)scheme
+                                     magazineSize:(size_t)magazineSize
+{
+    for (int reps = 0; reps < 200; ++reps) {
+        __block SPCPriorityQueue localQueue;
+        __block SPCPriorityQueue resultQueue;
+        
+        const size_t totalNumElems = 256;
+        const size_t numDelThreads = 32;
+        
+        // Every thread may strand a full magazine of nodes.
+        const size_t queueLength = totalNumElems + numDelThreads * magazineSize;
+        XCTAssertTrue(SPCPriorityQueueInitWithReclamationScheme(&localQueue, queueLength, scheme));
+        XCTAssertTrue(SPCPriorityQueueInitWithReclamationScheme(&resultQueue, queueLength, scheme));
+        
+        if (magazineSize) {
+            XCTAssertTrue(SPCPriorityQueueEnableMagazines(&localQueue, magazineSize));
+            XCTAssertTrue(SPCPriorityQueueEnableMagazines(&resultQueue, magazineSize));
+        }
+        
+        [self fillQueueWithOrderedElements:&localQueue
+                              startingFrom:1
+                                      upTo:totalNumElems];
+        
+        dispatch_group_t group = dispatch_group_create();
+        dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+        
+        dispatch_suspend(queue);
+        
+        // Delete and move to results.
+        for (int iter = 1; iter <= numDelThreads; ++iter) {
+            dispatch_group_async(group, queue, ^{
+                test_elem_t retrieveElem;
+                while ((retrieveElem.data = SPCPriorityQueueExtractMinimumElement(&localQueue, &retrieveElem.key)))
+                    XCTAssertTrue(SPCPriorityQueueInsertElement(&resultQueue, retrieveElem.key, retrieveElem.data),
+                                  @"Can't insert element into queue.");
+            });
+        }
+        
+        dispatch_resume(queue);
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        
+        [self extractOrderedElementsFromQueue:&resultQueue upTo:totalNumElems];
+        
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) == NULL,
+                      @"Queue still holds elements after extracting everything from it.");
+        XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&resultQueue, 0) == NULL,
+                      @"Queue still holds elements after extracting everything from it.");
+        
+        SPCPriorityQueueDispose(&localQueue);
+        SPCPriorityQueueDispose(&resultQueue);
+    }
+}
+
+
+- (void)testHandlesParallelDeletionsWithHazardPointers
+{
+    [self runParallelDeletionsWithReclamationScheme:kSPCMemoryReclamationHazardPointers magazineSize:0];
+}
+
+
+- (void)testHandlesParallelDeletionsWithEpochs
+{
+    [self runParallelDeletionsWithReclamationScheme:kSPCMemoryReclamationEpochs magazineSize:0];
+}
+
+
+- (void)testHandlesParallelDeletionsWithMagazines
+{
+    [self runParallelDeletionsWithReclamationScheme:kSPCMemoryReclamationReferenceCounting magazineSize:16];
+}
+
+
+- (void)testHandlesParallelDeletionsWithEpochsAndMagazines
+{
+    [self runParallelDeletionsWithReclamationScheme:kSPCMemoryReclamationEpochs magazineSize:16];
+}
+
+
+static NSString *reclamationSchemeName(SPCMemoryReclamationScheme scheme)
+{
+    switch (scheme) {
+        case kSPCMemoryReclamationHazardPointers: return @"hazard pointers";
+        case kSPCMemoryReclamationEpochs:         return @"epochs";
+        default:                                  return @"reference counting";
+    }
+}
+
+
+static const size_t kBenchmarkNumElems         = 1024;
+static const size_t kBenchmarkNumOpsPerThread  = 10000;
+static const size_t kBenchmarkMaxNumThreads    = 32;
+
+
+/**
+ *  Run a mix of operations on a queue holding a band of elements that are extracted and put back further down
+ *  the queue, followed by a band of elements that are only ever overwritten (a traversal without allocation).
+ *
+ *  @return The elapsed time.
+ */
+- (NSTimeInterval)runMixWithExtractPercentage:(unsigned int)extractPercentage
+                            reclamationScheme:(SPCMemoryReclamationScheme)scheme
+                              numberOfThreads:(size_t)numThreads
+{
+    __block SPCPriorityQueue localQueue;
+    XCTAssertTrue(SPCPriorityQueueInitWithReclamationScheme(&localQueue,
+                                                            2 * kBenchmarkNumElems + numThreads * (kCMemRetiredSlotCount + 1),
+                                                            scheme));
+    
+    const SPCPriorityQueueKey fixedBandStart = SPC_PQ_KEY_MAX / 2;
+    
+    [self fillQueueWithOrderedElements:&localQueue startingFrom:1 upTo:kBenchmarkNumElems];
+    for (SPCPriorityQueueKey key = fixedBandStart; key < fixedBandStart + kBenchmarkNumElems; ++key)
+        SPCPriorityQueueInsertElement(&localQueue, key, (void *)(sizeof(void *)));
+    
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestQueue", DISPATCH_QUEUE_CONCURRENT);
+    
+    dispatch_suspend(queue);
+    
+    for (size_t iter = 0; iter < numThreads; ++iter) {
+        dispatch_group_async(group, queue, ^{
+            unsigned int seed = (unsigned int)iter + 1;
+            
+            for (size_t op = 0; op < kBenchmarkNumOpsPerThread; ++op) {
+                seed = seed * 1103515245 + 12345;
+                
+                if ((seed >> 16) % 100 < extractPercentage) {
+                    SPCPriorityQueueKey key;
+                    void *data = SPCPriorityQueueExtractMinimumElement(&localQueue, &key);
+                    if (data)
+                        SPCPriorityQueueInsertElement(&localQueue, key + kBenchmarkNumElems, data);
+                } else
+                    SPCPriorityQueueInsertElement(&localQueue, fixedBandStart + (seed >> 16) % kBenchmarkNumElems, (void *)(sizeof(void *)));
+            }
+        });
+    }
+    
+    NSDate *startDate = [NSDate date];
+    
+    dispatch_resume(queue);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    NSTimeInterval elapsed = -[startDate timeIntervalSinceNow];
+    
+    SPCPriorityQueueDispose(&localQueue);
+    
+    return elapsed;
+}
+
+
+- (void)measureMixWithExtractPercentage:(unsigned int)extractPercentage
+                      reclamationScheme:(SPCMemoryReclamationScheme)scheme
+{
+    [self measureBlock:^{
+        for (size_t numThreads = 1; numThreads <= kBenchmarkMaxNumThreads; numThreads *= 2) {
+            NSTimeInterval elapsed = [self runMixWithExtractPercentage:extractPercentage
+                                                     reclamationScheme:scheme
+                                                       numberOfThreads:numThreads];
+            NSLog(@"%u%% extractions, %@, %zu threads: %.0f ns/op",
+                  extractPercentage,
+                  reclamationSchemeName(scheme),
+                  numThreads,
+                  elapsed * 1e9 / (numThreads * kBenchmarkNumOpsPerThread));
+        }
+    }];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithReferenceCounting
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationReferenceCounting];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithHazardPointers
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationHazardPointers];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithReferenceCounting
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationReferenceCounting];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithHazardPointers
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationHazardPointers];
+}
+
+
+- (void)testPerformanceReadHeavyMixWithEpochs
+{
+    [self measureMixWithExtractPercentage:10 reclamationScheme:kSPCMemoryReclamationEpochs];
+}
+
+
+- (void)testPerformanceExtractHeavyMixWithEpochs
+{
+    [self measureMixWithExtractPercentage:90 reclamationScheme:kSPCMemoryReclamationEpochs];
+}
+
+
+- (void)testPerformanceInitializesLargeQueue
+{
+    // The default size of the real-time scheduler's queue.
+    const size_t totalNumElems = 86400;
+    
+    [self measureBlock:^{
+        for (int reps = 0; reps < 100; ++reps) {
+            SPCPriorityQueue localQueue;
+            XCTAssertTrue(SPCPriorityQueueInit(&localQueue, totalNumElems));
+            XCTAssertTrue(SPCPriorityQueueInsertElement(&localQueue, 1, (void *)(sizeof(void *))));
+            SPCPriorityQueueDispose(&localQueue);
+        }
+    }];
+}
+
+
+- (void)testPerformanceInsertsIntoLargeQueue
+{
+    // The default size of the real-time scheduler's queue.
+    const size_t totalNumElems = 86400;
+    
+    [self measureBlock:^{
+        SPCPriorityQueue localQueue;
+        XCTAssertTrue(SPCPriorityQueueInit(&localQueue, totalNumElems));
+        
+        // Scatter the keys, so that every insert has to search the queue.
+        for (size_t numElem = 1; numElem <= totalNumElems; ++numElem)
+            XCTAssertTrue(SPCPriorityQueueInsertElement(&localQueue, (numElem * 7919) % totalNumElems + 1, (void *)(sizeof(void *) * numElem)));
+        
+        for (size_t numElem = 1; numElem <= totalNumElems; ++numElem)
+            XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) != NULL);
+        
+        SPCPriorityQueueDispose(&localQueue);
+    }];
+}
+
+
+- (void)testPerformanceInsertsSortedElementsIntoLargeQueue
+{
+    // The default size of the real-time scheduler's queue.
+    const size_t totalNumElems = 86400;
+    const size_t batchLength   = 1024;
+
+    SPCPriorityQueueKey *keys     = malloc(sizeof(SPCPriorityQueueKey) * batchLength);
+    void               **elements = malloc(sizeof(void *) * batchLength);
+
+    [self measureBlock:^{
+        SPCPriorityQueue localQueue;
+        XCTAssertTrue(SPCPriorityQueueInit(&localQueue, totalNumElems));
+
+        // Interleave the batches, so that every batch lands between the elements already in the queue.
+        const size_t numBatches = totalNumElems / batchLength;
+        for (size_t numBatch = 0; numBatch < numBatches; ++numBatch) {
+            for (size_t idx = 0; idx < batchLength; ++idx) {
+                keys[idx]     = idx * numBatches + numBatch + 1;
+                elements[idx] = (void *)(sizeof(void *) * keys[idx]);
+            }
+            XCTAssertTrue(SPCPriorityQueueInsertSortedElements(&localQueue, keys, elements, batchLength) == batchLength);
+        }
+
+        for (size_t numElem = 1; numElem <= numBatches * batchLength; ++numElem)
+            XCTAssertTrue(SPCPriorityQueueExtractMinimumElement(&localQueue, 0) != NULL);
+
+        SPCPriorityQueueDispose(&localQueue);
+    }];
+
+    free(keys);
+    free(elements);
+}
+
+
 @end
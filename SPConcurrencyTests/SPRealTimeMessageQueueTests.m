@@ -0,0 +1,100 @@
+//
+//  SPRealTimeMessageQueueTests.m
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 06/01/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "SPCMessageQueue.h"
+#import "SPCRealTimeMessageQueue.h"
+
+
+
+#define kNumCommands 10
+
+
+static size_t handledCommands[kNumCommands];
+static size_t numHandledCommands;
+
+
+static void recordCommandHandler(void *arguments, size_t argumentsLength)
+{
+    assert(arguments && argumentsLength == sizeof(size_t));
+
+    if (numHandledCommands < kNumCommands)
+        handledCommands[numHandledCommands] = *(size_t *)arguments;
+
+    ++numHandledCommands;
+}
+
+
+
+@interface SPRealTimeMessageQueueTests : XCTestCase
+{
+    SPCMessageQueue         *_responseQueue;
+    SPCRealTimeMessageQueue *_realTimeMessageQueue;
+}
+
+@end
+
+
+
+@implementation SPRealTimeMessageQueueTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    numHandledCommands = 0;
+
+    _responseQueue = [[SPCMessageQueue alloc] initWithName:@"com.pzhivkov.testResponseQueue"];
+    XCTAssertNotNil(_responseQueue, @"Response queue can't be initialized.");
+
+    _realTimeMessageQueue = [[SPCRealTimeMessageQueue alloc] initWithResponseQueue:_responseQueue];
+    XCTAssertNotNil(_realTimeMessageQueue, @"Real-time message queue can't be initialized.");
+}
+
+- (void)tearDown
+{
+    _realTimeMessageQueue = nil;
+    _responseQueue = nil;
+    [super tearDown];
+}
+
+
+
+- (void)testProcessesMessagesWithinBudget
+{
+    const size_t maxMessages = 4;
+
+    for (size_t idx = 0; idx < kNumCommands; ++idx)
+        XCTAssertTrue(SPCRealTimeMessageQueueDispatch(_realTimeMessageQueue, recordCommandHandler, &idx, sizeof(idx)) == kSPCMessageQueueDispatchQueued,
+                      @"Queue should have space for the commands.");
+
+    // The first pass stops at the budget, and leaves the rest in place.
+    size_t remainingMessages = SIZE_MAX;
+    size_t processed = SPCRealTimeMessageQueueProccessMessagesWithBudget(_realTimeMessageQueue, maxMessages, 0, &remainingMessages);
+
+    XCTAssertTrue(processed == maxMessages, @"A pass should process exactly the budget when there are more messages.");
+    XCTAssertTrue(remainingMessages == kNumCommands - maxMessages, @"The messages over the budget should be left in the queue.");
+    XCTAssertTrue(numHandledCommands == maxMessages, @"Only the messages within the budget should run.");
+
+    // The next pass picks up where the first one stopped.
+    remainingMessages = SIZE_MAX;
+    processed = SPCRealTimeMessageQueueProccessMessagesWithBudget(_realTimeMessageQueue, SIZE_MAX, 0, &remainingMessages);
+
+    XCTAssertTrue(processed == kNumCommands - maxMessages, @"The next pass should process the messages that were left.");
+    XCTAssertTrue(remainingMessages == 0, @"No messages should be left.");
+    XCTAssertTrue(numHandledCommands == kNumCommands, @"Every message should run exactly once.");
+
+    for (size_t idx = 0; idx < kNumCommands; ++idx)
+        XCTAssertTrue(handledCommands[idx] == idx, @"Messages should run in the order they were dispatched.");
+
+    XCTAssertTrue(SPCRealTimeMessageQueueProccessMessagesWithBudget(_realTimeMessageQueue, maxMessages, 0, NULL) == 0,
+                  @"An empty queue has nothing to process.");
+}
+
+@end
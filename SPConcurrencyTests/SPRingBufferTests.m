@@ -0,0 +1,202 @@
+//
+//  SPRingBufferTests.m
+//  Peter Zhivkov.
+//
+//  Created by Peter Zhivkov on 12/02/2014.
+//  Copyright (c) 2014 Peter Zhivkov. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#include "SPCRingBuffer.h"
+
+
+
+@interface SPRingBufferTests : XCTestCase
+{
+    SPCRingBuffer _buffer;
+}
+
+@end
+
+
+const size_t kDefaultRingBufferLength = 16384;
+
+
+
+@implementation SPRingBufferTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    XCTAssertTrue(SPCRingBufferInit(&_buffer, kDefaultRingBufferLength), @"Ring buffer can't be initialized.");
+}
+
+- (void)tearDown
+{
+    SPCRingBufferDispose(&_buffer);
+    [super tearDown];
+}
+
+
+
+- (void)testWritesAndReadsAcrossTheEnd
+{
+    size_t available = 0;
+
+    for (unsigned int iter = 0; iter < 3 * kDefaultRingBufferLength / sizeof(iter); iter += 3) {
+
+        unsigned int *writePtr = SPCRingBufferGetForWrite(&_buffer, &available);
+        XCTAssertTrue(writePtr && available >= 3 * sizeof(iter), @"Buffer should have space.");
+
+        writePtr[0] = iter;
+        writePtr[1] = iter + 1;
+        writePtr[2] = iter + 2;
+        SPCRingBufferMarkWritten(&_buffer, 3 * sizeof(iter));
+
+        unsigned int *readPtr = SPCRingBufferGetForRead(&_buffer, &available);
+        XCTAssertTrue(readPtr && available == 3 * sizeof(iter), @"Buffer should contain exactly what was written.");
+        XCTAssertTrue(readPtr[0] == iter && readPtr[1] == iter + 1 && readPtr[2] == iter + 2, @"Data is corrupted.");
+        SPCRingBufferMarkRead(&_buffer, 3 * sizeof(iter));
+    }
+
+    XCTAssertTrue(!SPCRingBufferGetForRead(&_buffer, &available) && !available, @"Buffer should be empty.");
+}
+
+
+- (void)testDoesNotOverfill
+{
+    size_t available = 0;
+
+    XCTAssertTrue(SPCRingBufferGetForWrite(&_buffer, &available), @"Buffer should have space.");
+    SPCRingBufferMarkWritten(&_buffer, available);
+
+    XCTAssertTrue(!SPCRingBufferGetForWrite(&_buffer, &available) && !available, @"Buffer should be full.");
+
+    SPCRingBufferClear(&_buffer);
+    XCTAssertTrue(!SPCRingBufferGetForRead(&_buffer, &available) && !available, @"Buffer should be empty.");
+}
+
+
+- (void)testGetsMinimumSpaceForWriting
+{
+    size_t available = 0;
+
+    XCTAssertTrue(SPCRingBufferGetForWrite(&_buffer, &available), @"Buffer should have space.");
+    SPCRingBufferMarkWritten(&_buffer, available - sizeof(void *));
+
+    XCTAssertTrue(!SPCRingBufferGetForWriteMinimum(&_buffer, 2 * sizeof(void *), &available), @"Buffer should be almost full.");
+
+    // Reading frees up space, which the producer sees when it asks for more than it has cached.
+    XCTAssertTrue(SPCRingBufferGetForRead(&_buffer, &available), @"Buffer should have data.");
+    SPCRingBufferMarkRead(&_buffer, sizeof(void *));
+
+    XCTAssertTrue(SPCRingBufferGetForWriteMinimum(&_buffer, 2 * sizeof(void *), &available) && available == 2 * sizeof(void *),
+                  @"Buffer should have exactly the space that was read.");
+}
+
+
+- (void)testConcurrentProducersKeepTheirOrder
+{
+    const int numThreads  = 8;
+    const int numMessages = 10000;
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_queue_create("com.pzhivkov.concurrentTestRingBuffer", DISPATCH_QUEUE_CONCURRENT);
+
+    for (int thread = 0; thread < numThreads; ++thread) {
+
+        dispatch_group_async(group, queue, ^{
+            for (int iter = 0; iter < numMessages; ++iter) {
+
+                int *message;
+                while (!(message = SPCRingBufferReserveForWrite_MPSC(&_buffer, 2 * sizeof(int))))
+                    sched_yield();
+
+                message[0] = thread;
+                message[1] = iter;
+                SPCRingBufferCommitWrite_MPSC(&_buffer, message, 2 * sizeof(int));
+            }
+        });
+    }
+
+    int nextMessage[numThreads];
+    memset(nextMessage, 0, sizeof(nextMessage));
+
+    for (int received = 0; received < numThreads * numMessages;) {
+
+        size_t available = 0;
+        int *message = SPCRingBufferGetForRead_MPSC(&_buffer, &available);
+        if (!message) {
+            sched_yield();
+            continue;
+        }
+
+        XCTAssertTrue(available >= 2 * sizeof(int), @"Message is truncated.");
+        XCTAssertTrue(message[1] == nextMessage[message[0]]++, @"Messages from one producer are out of order.");
+
+        SPCRingBufferMarkReadAndClear_MPSC(&_buffer);
+        ++received;
+    }
+
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+}
+
+
+- (void)testCountsCommittedChunks
+{
+    int *first  = SPCRingBufferReserveForWrite_MPSC(&_buffer, sizeof(int));
+    int *second = SPCRingBufferReserveForWrite_MPSC(&_buffer, 3 * sizeof(int));
+    int *third  = SPCRingBufferReserveForWrite_MPSC(&_buffer, sizeof(int));
+    XCTAssertTrue(first && second && third, @"Buffer should have space.");
+
+    SPCRingBufferCommitWrite_MPSC(&_buffer, first, sizeof(int));
+    SPCRingBufferCommitWrite_MPSC(&_buffer, third, sizeof(int));
+    XCTAssertTrue(SPCRingBufferGetCommittedCount_MPSC(&_buffer) == 1, @"Counting should stop at the first uncommitted chunk.");
+
+    SPCRingBufferCommitWrite_MPSC(&_buffer, second, 3 * sizeof(int));
+    XCTAssertTrue(SPCRingBufferGetCommittedCount_MPSC(&_buffer) == 3, @"All chunks should be counted.");
+
+    size_t available = 0;
+    XCTAssertTrue(SPCRingBufferGetForRead_MPSC(&_buffer, &available), @"Buffer should have data.");
+    SPCRingBufferMarkReadAndClear_MPSC(&_buffer);
+    XCTAssertTrue(SPCRingBufferGetCommittedCount_MPSC(&_buffer) == 2, @"Read chunks should not be counted.");
+}
+
+
+- (void)testCountsCommittedChunksInFullBuffer
+{
+    const size_t chunkBytes = 64 - sizeof(size_t);
+    size_t numChunks = 0;
+
+    void *chunk;
+    while ((chunk = SPCRingBufferReserveForWrite_MPSC(&_buffer, chunkBytes))) {
+        SPCRingBufferCommitWrite_MPSC(&_buffer, chunk, chunkBytes);
+        ++numChunks;
+    }
+    XCTAssertTrue(numChunks == _buffer._length / 64, @"Buffer should be filled up to its length.");
+
+    XCTAssertTrue(SPCRingBufferGetCommittedCount_MPSC(&_buffer) == numChunks, @"All chunks of a full buffer should be counted.");
+}
+
+
+- (void)testPerformanceMarkWritten
+{
+    [self measureBlock:^{
+        size_t available = 0;
+
+        for (int iter = 0; iter < 1000000; ++iter) {
+
+            (void)SPCRingBufferGetForWrite(&_buffer, &available);
+            SPCRingBufferMarkWritten(&_buffer, sizeof(void *));
+
+            (void)SPCRingBufferGetForRead(&_buffer, &available);
+            SPCRingBufferMarkRead(&_buffer, sizeof(void *));
+        }
+    }];
+}
+
+
+
+@end